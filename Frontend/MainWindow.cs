@@ -61,6 +61,7 @@ public partial class MainWindow: Gtk.Window
     private const string STR_DEFAULT_SAVE_FILE_NAME="";
     private const string STR_DIRTY_MARKER = "*";
     private const string STR_FILE_EXTENSION = ".mmgs";
+    private const string STR_BINARY_FILE_EXTENSION = ".mmgb"; //saved in the compact binary format instead
 
     //UI resource paths
     private const string RES_ADDSTAND_ICON = "Frontend.Assets.addstandicon.png";
@@ -176,6 +177,7 @@ public partial class MainWindow: Gtk.Window
         FileFilter mmgsFileFilter = new FileFilter();
         mmgsFileFilter.Name = "Maps";
         mmgsFileFilter.AddPattern("*.mmgs");
+        mmgsFileFilter.AddPattern("*" + STR_BINARY_FILE_EXTENSION);
         FileFilter allFileFilter = new FileFilter();
         allFileFilter.Name = "All Files";
         allFileFilter.AddPattern("*");
@@ -374,6 +376,8 @@ public partial class MainWindow: Gtk.Window
             Console.WriteLine("Exception while loading grid: " + e.Message + "\n\n" + e.StackTrace);
         }
 
+        //the whole grid is about to be drawn, so anything the engine has recorded as changed is stale
+        EngineAPI.getDirtyRegions();
         DrawType = (int)Enumerations.DrawType.InitialGridDraw;
     }
 
@@ -458,6 +462,7 @@ public partial class MainWindow: Gtk.Window
             FileFilter mmgsFilter = new FileFilter();
             mmgsFilter.Name = "Map";
             mmgsFilter.AddPattern("*.mmgs");
+            mmgsFilter.AddPattern("*" + STR_BINARY_FILE_EXTENSION);
             openMapSaveDialog.AddFilter(mmgsFilter);
             response = (ResponseType)openMapSaveDialog.Run();
             fileName = openMapSaveDialog.Filename;
@@ -575,7 +580,12 @@ public partial class MainWindow: Gtk.Window
     /// <param name="filePath">File path.</param>
     private string applyExtensionIfNecessary(string filePath)
     {
-        if(!filePath.Contains(STR_FILE_EXTENSION))
+        if(filePath.EndsWith(STR_BINARY_FILE_EXTENSION))
+        {
+            this.curFileName = filePath;
+            return filePath;
+        }
+        else if(!filePath.Contains(STR_FILE_EXTENSION))
         {
             this.curFileName = filePath + STR_FILE_EXTENSION;
             return filePath + STR_FILE_EXTENSION;
@@ -732,8 +742,17 @@ public partial class MainWindow: Gtk.Window
     {
         Stand stand = new Stand(args.SelectionData.Text);
 
-        //can Stand be placed here
-        if (EngineAPI.canApplyGrabbedStand((long)args.Y, (long)args.X) && isStandSelected)
+        long row = (long)args.Y;
+        long column = (long)args.X;
+
+        //can Stand be placed here, or failing that somewhere close by
+        bool fits = EngineAPI.canApplyGrabbedStand(row, column);
+        if (!fits && EngineAPI.snapGrabbedStand(row, column, false, true, out row, out column))
+        {
+            fits = EngineAPI.canApplyGrabbedStand(row, column);
+        }
+
+        if (fits && isStandSelected)
         {
             EngineAPI.doApplyGrabbedStand();
         }
@@ -745,8 +764,7 @@ public partial class MainWindow: Gtk.Window
                 md.Destroy();
             }
         }
-        DrawType = (int)Enumerations.DrawType.GridRedraw;
-        Grid.QueueDraw();
+        QueueDirtyRegions();
         isStandSelected = false;
     }
 
@@ -823,8 +841,7 @@ public partial class MainWindow: Gtk.Window
                     selectedStandInformation[KEY_CURRENT_STAND_WIDTH] = (int)EngineAPI.getSelectedStandWidth();
                     selectedStandInformation[KEY_CURRENT_STAND_HEIGHT] = (int)EngineAPI.getSelectedStandHeight();
 
-                    DrawType = (int)Enumerations.DrawType.GridRedraw;
-                    Grid.QueueDraw();
+                    QueueDirtyRegions();
                     isStandSelected = false;
                 }
                 else
@@ -844,6 +861,24 @@ public partial class MainWindow: Gtk.Window
 
     #region Grid Drawing
 
+    /// <summary>
+    /// Queues a redraw of only the parts of the mapping area the engine reports as changed since the last call.
+    /// Each region is widened to the 3 pixel blocks DrawGrid draws Tiles in, plus a pixel for the stroke's end caps.
+    /// </summary>
+    private void QueueDirtyRegions()
+    {
+        long[] regions = EngineAPI.getDirtyRegions();
+        DrawType = (int)Enumerations.DrawType.GridRedraw;
+        for (int i = 0; i + 3 < regions.Length; i += 4)
+        {
+            long top = regions[i] / 3 * 3 - 1;
+            long left = regions[i + 1] / 3 * 3 - 1;
+            long bottom = (regions[i] + regions[i + 2] + 2) / 3 * 3 + 1;
+            long right = (regions[i + 1] + regions[i + 3] + 2) / 3 * 3 + 1;
+            Grid.QueueDrawArea((int)left, (int)top, (int)(right - left), (int)(bottom - top));
+        }
+    }
+
     /// <summary>
     /// Mission Critical method for drawing.  Originally, many different enums with switch statements were used and partial redraws of the grid were calculated based on user
     /// movement in the mapping area.  However, after the design decision was made to have a 3 pixel per Tile ratio instead of a 1 pixel per Tile ratio the performance of drawing the grid
@@ -852,6 +887,9 @@ public partial class MainWindow: Gtk.Window
     /// 
     /// Past versions of this method can be viewed at https://github.com/thecisguy/map-my-garage-sale, but it has been greatly simplified since.
     /// 
+    /// Changes to Stands are now redrawn from the regions the engine itself records as changed (see QueueDirtyRegions), which are exact and
+    /// so do not leave the artifacting the old frontend-side clips did.  Only the Tiles inside the exposed area are drawn.
+    /// 
     /// This is still where all drawing physically takes place.
     /// 
     /// Fired when the drawable is exposed to the UI (window created, queued up manually, resized/minimized dialog)
@@ -873,13 +911,13 @@ public partial class MainWindow: Gtk.Window
             {
                 case (int)Enumerations.DrawType.GridRedraw:
                     {
-                        CairoGrid.DrawGrid(context);
+                        CairoGrid.DrawGrid(context, args.Event.Area);
                         break;
                     }
                 case (int)Enumerations.DrawType.InitialGridDraw:
                     {
                         CairoGrid.BackdropPath = string.Empty;
-                        CairoGrid.DrawGrid(context);
+                        CairoGrid.DrawGrid(context, args.Event.Area);
                         break;
                     }
                 default:
@@ -939,7 +977,8 @@ public partial class MainWindow: Gtk.Window
     }
 
     /// <summary>
-    /// When the user presses escape, deselect the currently selected stand in the grid if there is one
+    /// When the user presses escape, deselect the currently selected stand in the grid if there is one.
+    /// Ctrl+Z undoes the last edit to the map, and Ctrl+Y or Ctrl+Shift+Z redoes it; either deselects the stand.
     /// </summary>
     /// <param name="o">O.</param>
     /// <param name="args">Arguments.</param>
@@ -950,6 +989,22 @@ public partial class MainWindow: Gtk.Window
             EngineAPI.deselectStand();
             isStandSelected = false;
         }
+
+        if ((args.Event.State & Gdk.ModifierType.ControlMask) != 0)
+        {
+            bool shift = (args.Event.State & Gdk.ModifierType.ShiftMask) != 0;
+            bool changed = false;
+            if (args.Event.Key == Gdk.Key.z && !shift)
+                changed = EngineAPI.undo();
+            else if (args.Event.Key == Gdk.Key.y || args.Event.Key == Gdk.Key.Z
+                     || (args.Event.Key == Gdk.Key.z && shift))
+                changed = EngineAPI.redo();
+            if (changed)
+            {
+                isStandSelected = false;
+                QueueDirtyRegions();
+            }
+        }
     }
 
     #endregion
@@ -1013,10 +1068,7 @@ public partial class MainWindow: Gtk.Window
 
             CairoStand.Height = CairoStand.Width; //flip for rotation
             CairoStand.Width = CairoStand.Height;
-            DrawType = (int)Enumerations.DrawType.GridRedraw;
-            Grid.QueueDrawArea(selectedStandInformation[KEY_CURRENT_STAND_ORIGIN_X], selectedStandInformation[KEY_CURRENT_STAND_ORIGIN_Y], 
-                selectedStandInformation[KEY_CURRENT_STAND_WIDTH] + selectedStandInformation[KEY_CURRENT_STAND_HEIGHT], 
-                selectedStandInformation[KEY_PREVIOUS_STAND_HEIGHT] + selectedStandInformation[KEY_CURRENT_STAND_WIDTH]);
+            QueueDirtyRegions();
         }
         else
         {
@@ -1034,10 +1086,7 @@ public partial class MainWindow: Gtk.Window
         if (isStandSelected)
         {
             EngineAPI.removeSelectedStand();
-            DrawType = (int)Enumerations.DrawType.GridRedraw;
-            Grid.QueueDrawArea(selectedStandInformation[KEY_CURRENT_STAND_ORIGIN_X], selectedStandInformation[KEY_CURRENT_STAND_ORIGIN_Y], 
-                selectedStandInformation[KEY_CURRENT_STAND_WIDTH] + selectedStandInformation[KEY_CURRENT_STAND_HEIGHT], 
-                selectedStandInformation[KEY_PREVIOUS_STAND_HEIGHT] + selectedStandInformation[KEY_CURRENT_STAND_WIDTH]);
+            QueueDirtyRegions();
             isStandSelected = false;
         }
         else
@@ -36,24 +36,40 @@ namespace Frontend.Map
         public static string BackdropPath = string.Empty;
         public static bool DrawLines = true;
 
+        //colours of the sampled Tiles, filled by the engine and kept between exposes
+        private static uint[] tileColors = new uint[0];
+
         #endregion
 
         #region Drawing Methods
 
         /// <summary>
-        /// Takes in width, height and calls draw method.  The Height and Width are incremented by 3 instead of a 1:1 ratio due to performance issues when drawing to the grid.
+        /// Draws the Tiles inside the exposed area.  The Height and Width are incremented by 3 instead of a 1:1 ratio due to performance issues when drawing to the grid.
         /// </summary>
-        /// <param name="window">Window.</param>
-        /// <param name="width">Width.</param>
-        /// <param name="height">Height.</param>
-        public static void DrawGrid(Context context)
+        /// <param name="context">Context.</param>
+        /// <param name="area">The exposed area; only the Tiles in it are drawn.</param>
+        public static void DrawGrid(Context context, Gdk.Rectangle area)
         {
+            //start on the 3 pixel block containing the area's corner
+            int startHeight = Math.Max(area.Y, 0) / 3 * 3;
+            int startWidth = Math.Max(area.X, 0) / 3 * 3;
+            long endHeight = Math.Min((long)area.Y + area.Height, Height);
+            long endWidth = Math.Min((long)area.X + area.Width, Width);
 
-            for (int countHeight = 0; countHeight < Height; countHeight+=3)
+            if (startHeight >= endHeight || startWidth >= endWidth)
             {
-                for (int countWidth = 0; countWidth < Width; countWidth+=3)
+                return;
+            }
+
+            //fetch every sampled Tile's colour in one call rather than one call per Tile
+            EngineAPI.fillTileColors(startHeight, startWidth, (uint)(endHeight - startHeight), (uint)(endWidth - startWidth), 3, ref tileColors);
+
+            int index = 0;
+            for (int countHeight = startHeight; countHeight < endHeight; countHeight+=3)
+            {
+                for (int countWidth = startWidth; countWidth < endWidth; countWidth+=3)
                 {
-                    DrawTile(context, new PointD(countWidth, countHeight));
+                    DrawTile(context, new PointD(countWidth, countHeight), tileColors[index++]);
                 }
             }
             if (DrawLines)
@@ -167,7 +183,20 @@ namespace Frontend.Map
         public static void DrawTile(Context context, PointD point)
         {
             Cairo.Color color = EngineAPI.getColorOfTile((uint)point.Y, (uint)point.X); 
+            DrawTile(context, point, color);
+        }
 
+        /// <summary>
+        /// Draws a Tile whose colour was packed as 0xAARRGGBB by EngineAPI.fillTileColors.
+        /// </summary>
+        public static void DrawTile(Context context, PointD point, uint packed)
+        {
+            Cairo.Color color = new Cairo.Color(((packed >> 16) & 0xff) / 255.0, ((packed >> 8) & 0xff) / 255.0, (packed & 0xff) / 255.0);
+            DrawTile(context, point, color);
+        }
+
+        private static void DrawTile(Context context, PointD point, Cairo.Color color)
+        {
             context.Antialias = Antialias.None;
             context.SetSourceRGBA(color.R, color.G, color.B, 0.9);
             context.LineCap = LineCap.Round;
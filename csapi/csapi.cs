@@ -100,6 +100,44 @@ namespace csapi {
 		[MethodImplAttribute(MethodImplOptions.InternalCall)]
 		extern static void saveUserFileRaw(string filename);
 
+		[MethodImplAttribute(MethodImplOptions.InternalCall)]
+		extern static long[] getStandExtentsInRectRaw(long row,
+					long column, uint height, uint width);
+
+		[MethodImplAttribute(MethodImplOptions.InternalCall)]
+		extern static long[] getDirtyRegionsRaw();
+
+		[MethodImplAttribute(MethodImplOptions.InternalCall)]
+		extern static uint fillTileColorsRaw(long row, long column,
+					uint height, uint width, uint step, uint[] buffer);
+
+		[MethodImplAttribute(MethodImplOptions.InternalCall)]
+		extern static uint packTemplatesRaw(int[] st_ids, uint[] counts,
+					int objective, uint attempts);
+
+		[MethodImplAttribute(MethodImplOptions.InternalCall)]
+		extern static uint fillValidOriginsRaw(long row, long column,
+					uint height, uint width, uint step, byte[] buffer);
+
+		[MethodImplAttribute(MethodImplOptions.InternalCall)]
+		extern static long[] snapGrabbedStandRaw(long row, long column,
+					bool euclidean, bool anyOrientation);
+
+		[MethodImplAttribute(MethodImplOptions.InternalCall)]
+		extern static bool placeTemplatesRaw(int[] st_ids,
+					byte[] orientations, long[] rows, long[] columns,
+					byte[] statuses, int[] conflicts);
+
+		[MethodImplAttribute(MethodImplOptions.InternalCall)]
+		extern static bool undoRaw();
+
+		[MethodImplAttribute(MethodImplOptions.InternalCall)]
+		extern static bool redoRaw();
+
+		[MethodImplAttribute(MethodImplOptions.InternalCall)]
+		extern static long[] analyzeWalkabilityRaw(long[] entrances,
+					uint minAisle, bool measure);
+
 /***************** API Methods ***************************************/
 
 		public static Cairo.Color getColorOfTile(uint row, uint column) {
@@ -206,5 +244,90 @@ namespace csapi {
 		public static void saveUserFile(string filename) {
 			saveUserFileRaw(filename);
 		}
+
+		public static long[] getStandExtentsInRect(long row, long column,
+				uint height, uint width) {
+			return getStandExtentsInRectRaw(row, column, height, width);
+		}
+
+		public static long[] getDirtyRegions() {
+			return getDirtyRegionsRaw();
+		}
+
+		public static uint fillTileColors(long row, long column,
+				uint height, uint width, uint step, ref uint[] buffer) {
+			uint needed = fillTileColorsRaw(row, column, height, width,
+					step, buffer);
+			if (needed > buffer.Length) {
+				buffer = new uint[needed];
+				fillTileColorsRaw(row, column, height, width, step, buffer);
+			}
+			return needed;
+		}
+
+		// objectives for packTemplates, as in packer.h
+		public const int PackMaxFill = 0;
+		public const int PackMinArea = 1;
+
+		public static uint packTemplates(int[] st_ids, uint[] counts,
+				int objective, uint attempts) {
+			return packTemplatesRaw(st_ids, counts, objective, attempts);
+		}
+
+		public static bool snapGrabbedStand(long row, long column,
+				bool euclidean, bool anyOrientation,
+				out long snappedrow, out long snappedcolumn) {
+			long[] data = snapGrabbedStandRaw(row, column, euclidean,
+					anyOrientation);
+			snappedrow = data[1];
+			snappedcolumn = data[2];
+			return data[0] == 1;
+		}
+
+		// statuses set by placeTemplates, as in batch.h
+		public const byte PlaceOK = 0;
+		public const byte PlaceBadItem = 1;
+		public const byte PlaceOffGrid = 2;
+		public const byte PlaceOccupied = 3;
+		public const byte PlaceOverlap = 4;
+		public const byte PlaceNoMemory = 5;
+
+		public static bool placeTemplates(int[] st_ids, byte[] orientations,
+				long[] rows, long[] columns, out byte[] statuses,
+				out int[] conflicts) {
+			statuses = new byte[st_ids.Length];
+			conflicts = new int[st_ids.Length];
+			return placeTemplatesRaw(st_ids, orientations, rows, columns,
+					statuses, conflicts);
+		}
+
+		public static bool undo() {
+			return undoRaw();
+		}
+
+		public static bool redo() {
+			return redoRaw();
+		}
+
+		// distances of Stands given by analyzeWalkability
+		public const long WalkUnreachable = -1;
+		public const long WalkUnmeasured = -2;
+
+		public static long[] analyzeWalkability(long[] entrances,
+				uint minAisle, bool measure) {
+			return analyzeWalkabilityRaw(entrances, minAisle, measure);
+		}
+
+		public static uint fillValidOrigins(long row, long column,
+				uint height, uint width, uint step, ref byte[] buffer) {
+			uint needed = fillValidOriginsRaw(row, column, height, width,
+					step, buffer);
+			if (needed > buffer.Length) {
+				buffer = new byte[needed];
+				fillValidOriginsRaw(row, column, height, width, step,
+						buffer);
+			}
+			return needed;
+		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,362 @@
+/* batch.c
+ *
+ * This file contains definitions for applying many Stands to a Grid in one
+ * transaction: either every Stand of the batch is applied, or none is, and
+ * each one that couldn't be is given a reason.
+ *
+ * The whole batch is checked before anything is applied, in one pass over
+ * the occupied words of each shape, as can_apply would check them. Each
+ * word is tested against the Grid's occupancy plane and against a scratch
+ * plane holding the Stands of the batch checked so far, so the batch never
+ * touches the Grid until it is known to fit. The scratch plane only covers
+ * the bounding box of the batch, and is allocated zeroed, so the pages a
+ * sparse batch never touches cost nothing.
+ *
+ * Once everything fits, the Stands are applied one by one with
+ * prepare_apply and do_apply. Only running out of memory can stop that
+ * part way, in which case the Stands already applied are taken off again.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "templib.h"
+#include "batch.h"
+
+/* What place_stands works out about one item. */
+struct entry {
+	// the shape of the item in its orientation, and the bounding box
+	// of its occupied Tiles on the Grid
+	grid src;
+	struct extent e;
+
+	// the Stand applied for the item, and for a Stand that was passed
+	// in, where it was before, so it can be put back
+	stand placed;
+	uint8_t old_orientation;
+	grid old_g;
+	int64_t old_row;
+	int64_t old_column;
+};
+
+/* The Stands of the batch checked so far, as an occupancy plane covering
+ * rows row0 on, and columns from word word0 on.
+ */
+struct scratch {
+	int64_t row0;
+	int64_t word0;
+	uint32_t stride;
+	uint64_t *bits;
+};
+
+static enum place_status locate(grid g, struct place_item *item,
+                                struct entry *en);
+static enum place_status check_item(grid g, struct scratch *sc,
+                                    struct place_item *item,
+                                    struct entry *en);
+static void mark_item(struct scratch *sc, struct place_item *item,
+                      struct entry *en);
+static bool items_overlap(struct place_item *a, struct entry *ea,
+                          struct place_item *b, struct entry *eb);
+static void unplace(struct place_item *items, struct entry *entries,
+                    uint32_t num);
+
+/* Applies a batch of Stands to Grid g, all or none.
+ *
+ * Every item is checked as can_apply would check it, against the Stands
+ * already on the Grid and against the items before it, and its status is
+ * set to say whether it fits. If they all do, they are all applied, and
+ * the s of every template item is set to the Stand made for it. Each Stand
+ * may appear in the batch only once.
+ *
+ * Returns true if the batch was applied. Otherwise the Grid and the
+ * Stands passed in are left as they were, no new Stands are kept, and the
+ * status of each item that stood in the way says why.
+ */
+bool place_stands(grid g, struct place_item *items, uint32_t num) {
+	assert(g);
+	assert(items || num == 0);
+
+	bool ok = false;
+	struct entry *entries = malloc(sizeof(struct entry) * (num ? num : 1));
+	if (!entries) {
+		for (uint32_t i = 0; i < num; i++)
+			items[i].status = PLACE_NO_MEMORY;
+		goto out_entries;
+	}
+
+	// find every shape, and the rectangle the batch covers
+	bool fits = true;
+	int64_t top = g->height, bottom = 0, left = g->width, right = 0;
+	for (uint32_t i = 0; i < num; i++) {
+		items[i].status = locate(g, &items[i], &entries[i]);
+		items[i].conflict = UINT32_MAX;
+		struct extent *e = &entries[i].e;
+		if (items[i].status != PLACE_OK) {
+			fits = false;
+		} else if (e->height > 0) {
+			if (e->row < top)
+				top = e->row;
+			if (e->row + e->height > bottom)
+				bottom = e->row + e->height;
+			if (e->column < left)
+				left = e->column;
+			if (e->column + e->width > right)
+				right = e->column + e->width;
+		}
+	}
+
+	struct scratch sc = {0, 0, 0, NULL};
+	if (top < bottom) {
+		sc.row0 = top;
+		sc.word0 = left / OCC_WORD_BITS;
+		sc.stride = (right - 1) / OCC_WORD_BITS - sc.word0 + 1;
+		sc.bits = calloc((size_t) (bottom - top) * sc.stride,
+		                 sizeof(uint64_t));
+		if (!sc.bits) {
+			for (uint32_t i = 0; i < num; i++)
+				if (items[i].status == PLACE_OK)
+					items[i].status = PLACE_NO_MEMORY;
+			goto out_entries;
+		}
+	}
+
+	// check each item against the Grid and everything before it
+	for (uint32_t i = 0; i < num; i++) {
+		if (items[i].status != PLACE_OK || entries[i].e.height == 0)
+			continue;
+		items[i].status = check_item(g, &sc, &items[i], &entries[i]);
+		if (items[i].status == PLACE_OK) {
+			mark_item(&sc, &items[i], &entries[i]);
+			continue;
+		}
+		fits = false;
+		if (items[i].status != PLACE_OVERLAP)
+			continue;
+		for (uint32_t j = 0; j < i; j++) {
+			if (items[j].status == PLACE_OK
+			    && items_overlap(&items[i], &entries[i],
+			                     &items[j], &entries[j])) {
+				items[i].conflict = j;
+				break;
+			}
+		}
+	}
+	free(sc.bits);
+	if (!fits)
+		goto out_entries;
+
+	// everything fits, so only memory can stop us now
+	if (!grid_reserve_stands(g, num)) {
+		for (uint32_t i = 0; i < num; i++)
+			items[i].status = PLACE_NO_MEMORY;
+		goto out_entries;
+	}
+	for (uint32_t i = 0; i < num; i++) {
+		struct place_item *item = &items[i];
+		struct entry *en = &entries[i];
+		stand s = item->s;
+		if (!s) {
+			s = new_stand(item->t);
+			if (!s) {
+				item->status = PLACE_NO_MEMORY;
+				unplace(items, entries, i);
+				goto out_entries;
+			}
+		} else {
+			en->old_orientation = s->orientation;
+			en->old_g = s->g;
+			en->old_row = s->row;
+			en->old_column = s->column;
+		}
+		set_stand_orientation(s, item->orientation);
+		if (!prepare_apply(s, g, item->row, item->column)) {
+			item->status = PLACE_NO_MEMORY;
+			if (item->s)
+				set_stand_orientation(s, en->old_orientation);
+			else
+				del_stand(s);
+			unplace(items, entries, i);
+			goto out_entries;
+		}
+		do_apply(s);
+		en->placed = s;
+	}
+
+	for (uint32_t i = 0; i < num; i++)
+		items[i].s = entries[i].placed;
+	ok = true;
+
+out_entries:;
+	free(entries);
+	return ok;
+}
+
+/* Finds the shape of an item, and where its occupied Tiles would go.
+ *
+ * Returns PLACE_OK if it has a shape that lies on the Grid.
+ */
+static enum place_status locate(grid g, struct place_item *item,
+                                struct entry *en) {
+	orientation_set os;
+	if (item->orientation >= NUM_SYMMETRIES)
+		return PLACE_BAD_ITEM;
+	if (item->s) {
+		if (item->s->registry_index != STAND_UNREGISTERED)
+			return PLACE_BAD_ITEM;
+		os = item->s->orients;
+	} else if (item->t) {
+		// a template from a library gets its shape on first use
+		os = template_orients(item->t);
+		if (!os)
+			return PLACE_NO_MEMORY;
+	} else {
+		return PLACE_BAD_ITEM;
+	}
+
+	uint8_t index = os->index[item->orientation];
+	en->src = os->grids[index];
+	en->e = os->extents[index];
+	if (en->e.height == 0)
+		return PLACE_OK; // an empty shape fits anywhere
+
+	// coordinates are compared first, so nothing overflows
+	if (item->row < -(int64_t) g->height || item->row > g->height
+	    || item->column < -(int64_t) g->width
+	    || item->column > g->width)
+		return PLACE_OFF_GRID;
+	en->e.row += item->row;
+	en->e.column += item->column;
+	if (en->e.row < 0 || en->e.row + en->e.height > g->height
+	    || en->e.column < 0 || en->e.column + en->e.width > g->width)
+		return PLACE_OFF_GRID;
+	return PLACE_OK;
+}
+
+/* Checks an item that lies on the Grid against the Stands on the Grid and
+ * the items marked in the scratch plane. The Grid comes first, so that an
+ * item in the way of both is reported as PLACE_OCCUPIED.
+ */
+static enum place_status check_item(grid g, struct scratch *sc,
+                                    struct place_item *item,
+                                    struct entry *en) {
+	grid src = en->src;
+	bool overlap = false;
+	for (int64_t row = en->e.row; row < en->e.row + en->e.height; row++) {
+		const uint64_t *src_bits = src->occupancy
+			+ (size_t) (row - item->row) * src->occ_stride;
+		const uint64_t *bits = sc->bits
+			+ (size_t) (row - sc->row0) * sc->stride;
+		for (uint32_t w = 0; w < src->occ_stride; w++) {
+			if (!src_bits[w])
+				continue;
+			int64_t column = item->column + w * OCC_WORD_BITS;
+			if (src_bits[w] & grid_row_window(g, row, column))
+				return PLACE_OCCUPIED;
+			if (!overlap && (src_bits[w] & occupancy_window(
+				bits, sc->stride,
+				column - sc->word0 * OCC_WORD_BITS)))
+				overlap = true;
+		}
+	}
+	return overlap ? PLACE_OVERLAP : PLACE_OK;
+}
+
+/* Adds the Tiles of an item that fits to the scratch plane. */
+static void mark_item(struct scratch *sc, struct place_item *item,
+                      struct entry *en) {
+	grid src = en->src;
+	for (int64_t row = en->e.row; row < en->e.row + en->e.height; row++) {
+		const uint64_t *src_bits = src->occupancy
+			+ (size_t) (row - item->row) * src->occ_stride;
+		uint64_t *bits = sc->bits + (size_t) (row - sc->row0) * sc->stride;
+		for (uint32_t w = 0; w < src->occ_stride; w++) {
+			if (!src_bits[w])
+				continue;
+			// the 64 columns of this word straddle two words of
+			// the plane; only the occupied ones are sure to be on
+			// it
+			int64_t column = item->column + w * OCC_WORD_BITS
+				- sc->word0 * OCC_WORD_BITS;
+			int64_t word = column >= 0
+				? column / OCC_WORD_BITS
+				: -((-column + OCC_WORD_BITS - 1)
+				    / OCC_WORD_BITS);
+			unsigned shift = column - word * OCC_WORD_BITS;
+			uint64_t low = src_bits[w] << shift;
+			uint64_t high = shift ? src_bits[w]
+				>> (OCC_WORD_BITS - shift) : 0;
+			if (low)
+				bits[word] |= low;
+			if (high)
+				bits[word + 1] |= high;
+		}
+	}
+}
+
+/* Returns true if the occupied Tiles of two items that lie on the Grid
+ * overlap.
+ */
+static bool items_overlap(struct place_item *a, struct entry *ea,
+                          struct place_item *b, struct entry *eb) {
+	int64_t from = ea->e.row > eb->e.row ? ea->e.row : eb->e.row;
+	int64_t to = ea->e.row + ea->e.height < eb->e.row + eb->e.height
+		? ea->e.row + ea->e.height : eb->e.row + eb->e.height;
+	if (from >= to || ea->e.column >= eb->e.column + eb->e.width
+	    || eb->e.column >= ea->e.column + ea->e.width)
+		return false;
+
+	for (int64_t row = from; row < to; row++) {
+		const uint64_t *a_bits = ea->src->occupancy
+			+ (size_t) (row - a->row) * ea->src->occ_stride;
+		const uint64_t *b_bits = eb->src->occupancy
+			+ (size_t) (row - b->row) * eb->src->occ_stride;
+		for (uint32_t w = 0; w < ea->src->occ_stride; w++)
+			if (a_bits[w] && (a_bits[w] & occupancy_window(
+				b_bits, eb->src->occ_stride,
+				a->column + w * OCC_WORD_BITS - b->column)))
+				return true;
+	}
+	return false;
+}
+
+/* Takes the first num items of a batch back off the Grid, deleting the
+ * Stands made for templates and putting the others back as they were.
+ */
+static void unplace(struct place_item *items, struct entry *entries,
+                    uint32_t num) {
+	for (uint32_t i = num; i > 0; i--) {
+		struct entry *en = &entries[i - 1];
+		stand s = en->placed;
+		if (!items[i - 1].s) {
+			del_stand(s);
+			continue;
+		}
+		remove_stand(s);
+		set_stand_orientation(s, en->old_orientation);
+		s->g = en->old_g;
+		s->row = en->old_row;
+		s->column = en->old_column;
+	}
+}
@@ -0,0 +1,69 @@
+/* batch.h
+ *
+ * This file contains declarations for applying many Stands to a Grid in
+ * one transaction.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "grid.h"
+#include "stand.h"
+
+// why an item of a batch was or wasn't placed
+enum place_status {
+	PLACE_OK,
+	// no Stand or Stand Template, no such orientation, or the Stand
+	// is already applied
+	PLACE_BAD_ITEM,
+	// some of its Tiles would lie off the Grid
+	PLACE_OFF_GRID,
+	// it would overlap a Stand already on the Grid
+	PLACE_OCCUPIED,
+	// it would overlap an earlier item of the batch (see conflict)
+	PLACE_OVERLAP,
+	// memory ran out while placing it
+	PLACE_NO_MEMORY
+};
+
+/* One Stand to place: either an unapplied Stand, or, if s is NULL, a new
+ * Stand made from the Stand Template t. Its origin goes at (row, column),
+ * as for can_apply, turned to the given symmetry.
+ */
+struct place_item {
+	stand s;
+	stand_template t;
+	uint8_t orientation;
+	int64_t row;
+	int64_t column;
+
+	// filled in by place_stands; s is also set to the new Stand made
+	// for a template once the batch is placed
+	enum place_status status;
+	// for PLACE_OVERLAP, the index of the earliest item in the way
+	uint32_t conflict;
+};
+
+bool place_stands(grid g, struct place_item *items, uint32_t num);
+
+#endif
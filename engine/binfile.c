@@ -0,0 +1,1014 @@
+/* binfile.c
+ *
+ * This file contains definitions for the functions responsible
+ * for saving and loading the program in the binary (version 2) format.
+ *
+ * A version 2 file starts with the same "MMGS:<version>;" header as the
+ * textual format, so load_file can tell them apart, followed by a series of
+ * blocks. Every block is a four character tag and a 32-bit length, followed
+ * by that many bytes of payload; readers skip blocks with tags they do not
+ * know. All integers are little-endian.
+ *
+ *   GRID  width:u32 height:u32
+ *   TMPL  count:u32, then per Stand Template:
+ *           name_len:u16 name red:u8 green:u8 blue:u8 alpha:u8 mask
+ *   STND  count:u32, then per Stand:
+ *           name_len:u16 name red:u8 green:u8 blue:u8 alpha:u8
+ *           template:varint orientation:u8 row:zigzag column:zigzag
+ *           where template is one more than the index of the Stand
+ *           Template, or 0 for a Stand followed by its own base shape as
+ *           a mask
+ *   INDX  count:u32, then per Stand, in the order of STND:
+ *           record:varint top:varint left:varint height:varint
+ *           width:varint
+ *         where record is how far the Stand's record starts past the
+ *         previous Stand's (0 for the first), and the rest is the bounding
+ *         box of the Tiles it occupies, relative to its origin
+ *   END   checksum:u32, the FNV-1a hash of every byte between the header
+ *         and this block
+ *
+ * A mask is width:u32 height:u32 encoding:u8 length:u32, then length bytes
+ * holding the Tiles in row-major order, either as a bitmap (bit i of byte
+ * i / 8 is Tile i) or as alternating runs of empty and occupied Tiles,
+ * starting with an empty run, each a LEB128 number. The writer picks
+ * whichever is smaller.
+ *
+ * A varint is a LEB128 number, and a zigzag is a signed number folded
+ * into a varint so that small negative values stay short (0, -1, 1, -2
+ * are written as 0, 1, 2, 3).
+ *
+ * Stands made from a Stand Template refer to it by its index instead of
+ * repeating its shape. TMPL must come before STND.
+ *
+ * INDX lets open_map_index look a map over without loading it: the size
+ * and Stand Templates are at hand right away, and a Stand's record is only
+ * decoded when it is asked for. load_file doesn't need it, so files saved
+ * before it was added still load.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <assert.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "save_n_load.h"
+#include "binfile.h"
+#include "capi.h"
+#include "templib.h"
+
+#define BLOCK_TAG(a, b, c, d) ((uint32_t) (a) | (uint32_t) (b) << 8 \
+                               | (uint32_t) (c) << 16 | (uint32_t) (d) << 24)
+#define TAG_GRID BLOCK_TAG('G', 'R', 'I', 'D')
+#define TAG_TMPL BLOCK_TAG('T', 'M', 'P', 'L')
+#define TAG_STND BLOCK_TAG('S', 'T', 'N', 'D')
+#define TAG_INDX BLOCK_TAG('I', 'N', 'D', 'X')
+#define TAG_END  BLOCK_TAG('E', 'N', 'D', ' ')
+
+#define MASK_BITMAP 0
+#define MASK_RUNS   1
+
+// template index of a Stand that carries its own shape
+#define NO_TEMPLATE UINT32_MAX
+
+// smallest encodings of a Stand Template and a Stand, used to reject
+// counts the rest of the block could not possibly hold
+#define MIN_TEMPLATE_BYTES (2 + 4 + 13)
+#define MIN_STAND_BYTES    (2 + 4 + 1 + 1 + 2)
+
+#define INDEX_ENTRY_BYTES 5
+
+/* A growable byte buffer the file is assembled in before it is written. */
+struct out_buf {
+	uint8_t *data;
+	size_t len;
+	size_t cap;
+	bool failed;
+};
+
+/* A bounds-checked view of the bytes being read. Reading past the end
+ * sets failed and yields zeroes, so callers only need to check failed
+ * once they have read a whole record.
+ */
+struct in_buf {
+	const uint8_t *p;
+	const uint8_t *end;
+	bool failed;
+};
+
+static void put_bytes(struct out_buf *b, const void *src, size_t n);
+static void put_u8(struct out_buf *b, uint8_t v);
+static void put_u16(struct out_buf *b, uint16_t v);
+static void put_u32(struct out_buf *b, uint32_t v);
+static void put_varint(struct out_buf *b, uint64_t v);
+static void put_zigzag(struct out_buf *b, int64_t v);
+static void patch_u32(struct out_buf *b, size_t at, uint32_t v);
+static size_t begin_block(struct out_buf *b, uint32_t tag);
+static void end_block(struct out_buf *b, size_t at);
+static void put_color(struct out_buf *b, double red, double green,
+                      double blue, double alpha);
+static void put_name(struct out_buf *b, const char *name);
+static void put_mask(struct out_buf *b, grid g);
+static uint32_t template_index(stand s);
+static void put_index_entry(struct out_buf *b, size_t skip, stand s);
+
+static uint8_t get_u8(struct in_buf *b);
+static uint16_t get_u16(struct in_buf *b);
+static uint32_t get_u32(struct in_buf *b);
+static uint64_t get_varint(struct in_buf *b);
+static int64_t get_zigzag(struct in_buf *b);
+static const uint8_t *get_bytes(struct in_buf *b, size_t n);
+static char *get_name(struct in_buf *b);
+static grid get_mask(struct in_buf *b, stand_like sl);
+static bool read_templates_block(struct in_buf *b,
+                                 struct stand_template **st, int32_t *num);
+static bool read_stands_block(struct in_buf *b,
+                              struct stand_template *st, int32_t num_st,
+                              stand **stand_arr, int32_t *num);
+static stand get_stand(struct in_buf *b, uint32_t *tmpl);
+static bool get_origin(const uint8_t *record, const uint8_t *end,
+                       int64_t *row, int64_t *column);
+static void finish_stand(stand s, orientation_set tmpl_orients);
+static void discard_stand(stand s);
+static orientation_set index_template_shape(map_index mi, uint32_t t);
+
+bool save_file_binary(FILE *f) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	struct out_buf b = {NULL, 0, 0, false};
+
+	size_t at = begin_block(&b, TAG_GRID);
+	put_u32(&b, main_grid->width);
+	put_u32(&b, main_grid->height);
+	end_block(&b, at);
+
+	at = begin_block(&b, TAG_TMPL);
+	put_u32(&b, num_main_templates);
+	for (int32_t i = 0; i < num_main_templates; i++) {
+		stand_template tt = main_templates + i;
+		if (!template_orients(tt)) {
+			b.failed = true;
+			break;
+		}
+		put_name(&b, tt->name);
+		put_color(&b, tt->red, tt->green, tt->blue, tt->alpha);
+		put_mask(&b, tt->t);
+	}
+	end_block(&b, at);
+
+	// the registry of main_grid already lists every stand exactly once;
+	// the index is built alongside, to be written after
+	struct out_buf index = {NULL, 0, 0, false};
+	at = begin_block(&b, TAG_STND);
+	put_u32(&b, main_grid->num_stands);
+	size_t record = b.len;
+	for (uint32_t i = 0; i < main_grid->num_stands; i++) {
+		stand ss = main_grid->stands[i];
+		put_index_entry(&index, b.len - record, ss);
+		record = b.len;
+		uint32_t tmpl = template_index(ss);
+		put_name(&b, ss->name);
+		put_color(&b, ss->red, ss->green, ss->blue, ss->alpha);
+		put_varint(&b, tmpl == NO_TEMPLATE ? 0 : (uint64_t) tmpl + 1);
+		put_u8(&b, ss->orientation);
+		put_zigzag(&b, ss->row);
+		put_zigzag(&b, ss->column);
+		if (tmpl == NO_TEMPLATE)
+			put_mask(&b, ss->orients->grids[0]);
+	}
+	end_block(&b, at);
+
+	at = begin_block(&b, TAG_INDX);
+	put_u32(&b, main_grid->num_stands);
+	if (index.failed)
+		b.failed = true;
+	else
+		put_bytes(&b, index.data, index.len);
+	end_block(&b, at);
+	free(index.data);
+
+	uint32_t checksum = hash_bytes(b.data, b.len);
+	at = begin_block(&b, TAG_END);
+	put_u32(&b, checksum);
+	end_block(&b, at);
+
+	bool ok = !b.failed
+		&& fprintf(f, "MMGS:2;") > 0
+		&& fwrite(b.data, 1, b.len, f) == b.len;
+	if (ok)
+		record_save(strlen("MMGS:2;") + b.len, &start);
+	free(b.data);
+	return ok;
+}
+
+bool load_file_binary(const uint8_t *file, size_t len, size_t body) {
+	const uint8_t *data = file + body;
+	struct in_buf b = {data, file + len, false};
+
+	int32_t num_templates = 0;
+	struct stand_template *st_arr = NULL;
+	int32_t num_stands = 0;
+	stand *stand_arr = NULL;
+	grid g = NULL;
+	const uint8_t *stands_at = data;
+
+	// walk the block headers to find the checksum, and check it before
+	// believing anything else the file says
+	for (;;) {
+		const uint8_t *block_start = b.p;
+		uint32_t tag = get_u32(&b);
+		uint32_t length = get_u32(&b);
+		const uint8_t *payload = get_bytes(&b, length);
+		if (b.failed) {
+			set_load_error(block_start - file,
+			               "block runs past the end of the file");
+			return false;
+		}
+		if (tag == TAG_END) {
+			struct in_buf pb = {payload, payload + length, false};
+			if (get_u32(&pb) != hash_bytes(data, block_start - data)) {
+				set_load_error(block_start - file,
+				               "checksum mismatch");
+				return false;
+			}
+			break;
+		}
+	}
+
+	b.p = data;
+	for (;;) {
+		const uint8_t *block_start = b.p;
+		uint32_t tag = get_u32(&b);
+		uint32_t length = get_u32(&b);
+		const uint8_t *payload = get_bytes(&b, length);
+		struct in_buf pb = {payload, payload + length, false};
+
+		if (tag == TAG_END) {
+			break;
+		} else if (tag == TAG_GRID) {
+			if (g)
+				goto out_block;
+			uint32_t width = get_u32(&pb);
+			uint32_t height = get_u32(&pb);
+			if (pb.failed || width == 0 || height == 0)
+				goto out_block;
+			// very large maps are mostly empty space, so we
+			// only materialize the parts that hold Stands
+			if ((uint64_t) width * height > SPARSE_GRID_MIN_TILES)
+				g = new_sparse_grid(width, height);
+			else
+				g = new_grid(width, height);
+			if (!g)
+				goto out_block;
+		} else if (tag == TAG_TMPL) {
+			if (st_arr || stand_arr)
+				goto out_block;
+			if (!read_templates_block(&pb, &st_arr, &num_templates))
+				goto out_block;
+		} else if (tag == TAG_STND) {
+			if (stand_arr)
+				goto out_block;
+			stands_at = block_start;
+			if (!read_stands_block(&pb, st_arr, num_templates,
+			                       &stand_arr, &num_stands))
+				goto out_block;
+		}
+		// blocks from newer versions are skipped
+		continue;
+
+	out_block:;
+		set_load_error(block_start - file, "malformed block");
+		goto out_fail;
+	}
+
+	if (!g) {
+		set_load_error(body, "no GRID block");
+		goto out_fail;
+	}
+	if (!install_loaded_map(st_arr, num_templates,
+	                        stand_arr, num_stands, g)) {
+		set_load_error(stands_at - file,
+		               "a Stand overlaps another or lies off the Main Grid");
+		return false;
+	}
+	return true;
+
+out_fail:;
+	del_stand_templates(st_arr, num_templates);
+	for (int32_t i = 0; i < num_stands; i++)
+		del_stand(stand_arr[i]);
+	free(stand_arr);
+	if (g)
+		del_grid(g);
+	return false;
+}
+
+/* Opens a binary file to be looked over without loading it (see struct
+ * map_index). The file stays open, in memory, until del_map_index.
+ * 
+ * The checksum isn't verified, as that means reading the whole file.
+ * Instead, everything is checked as it is decoded, and load_file verifies
+ * the checksum as usual when the map is loaded for real.
+ * 
+ * Returns NULL if the file isn't a version 2 file with an index, or is
+ * malformed, or there isn't enough memory.
+ */
+map_index open_map_index(FILE *f) {
+	map_index mi = calloc(1, sizeof(struct map_index));
+	if (!mi)
+		return NULL;
+	if (!open_view(f, &mi->view)) {
+		free(mi);
+		return NULL;
+	}
+	const uint8_t *file = (const uint8_t *) mi->view.data;
+	const uint8_t *end = file + mi->view.len;
+	size_t header_len = strlen("MMGS:2;");
+	if (mi->view.len < header_len
+	    || memcmp(file, "MMGS:2;", header_len) != 0)
+		goto out_fail;
+
+	// the block headers alone say where everything is
+	struct in_buf b = {file + header_len, end, false};
+	struct in_buf tmpl = {NULL, NULL, true};
+	struct in_buf stnd = {NULL, NULL, true};
+	struct in_buf indx = {NULL, NULL, true};
+	bool have_grid = false;
+	for (;;) {
+		uint32_t tag = get_u32(&b);
+		uint32_t length = get_u32(&b);
+		const uint8_t *payload = get_bytes(&b, length);
+		if (b.failed)
+			goto out_fail;
+		struct in_buf pb = {payload, payload + length, false};
+
+		if (tag == TAG_END) {
+			break;
+		} else if (tag == TAG_GRID) {
+			mi->width = get_u32(&pb);
+			mi->height = get_u32(&pb);
+			have_grid = !pb.failed && mi->width && mi->height;
+		} else if (tag == TAG_TMPL) {
+			tmpl = pb;
+		} else if (tag == TAG_STND) {
+			stnd = pb;
+		} else if (tag == TAG_INDX) {
+			indx = pb;
+		}
+	}
+	if (!have_grid || tmpl.failed || stnd.failed || indx.failed)
+		goto out_fail;
+
+	// names and colours of the templates, skipping over their shapes
+	uint32_t count = get_u32(&tmpl);
+	if (tmpl.failed || count > INT32_MAX
+	    || count > (size_t) (tmpl.end - tmpl.p) / MIN_TEMPLATE_BYTES)
+		goto out_fail;
+	mi->templates = calloc(count ? count : 1,
+	                       sizeof(struct stand_template));
+	mi->template_masks = calloc(count ? count : 1, sizeof(uint8_t *));
+	if (!mi->templates || !mi->template_masks)
+		goto out_fail;
+	for (uint32_t i = 0; i < count; i++) {
+		stand_template t = &mi->templates[i];
+		t->name = get_name(&tmpl);
+		if (!t->name)
+			goto out_fail;
+		mi->num_templates = i + 1;
+		t->red = get_u8(&tmpl) / 255.0;
+		t->green = get_u8(&tmpl) / 255.0;
+		t->blue = get_u8(&tmpl) / 255.0;
+		t->alpha = get_u8(&tmpl) / 255.0;
+
+		mi->template_masks[i] = tmpl.p;
+		get_u32(&tmpl);
+		get_u32(&tmpl);
+		get_u8(&tmpl);
+		get_bytes(&tmpl, get_u32(&tmpl));
+		if (tmpl.failed)
+			goto out_fail;
+	}
+	mi->templates_end = tmpl.end;
+
+	// one index entry per Stand, each pointing a little further into
+	// STND than the last
+	mi->num_stands = get_u32(&stnd);
+	mi->stands = stnd.p;
+	mi->stands_end = stnd.end;
+	count = get_u32(&indx);
+	if (stnd.failed || indx.failed || count != mi->num_stands
+	    || count > (size_t) (indx.end - indx.p) / INDEX_ENTRY_BYTES)
+		goto out_fail;
+	mi->entries = calloc(count ? count : 1,
+	                     sizeof(struct map_index_entry));
+	if (!mi->entries)
+		goto out_fail;
+	size_t record = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		struct map_index_entry *e = &mi->entries[i];
+		record += get_varint(&indx);
+		uint64_t top = get_varint(&indx);
+		uint64_t left = get_varint(&indx);
+		uint64_t height = get_varint(&indx);
+		uint64_t width = get_varint(&indx);
+		if (indx.failed || record >= (size_t) (stnd.end - stnd.p)
+		    || top > UINT32_MAX || left > UINT32_MAX
+		    || height > UINT32_MAX || width > UINT32_MAX)
+			goto out_fail;
+		e->record = stnd.p + record;
+		e->top = top;
+		e->left = left;
+		e->height = height;
+		e->width = width;
+	}
+	return mi;
+
+out_fail:;
+	del_map_index(mi);
+	return NULL;
+}
+
+/* Closes a file opened with open_map_index. Stands already decoded from
+ * it are unaffected.
+ */
+void del_map_index(map_index mi) {
+	if (!mi)
+		return;
+	for (int32_t i = 0; i < mi->num_templates; i++) {
+		free(mi->templates[i].name);
+		if (mi->templates[i].orients)
+			del_orientation_set(mi->templates[i].orients);
+	}
+	free(mi->templates);
+	free(mi->template_masks);
+	free(mi->entries);
+	close_view(&mi->view);
+	free(mi);
+}
+
+/* Gets the bounding box of the Tiles Stand i occupies on the Main Grid,
+ * from the index and the origin at the head of the Stand's record.
+ * 
+ * Returns false if the record is malformed.
+ */
+bool map_index_extent(map_index mi, uint32_t i, struct extent *e) {
+	assert(i < mi->num_stands);
+
+	const struct map_index_entry *entry = &mi->entries[i];
+	if (!get_origin(entry->record, mi->stands_end, &e->row, &e->column))
+		return false;
+	e->row += entry->top;
+	e->column += entry->left;
+	e->height = entry->height;
+	e->width = entry->width;
+	return true;
+}
+
+/* Finds every Stand whose bounding box intersects the given rectangle, as
+ * stands_in_rect does for a loaded map, but by their numbers in the file.
+ * Stands whose records are malformed are left out.
+ * 
+ * Up to max of them are stored in out, which may be NULL if max is 0.
+ * 
+ * Returns the total number of Stands found, which may be greater than max.
+ */
+uint32_t map_index_in_rect(map_index mi, const struct extent *rect,
+                           uint32_t *out, uint32_t max) {
+	uint32_t found = 0;
+	for (uint32_t i = 0; i < mi->num_stands; i++) {
+		struct extent e;
+		if (!map_index_extent(mi, i, &e)
+		    || e.row >= rect->row + rect->height
+		    || rect->row >= e.row + e.height
+		    || e.column >= rect->column + rect->width
+		    || rect->column >= e.column + e.width)
+			continue;
+
+		if (found < max)
+			out[found] = i;
+		found++;
+	}
+	return found;
+}
+
+/* Decodes Stand i of a file opened with open_map_index into a new Stand,
+ * not applied to any Grid. The shape of the Stand Template it was made
+ * from is decoded too, the first time it is needed.
+ * 
+ * Returns NULL if the Stand's record is malformed, or there isn't enough
+ * memory.
+ */
+stand map_index_stand(map_index mi, uint32_t i) {
+	assert(i < mi->num_stands);
+
+	struct in_buf b = {mi->entries[i].record, mi->stands_end, false};
+	uint32_t tmpl;
+	stand s = get_stand(&b, &tmpl);
+	if (!s)
+		return NULL;
+	orientation_set tmpl_orients = NULL;
+	if (tmpl != NO_TEMPLATE) {
+		tmpl_orients = index_template_shape(mi, tmpl);
+		if (!tmpl_orients) {
+			discard_stand(s);
+			return NULL;
+		}
+	}
+	finish_stand(s, tmpl_orients);
+	return s;
+}
+
+/* Returns the shape of Stand Template t of a file opened with
+ * open_map_index, decoding it if it hasn't been yet. Returns NULL if there
+ * is no such template, or its shape is malformed.
+ */
+static orientation_set index_template_shape(map_index mi, uint32_t t) {
+	if (t >= (uint32_t) mi->num_templates)
+		return NULL;
+	stand_template tt = &mi->templates[t];
+	if (tt->orients)
+		return tt->orients;
+
+	struct in_buf b = {mi->template_masks[t], mi->templates_end, false};
+	stand_like tl;
+	tl.stand_proto.type = STAND_TEMPLATE;
+	tl.stand_st.st = tt;
+	grid shape = get_mask(&b, tl);
+	if (!shape)
+		return NULL;
+	tt->orients = new_orientation_set(shape);
+	if (!tt->orients) {
+		del_grid(shape);
+		return NULL;
+	}
+	tt->t = shape;
+	return tt->orients;
+}
+
+/* Reads the payload of a TMPL block. On failure, nothing is left
+ * allocated.
+ */
+static bool read_templates_block(struct in_buf *b,
+                                 struct stand_template **st, int32_t *num) {
+	uint32_t count = get_u32(b);
+	if (b->failed || count > INT32_MAX
+	    || count > (size_t) (b->end - b->p) / MIN_TEMPLATE_BYTES)
+		return false;
+	struct stand_template *new_st =
+		calloc(count ? count : 1, sizeof(struct stand_template));
+	if (!new_st)
+		return false;
+
+	uint32_t i;
+	for (i = 0; i < count; i++) {
+		stand_template t = &new_st[i];
+		t->name = get_name(b);
+		if (!t->name)
+			goto out_fail;
+		t->red = get_u8(b) / 255.0;
+		t->green = get_u8(b) / 255.0;
+		t->blue = get_u8(b) / 255.0;
+		t->alpha = get_u8(b) / 255.0;
+
+		stand_like tl;
+		tl.stand_proto.type = STAND_TEMPLATE;
+		tl.stand_st.st = t;
+		grid shape = get_mask(b, tl);
+		if (!shape)
+			goto out_name;
+		t->orients = new_orientation_set(shape);
+		if (!t->orients) {
+			del_grid(shape);
+			goto out_name;
+		}
+		t->t = shape;
+	}
+
+	*st = new_st;
+	*num = count;
+	return true;
+
+out_name:;
+	free(new_st[i].name);
+out_fail:;
+	del_stand_templates(new_st, i);
+	return false;
+}
+
+/* Reads the payload of a STND block, resolving template references against
+ * the given templates. On failure, nothing is left allocated.
+ */
+static bool read_stands_block(struct in_buf *b,
+                              struct stand_template *st, int32_t num_st,
+                              stand **stand_arr, int32_t *num) {
+	uint32_t count = get_u32(b);
+	if (b->failed || count > INT32_MAX
+	    || count > (size_t) (b->end - b->p) / MIN_STAND_BYTES)
+		return false;
+	stand *new_stands = calloc(count ? count : 1, sizeof(stand));
+	if (!new_stands)
+		return false;
+
+	uint32_t i;
+	for (i = 0; i < count; i++) {
+		uint32_t tmpl;
+		stand s = get_stand(b, &tmpl);
+		if (!s)
+			goto out_fail;
+		if (tmpl != NO_TEMPLATE && tmpl >= (uint32_t) num_st) {
+			discard_stand(s);
+			goto out_fail;
+		}
+		finish_stand(s, tmpl == NO_TEMPLATE ? NULL : st[tmpl].orients);
+		new_stands[i] = s;
+	}
+
+	*stand_arr = new_stands;
+	*num = count;
+	return true;
+
+out_fail:;
+	while (i-- > 0)
+		del_stand(new_stands[i]);
+	free(new_stands);
+	return false;
+}
+
+/* Reads a Stand record into a new Stand, and stores the index of the Stand
+ * Template it refers to. If it has a shape of its own instead, that is
+ * read as well; otherwise finish_stand has to be given the template's.
+ * Returns NULL if the record is malformed.
+ */
+static stand get_stand(struct in_buf *b, uint32_t *tmpl) {
+	char *name = get_name(b);
+	if (!name)
+		return NULL;
+
+	stand s = calloc(1, sizeof(struct stand));
+	if (!s)
+		goto out_name;
+	s->name = name;
+	s->red = get_u8(b) / 255.0;
+	s->green = get_u8(b) / 255.0;
+	s->blue = get_u8(b) / 255.0;
+	s->alpha = get_u8(b) / 255.0;
+	uint64_t t = get_varint(b);
+	*tmpl = t ? (uint32_t) (t - 1) : NO_TEMPLATE;
+	// kept here until finish_stand has a shape to orient
+	s->orientation = get_u8(b);
+	s->row = get_zigzag(b);
+	s->column = get_zigzag(b);
+	if (b->failed || t > INT32_MAX || s->orientation >= NUM_SYMMETRIES)
+		goto out_stand;
+
+	if (*tmpl == NO_TEMPLATE) {
+		stand_like sl;
+		sl.stand_proto.type = STAND;
+		sl.stand_stand.s = s;
+		grid shape = get_mask(b, sl);
+		if (!shape)
+			goto out_stand;
+		s->orients = new_orientation_set(shape);
+		if (!s->orients) {
+			del_grid(shape);
+			goto out_stand;
+		}
+	}
+	return s;
+
+out_stand:;
+	free(s);
+out_name:;
+	free(name);
+	return NULL;
+}
+
+/* Reads just the origin of the Stand whose record starts at record,
+ * skipping what comes before it. Returns false if the record is
+ * malformed.
+ */
+static bool get_origin(const uint8_t *record, const uint8_t *end,
+                       int64_t *row, int64_t *column) {
+	struct in_buf b = {record, end, false};
+	get_bytes(&b, get_u16(&b));
+	get_bytes(&b, 4);
+	get_varint(&b);
+	get_u8(&b);
+	*row = get_zigzag(&b);
+	*column = get_zigzag(&b);
+	return !b.failed;
+}
+
+/* Finishes a Stand read by get_stand, giving it the shape of the Stand
+ * Template it refers to (tmpl_orients) if it has none of its own.
+ */
+static void finish_stand(stand s, orientation_set tmpl_orients) {
+	if (!s->orients)
+		s->orients = share_orientation_set(tmpl_orients);
+	s->registry_index = STAND_UNREGISTERED;
+	set_stand_orientation(s, s->orientation);
+}
+
+/* Deallocates a Stand read by get_stand that is not to be finished. */
+static void discard_stand(stand s) {
+	if (s->orients)
+		del_orientation_set(s->orients);
+	free(s->name);
+	free(s);
+}
+
+/* Reads a mask into a new Grid whose occupied Tiles hold sl. Returns NULL
+ * if the mask is malformed or the Grid can't be allocated.
+ */
+static grid get_mask(struct in_buf *b, stand_like sl) {
+	uint32_t width = get_u32(b);
+	uint32_t height = get_u32(b);
+	uint8_t encoding = get_u8(b);
+	uint32_t length = get_u32(b);
+	const uint8_t *payload = get_bytes(b, length);
+	if (b->failed || width == 0 || height == 0)
+		return NULL;
+	// shapes are nowhere near as big as a map that needs a sparse Grid,
+	// so anything that size is a bad file asking for a huge allocation
+	uint64_t tiles = (uint64_t) width * height;
+	if (tiles > SPARSE_GRID_MIN_TILES)
+		return NULL;
+
+	if (encoding == MASK_BITMAP) {
+		if (length != (tiles + 7) / 8)
+			return NULL;
+		grid g = new_grid(width, height);
+		if (!g)
+			return NULL;
+		for (uint64_t i = 0; i < tiles; i++) {
+			if (payload[i / 8] >> (i % 8) & 1)
+				grid_set_stand(g, i / width, i % width, sl);
+		}
+		return g;
+	} else if (encoding == MASK_RUNS) {
+		// check that the runs cover the Grid exactly before
+		// allocating anything
+		struct in_buf rb = {payload, payload + length, false};
+		uint64_t total = 0;
+		while (rb.p < rb.end && !rb.failed) {
+			uint64_t run = get_varint(&rb);
+			if (run > tiles - total)
+				return NULL;
+			total += run;
+		}
+		if (rb.failed || total != tiles)
+			return NULL;
+
+		grid g = new_grid(width, height);
+		if (!g)
+			return NULL;
+		rb.p = payload;
+		uint64_t i = 0;
+		bool occupied = false;
+		while (rb.p < rb.end) {
+			uint64_t run = get_varint(&rb);
+			if (occupied) {
+				for (uint64_t j = i; j < i + run; j++)
+					grid_set_stand(g, j / width,
+					               j % width, sl);
+			}
+			i += run;
+			occupied = !occupied;
+		}
+		return g;
+	}
+
+	return NULL;
+}
+
+/* Writes the occupied Tiles of a Grid as a mask, in whichever encoding is
+ * smaller.
+ */
+static void put_mask(struct out_buf *b, grid g) {
+	uint64_t tiles = (uint64_t) g->width * g->height;
+
+	// encode the runs into a scratch buffer to see how big they are
+	struct out_buf runs = {NULL, 0, 0, false};
+	bool occupied = false;
+	uint64_t run = 0;
+	for (uint64_t i = 0; i < tiles; i++) {
+		if (grid_occupied(g, i / g->width, i % g->width) != occupied) {
+			put_varint(&runs, run);
+			occupied = !occupied;
+			run = 0;
+		}
+		run++;
+	}
+	put_varint(&runs, run);
+
+	put_u32(b, g->width);
+	put_u32(b, g->height);
+	if (!runs.failed && runs.len < (tiles + 7) / 8) {
+		put_u8(b, MASK_RUNS);
+		put_u32(b, runs.len);
+		put_bytes(b, runs.data, runs.len);
+	} else {
+		put_u8(b, MASK_BITMAP);
+		put_u32(b, (tiles + 7) / 8);
+		uint8_t byte = 0;
+		for (uint64_t i = 0; i < tiles; i++) {
+			if (grid_occupied(g, i / g->width, i % g->width))
+				byte |= 1 << (i % 8);
+			if (i % 8 == 7 || i == tiles - 1) {
+				put_u8(b, byte);
+				byte = 0;
+			}
+		}
+	}
+	free(runs.data);
+}
+
+/* Writes the INDX entry of a Stand whose record starts skip bytes past
+ * the previous one's.
+ */
+static void put_index_entry(struct out_buf *b, size_t skip, stand s) {
+	struct extent e;
+	get_stand_extent(s, &e);
+	put_varint(b, skip);
+	put_varint(b, e.row - s->row);
+	put_varint(b, e.column - s->column);
+	put_varint(b, e.height);
+	put_varint(b, e.width);
+}
+
+/* Returns the index in main_templates of the Stand Template a Stand was
+ * made from, or NO_TEMPLATE if it has a shape of its own.
+ */
+static uint32_t template_index(stand s) {
+	for (int32_t i = 0; i < num_main_templates; i++) {
+		if (main_templates[i].orients == s->orients)
+			return i;
+	}
+	return NO_TEMPLATE;
+}
+
+static void put_color(struct out_buf *b, double red, double green,
+                      double blue, double alpha) {
+	put_u8(b, (uint8_t) (red * 255.0));
+	put_u8(b, (uint8_t) (green * 255.0));
+	put_u8(b, (uint8_t) (blue * 255.0));
+	put_u8(b, (uint8_t) (alpha * 255.0));
+}
+
+/* Writes a name. Longer ones than the format can hold fail the save,
+ * rather than be cut short.
+ */
+static void put_name(struct out_buf *b, const char *name) {
+	size_t len = strlen(name);
+	if (len > UINT16_MAX) {
+		b->failed = true;
+		return;
+	}
+	put_u16(b, len);
+	put_bytes(b, name, len);
+}
+
+/* Starts a block, returning where its length is to be patched in. */
+static size_t begin_block(struct out_buf *b, uint32_t tag) {
+	put_u32(b, tag);
+	size_t at = b->len;
+	put_u32(b, 0);
+	return at;
+}
+
+static void end_block(struct out_buf *b, size_t at) {
+	patch_u32(b, at, b->len - at - 4);
+}
+
+static void put_bytes(struct out_buf *b, const void *src, size_t n) {
+	if (b->failed)
+		return;
+	if (b->len + n > b->cap) {
+		size_t cap = b->cap ? b->cap : 4096;
+		while (cap < b->len + n)
+			cap *= 2;
+		uint8_t *nd = realloc(b->data, cap);
+		if (!nd) {
+			b->failed = true;
+			return;
+		}
+		b->data = nd;
+		b->cap = cap;
+	}
+	memcpy(b->data + b->len, src, n);
+	b->len += n;
+}
+
+static void put_u8(struct out_buf *b, uint8_t v) {
+	put_bytes(b, &v, 1);
+}
+
+static void put_u16(struct out_buf *b, uint16_t v) {
+	uint8_t bytes[2] = {v, v >> 8};
+	put_bytes(b, bytes, 2);
+}
+
+static void put_u32(struct out_buf *b, uint32_t v) {
+	uint8_t bytes[4] = {v, v >> 8, v >> 16, v >> 24};
+	put_bytes(b, bytes, 4);
+}
+
+static void put_varint(struct out_buf *b, uint64_t v) {
+	while (v >= 0x80) {
+		put_u8(b, (v & 0x7f) | 0x80);
+		v >>= 7;
+	}
+	put_u8(b, v);
+}
+
+static void put_zigzag(struct out_buf *b, int64_t v) {
+	put_varint(b, (uint64_t) v << 1 ^ (uint64_t) (v >> 63));
+}
+
+static void patch_u32(struct out_buf *b, size_t at, uint32_t v) {
+	if (b->failed)
+		return;
+	b->data[at] = v;
+	b->data[at + 1] = v >> 8;
+	b->data[at + 2] = v >> 16;
+	b->data[at + 3] = v >> 24;
+}
+
+static const uint8_t *get_bytes(struct in_buf *b, size_t n) {
+	if (b->failed || (size_t) (b->end - b->p) < n) {
+		b->failed = true;
+		return NULL;
+	}
+	const uint8_t *p = b->p;
+	b->p += n;
+	return p;
+}
+
+static uint8_t get_u8(struct in_buf *b) {
+	const uint8_t *p = get_bytes(b, 1);
+	return p ? p[0] : 0;
+}
+
+static uint16_t get_u16(struct in_buf *b) {
+	const uint8_t *p = get_bytes(b, 2);
+	return p ? (uint16_t) (p[0] | p[1] << 8) : 0;
+}
+
+static uint32_t get_u32(struct in_buf *b) {
+	const uint8_t *p = get_bytes(b, 4);
+	return p ? (uint32_t) p[0] | (uint32_t) p[1] << 8
+	           | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24 : 0;
+}
+
+static uint64_t get_varint(struct in_buf *b) {
+	uint64_t v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		uint8_t byte = get_u8(b);
+		v |= (uint64_t) (byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return v;
+	}
+	// too long to be a 64-bit number
+	b->failed = true;
+	return 0;
+}
+
+static int64_t get_zigzag(struct in_buf *b) {
+	uint64_t v = get_varint(b);
+	return (int64_t) (v >> 1 ^ -(v & 1));
+}
+
+/* Reads a name into a new NUL-terminated string, or returns NULL. */
+static char *get_name(struct in_buf *b) {
+	uint16_t len = get_u16(b);
+	const uint8_t *p = get_bytes(b, len);
+	if (!p)
+		return NULL;
+	char *name = malloc(len + 1);
+	if (!name)
+		return NULL;
+	memcpy(name, p, len);
+	name[len] = '\0';
+	return name;
+}
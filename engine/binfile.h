@@ -0,0 +1,91 @@
+/* binfile.h
+ *
+ * This file contains declarations for the functions responsible
+ * for saving and loading the program in the binary (version 2) format.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BINFILE_H
+#define BINFILE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "save_n_load.h"
+
+// file extension the frontend uses for binary saves
+#define BINARY_FILE_EXTENSION ".mmgb"
+
+bool save_file_binary(FILE *f);
+
+/* Loads a version 2 file from memory. body is the offset of the first
+ * block, just past the "MMGS:2;" header load_file has already checked.
+ */
+bool load_file_binary(const uint8_t *file, size_t len, size_t body);
+
+/* Where a Stand's record lies in a file opened with open_map_index, and
+ * the bounding box of the Tiles it occupies, relative to its origin.
+ */
+struct map_index_entry {
+	const uint8_t *record;
+	uint32_t top;
+	uint32_t left;
+	uint32_t height;
+	uint32_t width;
+};
+
+/* A binary file opened with open_map_index, to be looked over without
+ * loading it: browsing through past sales, say. The size of the map and
+ * its Stand Templates are read up front, and the bounding box of every
+ * Stand is at hand in the file's index, but shapes are only decoded once
+ * a Stand is asked for with map_index_stand.
+ */
+struct map_index {
+	uint32_t width;
+	uint32_t height;
+
+	// the shapes of these (t and orients) are NULL until a Stand made
+	// from them is decoded
+	struct stand_template *templates;
+	int32_t num_templates;
+
+	uint32_t num_stands;
+
+	// the file, and where the parts still to be decoded lie in it
+	struct file_view view;
+	const uint8_t **template_masks;
+	const uint8_t *templates_end;
+	const uint8_t *stands;
+	const uint8_t *stands_end;
+	struct map_index_entry *entries;
+};
+typedef struct map_index *map_index;
+
+map_index open_map_index(FILE *f);
+void del_map_index(map_index mi);
+bool map_index_extent(map_index mi, uint32_t i, struct extent *e);
+uint32_t map_index_in_rect(map_index mi, const struct extent *rect,
+                           uint32_t *out, uint32_t max);
+stand map_index_stand(map_index mi, uint32_t i);
+
+#endif
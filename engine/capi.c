@@ -39,10 +39,29 @@
 #include "stand.h"
 #include "capi.h"
 #include "save_n_load.h"
+#include "binfile.h"
+#include "spatial.h"
+#include "journal.h"
+#include "templib.h"
+#include "packer.h"
+#include "origins.h"
+#include "batch.h"
+#include "history.h"
+#include "walk.h"
 
 grid main_grid;
+// the template library in use, if any; kept open as long as there are
+// templates borrowing from it
+static template_library main_library = NULL;
 static stand selected_stand = NULL;
 static stand grabbed_stand = NULL;
+// whether grabbed_stand was lifted from the Main Grid, or else the
+// Stand Template it was made from, for the journal
+static bool grabbed_was_lifted = false;
+static int32_t grabbed_template;
+// where a lifted grabbed_stand was lifted from, for the history
+static int64_t lifted_row;
+static int64_t lifted_column;
 static MonoDomain *main_domain;
 static MonoAssembly *main_assembly;
 struct stand_template *main_templates = NULL;
@@ -73,6 +92,29 @@ static MonoArray *get_color_of_st(int32_t st_id);
 static void set_st_name(int32_t st_id, MonoString *newname);
 static MonoString *get_st_name(int32_t st_id);
 static void save_user_file(MonoString *ufile);
+static MonoArray *get_stand_extents_in_rect(int64_t row, int64_t column,
+                                            uint32_t height, uint32_t width);
+static MonoArray *get_dirty_regions(void);
+static uint32_t fill_tile_colors(int64_t row, int64_t column,
+                                 uint32_t height, uint32_t width,
+                                 uint32_t step, MonoArray *buffer);
+static uint32_t pack_templates(MonoArray *st_ids, MonoArray *counts,
+                               int32_t objective, uint32_t attempts);
+static uint32_t fill_valid_origins(int64_t row, int64_t column,
+                                   uint32_t height, uint32_t width,
+                                   uint32_t step, MonoArray *buffer);
+static MonoArray *snap_grabbed_stand(int64_t row, int64_t column,
+                                     mono_bool euclidean,
+                                     mono_bool any_orientation);
+static mono_bool place_templates(MonoArray *st_ids, MonoArray *orientations,
+                                 MonoArray *rows, MonoArray *columns,
+                                 MonoArray *statuses, MonoArray *conflicts);
+static void settle_grabbed_stand(void);
+static mono_bool undo_edit(void);
+static mono_bool redo_edit(void);
+static MonoArray *analyze_walkability(MonoArray *entrances,
+                                      uint32_t min_aisle,
+                                      mono_bool measure);
 
 static MonoArray *get_color_of_tile(uint32_t row, uint32_t column) {
 	
@@ -128,6 +170,37 @@ void initialize_engine(void) {
 	fclose(def);
 }
 
+/* Makes the Stand Templates of a compiled template library (see templib.c)
+ * the current ones, in place of whatever templates were loaded before.
+ * A map loaded afterwards with Stand Templates of its own replaces them in
+ * turn, as load_file always does; one without any keeps the library's,
+ * though its Stands can't refer to them.
+ * Returns false, leaving the templates alone, if the library can't be
+ * opened.
+ */
+bool use_template_library(const char *path) {
+	template_library lib = open_template_library(path);
+	if (!lib)
+		return false;
+	struct stand_template *st = new_library_templates(lib);
+	if (!st) {
+		del_template_library(lib);
+		return false;
+	}
+
+	// Stands never borrow from a library, so the templates are the
+	// only thing the old one has to outlive
+	del_stand_templates(main_templates, num_main_templates);
+	main_templates = st;
+	num_main_templates = lib->num_templates;
+	// the history can only put back Stands of the current templates
+	history_clear();
+	if (main_library)
+		del_template_library(main_library);
+	main_library = lib;
+	return true;
+}
+
 static void register_api_functions(void) {
 	mono_add_internal_call("csapi.EngineAPI::getColorOfTileRaw",
 	                       get_color_of_tile);
@@ -177,6 +250,26 @@ static void register_api_functions(void) {
 	                       set_st_name);
 	mono_add_internal_call("csapi.EngineAPI::saveUserFileRaw",
 	                       save_user_file);
+	mono_add_internal_call("csapi.EngineAPI::getStandExtentsInRectRaw",
+	                       get_stand_extents_in_rect);
+	mono_add_internal_call("csapi.EngineAPI::getDirtyRegionsRaw",
+	                       get_dirty_regions);
+	mono_add_internal_call("csapi.EngineAPI::fillTileColorsRaw",
+	                       fill_tile_colors);
+	mono_add_internal_call("csapi.EngineAPI::packTemplatesRaw",
+	                       pack_templates);
+	mono_add_internal_call("csapi.EngineAPI::fillValidOriginsRaw",
+	                       fill_valid_origins);
+	mono_add_internal_call("csapi.EngineAPI::snapGrabbedStandRaw",
+	                       snap_grabbed_stand);
+	mono_add_internal_call("csapi.EngineAPI::placeTemplatesRaw",
+	                       place_templates);
+	mono_add_internal_call("csapi.EngineAPI::undoRaw",
+	                       undo_edit);
+	mono_add_internal_call("csapi.EngineAPI::redoRaw",
+	                       redo_edit);
+	mono_add_internal_call("csapi.EngineAPI::analyzeWalkabilityRaw",
+	                       analyze_walkability);
 }
 
 void initialize_mono(const char *filename) {
@@ -236,37 +329,64 @@ static void deselect_stand(void) {
 /* Rotates the selected Stand in the specified direction */
 static void rotate_selected_stand(mono_bool clockwise) {
 	assert(selected_stand);
+	uint8_t old_orientation = selected_stand->orientation;
+	journal_rotate(selected_stand, (bool) clockwise);
 	rotate_stand(selected_stand, (bool) clockwise);
+	if (selected_stand->orientation != old_orientation)
+		history_move(selected_stand, selected_stand->row,
+		             selected_stand->column, old_orientation);
 }
 
 /* Removes the selected Stand */
 static void remove_selected_stand(void) {
 	assert(select_stand);
-	del_stand(selected_stand);
+	journal_remove(selected_stand);
+	// the history keeps it, so that it can be put back
+	remove_stand(selected_stand);
+	selected_stand->g = NULL;
+	history_remove(selected_stand);
 	selected_stand = NULL;
 }
 
 /* Mirrors the selected Stand */
 static void mirror_selected_stand(void) {
 	assert(select_stand);
+	uint8_t old_orientation = selected_stand->orientation;
+	journal_mirror(selected_stand);
 	mirror_stand(selected_stand);
+	if (selected_stand->orientation != old_orientation)
+		history_move(selected_stand, selected_stand->row,
+		             selected_stand->column, old_orientation);
 }
 
 /* Creates a Stand from a Stand Template, and grabs it */
 static void grab_new_stand(int32_t st_num) {
 	assert(main_templates);
 	assert(st_num < num_main_templates && st_num >= 0);
+	if (grabbed_stand)
+		remove_grabbed_stand();
 	grabbed_stand = new_stand(main_templates + st_num);
+	grabbed_was_lifted = false;
+	grabbed_template = st_num;
 }
 
 /* Checks the applicability of the grabbed stand onto the Main Grid
  * at the specified coordinates.
+ *
+ * The frontend asks this for every position the mouse passes over, so the
+ * answer comes from the valid origins of the grabbed stand (see
+ * origins.c), which are only worked out again once the Main Grid changes.
  */
 static mono_bool can_apply_grabbed_stand(int64_t row, int64_t column) {
 	if (!grabbed_stand) return (mono_bool) false;
-	printf("engine got row: %" PRIi64 "\n", row);
-	printf("engine got column: %" PRIi64 "\n", column);
-	return (mono_bool) can_apply(grabbed_stand, main_grid, row, column);
+	origin_map m = valid_origins(main_grid, grabbed_stand->orients,
+	                             grabbed_stand->orientation);
+	if (!m)
+		return (mono_bool) can_apply(grabbed_stand, main_grid,
+		                             row, column);
+	return (mono_bool) (origin_valid(m, row, column)
+	                    && prepare_apply(grabbed_stand, main_grid,
+	                                     row, column));
 }
 
 /* Actually applies the grabbed stand.
@@ -274,15 +394,30 @@ static mono_bool can_apply_grabbed_stand(int64_t row, int64_t column) {
  */
 static void do_apply_grabbed_stand(void) {
 	do_apply(grabbed_stand);
+	if (grabbed_was_lifted) {
+		journal_apply_lifted(grabbed_stand);
+		history_move(grabbed_stand, lifted_row, lifted_column,
+		             grabbed_stand->orientation);
+	} else {
+		journal_apply_new(grabbed_template, grabbed_stand);
+		history_add(grabbed_stand);
+	}
 	selected_stand = grabbed_stand;
 	grabbed_stand = NULL;
 }
 
-/* Deletes the grabbed stand.
+/* Lets go of the grabbed stand. A new one is deleted, but one lifted from
+ * the Main Grid goes to the history, so that deleting it can be undone.
  */
 static void remove_grabbed_stand(void) {
 	if (!grabbed_stand) return;
-	del_stand(grabbed_stand);
+	if (grabbed_was_lifted) {
+		journal_drop_lifted();
+		// its row and column still say where it was lifted from
+		history_remove(grabbed_stand);
+	} else {
+		del_stand(grabbed_stand);
+	}
 	grabbed_stand = NULL;
 }
 
@@ -290,11 +425,15 @@ static void remove_grabbed_stand(void) {
  */
 static void grab_selected_stand(void) {
 	if (!selected_stand) return;
-	remove_stand(selected_stand);
-	selected_stand->g = NULL;
 	if (grabbed_stand)
 		remove_grabbed_stand();
+	journal_lift(selected_stand);
+	remove_stand(selected_stand);
+	selected_stand->g = NULL;
 	grabbed_stand = selected_stand;
+	grabbed_was_lifted = true;
+	lifted_row = selected_stand->row;
+	lifted_column = selected_stand->column;
 	selected_stand = NULL;
 }
 
@@ -311,10 +450,26 @@ static uint32_t get_main_grid_width(void) {
 /* Loads a file from user input in the frontend */
 static void load_user_file(MonoString *ufile) {
 	char *filename = mono_string_to_utf8(ufile);
-	FILE *userfile = fopen(filename, "r");
+	FILE *userfile = fopen(filename, "rb");
 	assert(userfile);
-	load_file(userfile);
+	// finish any drag while the journal still belongs to the old map,
+	// since journaling it may compact the journal from main_grid
+	settle_grabbed_stand();
+	bool ok = load_file(userfile);
 	fclose(userfile);
+	if (ok) {
+		// Stands of the old map are gone, so let go of them
+		selected_stand = NULL;
+		// replays edits made since the file was last saved in full
+		if (!journal_open(filename))
+			printf("could not open the journal for %s\n", filename);
+		history_clear();
+	} else {
+		size_t offset;
+		const char *why = get_load_error(&offset);
+		printf("could not load %s: %s at byte %zu\n",
+		       filename, why, offset);
+	}
 	mono_free(filename);
 }
 
@@ -329,9 +484,11 @@ static void set_selected_stand_name(MonoString *newname) {
 		goto out_mononame;
 	strcpy(cname, mononame);
 
-	if (selected_stand->name)
-		free(selected_stand->name);
+	char *old_name = selected_stand->name;
 	selected_stand->name = cname;
+	journal_rename_stand(selected_stand, cname);
+	history_rename(selected_stand, old_name ? old_name : "");
+	free(old_name);
 	
 	out_mononame:
 		mono_free(mononame);
@@ -387,9 +544,8 @@ static void set_st_name(int32_t st_id, MonoString *newname) {
 
 	stand_template st = main_templates + st_id;
 	
-	if (st->name)
-		free(st->name);
-	st->name = cname;
+	rename_stand_template(st, cname);
+	journal_rename_template(st_id, cname);
 
 	out_mononame:
 		mono_free(mononame);
@@ -409,10 +565,437 @@ static MonoString *get_st_name(int32_t st_id) {
 /* Saves a file from user input in the frontend */
 static void save_user_file(MonoString *ufile) {
 	char *filename = mono_string_to_utf8(ufile);
-	FILE *userfile = fopen(filename, "w");
+	FILE *userfile = fopen(filename, "wb");
 	assert(userfile);
 	printf("saving to %s\n", filename);
-	save_file(userfile);
-	fclose(userfile);
+
+	// the extension picks the format; loading tells them apart by header
+	size_t len = strlen(filename);
+	size_t ext_len = strlen(BINARY_FILE_EXTENSION);
+	bool ok;
+	if (len >= ext_len
+	    && strcmp(filename + len - ext_len, BINARY_FILE_EXTENSION) == 0)
+		ok = save_file_binary(userfile);
+	else
+		ok = save_file(userfile);
+	if (fclose(userfile) != 0)
+		ok = false;
+
+	if (ok) {
+		uint64_t bytes;
+		double seconds;
+		get_save_stats(&bytes, &seconds);
+		printf("saved %" PRIu64 " bytes in %.1f ms\n",
+		       bytes, seconds * 1000.0);
+		// the journal starts over from the new save
+		if (!journal_reset(filename))
+			printf("could not open the journal for %s\n", filename);
+	} else {
+		printf("could not save %s\n", filename);
+	}
 	mono_free(filename);
-}
\ No newline at end of file
+}
+
+/* Finds every Stand on the Main Grid whose bounding box intersects the given
+ * rectangle, e.g. the visible part of the map or a rubber-band selection.
+ *
+ * Returns an array holding the row, column, height and width of the bounding
+ * box of each Stand found, one after the other.
+ */
+static MonoArray *get_stand_extents_in_rect(int64_t row, int64_t column,
+                                            uint32_t height, uint32_t width) {
+	struct extent rect = {row, column, height, width};
+	uint32_t num = stands_in_rect(main_grid, &rect, NULL, 0);
+	stand *found = malloc(sizeof(stand) * (num ? num : 1));
+	if (!found)
+		num = 0;
+	else
+		stands_in_rect(main_grid, &rect, found, num);
+
+	MonoArray *data = mono_array_new(main_domain,
+			mono_get_int64_class(), 4 * num);
+	for (uint32_t i = 0; i < num; i++) {
+		struct extent e;
+		get_stand_extent(found[i], &e);
+		mono_array_set(data, int64_t, 4 * i, e.row);
+		mono_array_set(data, int64_t, 4 * i + 1, e.column);
+		mono_array_set(data, int64_t, 4 * i + 2, e.height);
+		mono_array_set(data, int64_t, 4 * i + 3, e.width);
+	}
+
+	free(found);
+	return data;
+}
+
+/* Takes the regions of the Main Grid that have changed since the last call,
+ * so the frontend can repaint only those.
+ *
+ * Returns an array holding the row, column, height and width of each
+ * region, one after the other.
+ */
+static MonoArray *get_dirty_regions(void) {
+	struct extent dirty[MAX_DIRTY_RECTS];
+	uint32_t num = grid_take_dirty(main_grid, dirty, MAX_DIRTY_RECTS);
+
+	MonoArray *data = mono_array_new(main_domain,
+			mono_get_int64_class(), 4 * num);
+	for (uint32_t i = 0; i < num; i++) {
+		mono_array_set(data, int64_t, 4 * i, dirty[i].row);
+		mono_array_set(data, int64_t, 4 * i + 1, dirty[i].column);
+		mono_array_set(data, int64_t, 4 * i + 2, dirty[i].height);
+		mono_array_set(data, int64_t, 4 * i + 3, dirty[i].width);
+	}
+
+	return data;
+}
+
+/* Packs a colour with channels in [0, 1] into 0xAARRGGBB. */
+static uint32_t pack_color(double red, double green, double blue,
+                           double alpha) {
+	return (uint32_t) (alpha * 255.0 + 0.5) << 24
+	       | (uint32_t) (red * 255.0 + 0.5) << 16
+	       | (uint32_t) (green * 255.0 + 0.5) << 8
+	       | (uint32_t) (blue * 255.0 + 0.5);
+}
+
+/* Fills a frontend-provided buffer with the colours of a rectangle of Tiles
+ * on the Main Grid, so a whole expose can be rendered with a single call
+ * instead of one get_color_of_tile (and one new array) per Tile.
+ *
+ * Only every step'th Tile down and across is sampled, starting at the
+ * rectangle's corner, matching the frontend drawing one block per step
+ * Tiles. Samples are written row by row as 0xAARRGGBB, with the same
+ * colours get_color_of_tile gives; samples off the Grid are 0.
+ *
+ * Returns the number of samples the rectangle needs. If the buffer is
+ * smaller than that, nothing is written, and the frontend should call again
+ * with a buffer of the returned size.
+ */
+static uint32_t fill_tile_colors(int64_t row, int64_t column,
+                                 uint32_t height, uint32_t width,
+                                 uint32_t step, MonoArray *buffer) {
+	if (step == 0)
+		step = 1;
+	uint32_t rows = (height + step - 1) / step;
+	uint32_t columns = (width + step - 1) / step;
+	uint64_t needed = (uint64_t) rows * columns;
+	if (needed > UINT32_MAX)
+		return UINT32_MAX;
+	if (mono_array_length(buffer) < needed)
+		return needed;
+
+	uint32_t *out = mono_array_addr(buffer, uint32_t, 0);
+	const uint32_t empty = pack_color(TILE_EMPTY_RED, TILE_EMPTY_GREEN,
+	                                  TILE_EMPTY_BLUE, TILE_EMPTY_ALPHA);
+
+	// neighbouring samples are usually the same Stand, so only repack
+	// the colour when it changes
+	stand last = NULL;
+	uint32_t last_color = 0;
+	for (uint32_t i = 0; i < rows; i++) {
+		int64_t r = row + (int64_t) i * step;
+		for (uint32_t j = 0; j < columns; j++) {
+			int64_t c = column + (int64_t) j * step;
+			if (r < 0 || r >= main_grid->height
+			    || c < 0 || c >= main_grid->width) {
+				*out++ = 0;
+				continue;
+			}
+			if (!grid_occupied(main_grid, r, c)) {
+				*out++ = empty;
+				continue;
+			}
+
+			stand s = grid_lookup(main_grid, r, c)->stand.stand_stand.s;
+			if (s != last) {
+				last = s;
+				last_color = pack_color(s->red, s->green,
+				                        s->blue, s->alpha);
+			}
+			*out++ = last_color;
+		}
+	}
+
+	return needed;
+}
+
+/* Lays out counts[i] new Stands of Stand Template st_ids[i] on the Main
+ * Grid automatically (see packer.c), around the Stands already on it, and
+ * records each in the journal as if it had been dragged there.
+ *
+ * objective is a pack_objective, and attempts the number of layouts to
+ * try, or 0 for the default.
+ *
+ * Returns the number of Stands placed.
+ */
+static uint32_t pack_templates(MonoArray *st_ids, MonoArray *counts,
+                               int32_t objective, uint32_t attempts) {
+	uintptr_t num = mono_array_length(st_ids);
+	if (num != mono_array_length(counts)
+	    || (objective != PACK_MAX_FILL && objective != PACK_MIN_AREA))
+		return 0;
+
+	uint32_t placed_num = 0;
+	struct pack_item *items = malloc(sizeof(struct pack_item)
+	                                 * (num ? num : 1));
+	if (!items)
+		goto out_items;
+	uint64_t total = 0;
+	for (uintptr_t i = 0; i < num; i++) {
+		int32_t st_id = mono_array_get(st_ids, int32_t, i);
+		if (st_id < 0 || st_id >= num_main_templates)
+			goto out_placed;
+		items[i].t = main_templates + st_id;
+		items[i].count = mono_array_get(counts, uint32_t, i);
+		total += items[i].count;
+	}
+	if (total > UINT32_MAX)
+		goto out_placed;
+	struct pack_placement *placed = malloc(sizeof(struct pack_placement)
+	                                       * (total ? total : 1));
+	if (!placed)
+		goto out_placed;
+
+	struct pack_options opts = {objective, attempts, (uint64_t) rand(),
+	                            false};
+	if (pack_stands(main_grid, items, num, &opts, placed, &placed_num)) {
+		// the whole layout is undone at once
+		history_begin_step();
+		for (uint32_t i = 0; i < placed_num; i++) {
+			journal_apply_new(mono_array_get(st_ids, int32_t,
+			                                 placed[i].item),
+			                  placed[i].s);
+			history_add(placed[i].s);
+		}
+		history_end_step();
+	}
+	free(placed);
+out_placed:;
+	free(items);
+out_items:;
+	return placed_num;
+}
+
+/* Fills a frontend-provided buffer with where the grabbed stand could be
+ * dropped, so the frontend can shade every legal drop zone at once.
+ *
+ * Samples are taken like fill_tile_colors, every step'th origin down and
+ * across a rectangle of the Main Grid, and are 1 where the grabbed stand
+ * fits with its origin there and 0 elsewhere, or if nothing is grabbed.
+ *
+ * Returns the number of samples the rectangle needs. If the buffer is
+ * smaller than that, nothing is written, and the frontend should call again
+ * with a buffer of the returned size.
+ */
+static uint32_t fill_valid_origins(int64_t row, int64_t column,
+                                   uint32_t height, uint32_t width,
+                                   uint32_t step, MonoArray *buffer) {
+	if (step == 0)
+		step = 1;
+	uint32_t rows = (height + step - 1) / step;
+	uint32_t columns = (width + step - 1) / step;
+	uint64_t needed = (uint64_t) rows * columns;
+	if (needed > UINT32_MAX)
+		return UINT32_MAX;
+	if (mono_array_length(buffer) < needed)
+		return needed;
+
+	uint8_t *out = mono_array_addr(buffer, uint8_t, 0);
+	origin_map m = grabbed_stand
+		? valid_origins(main_grid, grabbed_stand->orients,
+		                grabbed_stand->orientation)
+		: NULL;
+	if (!m) {
+		memset(out, 0, needed);
+		return needed;
+	}
+	for (uint32_t i = 0; i < rows; i++) {
+		int64_t r = row + (int64_t) i * step;
+		for (uint32_t j = 0; j < columns; j++)
+			*out++ = origin_valid(m, r, column + (int64_t) j * step);
+	}
+	return needed;
+}
+
+/* Finds the nearest place to the given origin that the grabbed stand fits
+ * on the Main Grid, for when it is dropped somewhere it doesn't (see
+ * snap_stand). If any_orientation is set and another orientation fits
+ * nearer, the grabbed stand is turned to it. A stand lifted from the Main
+ * Grid keeps its orientation, as the journal records only where it went.
+ *
+ * Returns {found, row, column}; if found is 0 it fits nowhere.
+ */
+static MonoArray *snap_grabbed_stand(int64_t row, int64_t column,
+                                     mono_bool euclidean,
+                                     mono_bool any_orientation) {
+	struct snap sp;
+	bool found = grabbed_stand
+		&& snap_stand(main_grid, grabbed_stand, row, column,
+		              euclidean ? SNAP_EUCLIDEAN : SNAP_MANHATTAN,
+		              any_orientation && !grabbed_was_lifted, &sp);
+	if (found)
+		set_stand_orientation(grabbed_stand, sp.sym);
+
+	MonoArray *data = mono_array_new(main_domain,
+			mono_get_int64_class(), 3);
+	mono_array_set(data, int64_t, 0, found);
+	mono_array_set(data, int64_t, 1, found ? sp.row : 0);
+	mono_array_set(data, int64_t, 2, found ? sp.column : 0);
+	return data;
+}
+
+/* Places a batch of new Stands on the Main Grid, all or none, such as the
+ * stalls of an imported spreadsheet. Item i is a Stand of Stand Template
+ * st_ids[i], turned to orientations[i], with its origin at (rows[i],
+ * columns[i]); the arrays must all be the same length.
+ *
+ * statuses[i] is set to the place_status of each item (see batch.h), and
+ * for PLACE_OVERLAP, conflicts[i] to the earlier item in its way. Each new
+ * Stand is recorded in the journal.
+ *
+ * Returns true if every Stand was placed.
+ */
+static mono_bool place_templates(MonoArray *st_ids, MonoArray *orientations,
+                                 MonoArray *rows, MonoArray *columns,
+                                 MonoArray *statuses, MonoArray *conflicts) {
+	uintptr_t num = mono_array_length(st_ids);
+	if (num != mono_array_length(orientations)
+	    || num != mono_array_length(rows)
+	    || num != mono_array_length(columns)
+	    || num != mono_array_length(statuses)
+	    || num != mono_array_length(conflicts) || num > UINT32_MAX)
+		return false;
+
+	bool ok = false;
+	struct place_item *items = malloc(sizeof(struct place_item)
+	                                  * (num ? num : 1));
+	if (!items)
+		goto out_items;
+	for (uintptr_t i = 0; i < num; i++) {
+		int32_t st_id = mono_array_get(st_ids, int32_t, i);
+		items[i].s = NULL;
+		items[i].t = st_id >= 0 && st_id < num_main_templates
+			? main_templates + st_id : NULL;
+		items[i].orientation = mono_array_get(orientations, uint8_t, i);
+		items[i].row = mono_array_get(rows, int64_t, i);
+		items[i].column = mono_array_get(columns, int64_t, i);
+	}
+
+	ok = place_stands(main_grid, items, num);
+	history_begin_step();
+	for (uintptr_t i = 0; i < num; i++) {
+		mono_array_set(statuses, uint8_t, i, items[i].status);
+		mono_array_set(conflicts, int32_t, i,
+		               items[i].status == PLACE_OVERLAP
+		               ? (int32_t) items[i].conflict : -1);
+		if (ok) {
+			journal_apply_new(mono_array_get(st_ids, int32_t, i),
+			                  items[i].s);
+			history_add(items[i].s);
+		}
+	}
+	history_end_step();
+
+	free(items);
+out_items:;
+	return (mono_bool) ok;
+}
+
+/* Finishes any drag in progress before the history or a newly loaded map
+ * changes the Main Grid under it: a lifted Stand goes back where it came
+ * from, and a new one is thrown away.
+ */
+static void settle_grabbed_stand(void) {
+	if (grabbed_stand && grabbed_was_lifted
+	    && can_apply(grabbed_stand, main_grid, lifted_row, lifted_column)) {
+		do_apply(grabbed_stand);
+		journal_apply_lifted(grabbed_stand);
+		grabbed_stand = NULL;
+	}
+	remove_grabbed_stand();
+}
+
+/* Undoes the last edit to the Main Grid, or the last batch of them, such
+ * as a layout from packTemplates. The selected Stand is deselected.
+ *
+ * Returns false if there was nothing to undo.
+ */
+static mono_bool undo_edit(void) {
+	settle_grabbed_stand();
+	selected_stand = NULL;
+	return (mono_bool) history_undo();
+}
+
+/* Redoes the last edit undone by undo_edit. */
+static mono_bool redo_edit(void) {
+	settle_grabbed_stand();
+	selected_stand = NULL;
+	return (mono_bool) history_redo();
+}
+
+/* Works out where shoppers can walk on the Main Grid from the given
+ * entrances, which are the row and column of each entrance Tile, one after
+ * the other. See analyze_walk for min_aisle and measure.
+ *
+ * Returns an array holding the number of reached Tiles, of reached Tiles
+ * in too narrow an aisle, of pockets and of unreachable Stands; then the
+ * row, column, height, width and number of Tiles of each pocket; then the
+ * row, column, height and width of the bounding box of each Stand with its
+ * distance, which is -1 if it can't be reached and -2 if it wasn't
+ * measured. The array is empty if the analysis couldn't be done.
+ */
+static MonoArray *analyze_walkability(MonoArray *entrances,
+                                      uint32_t min_aisle,
+                                      mono_bool measure) {
+	uintptr_t num = mono_array_length(entrances) / 2;
+	struct walk_entrance *en = malloc(sizeof(struct walk_entrance)
+	                                  * (num ? num : 1));
+	if (!en || num > UINT32_MAX || min_aisle > WALK_MAX_AISLE)
+		goto out_fail;
+	for (uintptr_t i = 0; i < num; i++) {
+		en[i].row = mono_array_get(entrances, int64_t, 2 * i);
+		en[i].column = mono_array_get(entrances, int64_t, 2 * i + 1);
+	}
+
+	struct walk_result r;
+	if (!analyze_walk(main_grid, en, num, min_aisle, measure, &r))
+		goto out_fail;
+
+	MonoArray *data = mono_array_new(main_domain, mono_get_int64_class(),
+			4 + 5 * (uintptr_t) r.num_pockets
+			+ 5 * (uintptr_t) r.num_stands);
+	mono_array_set(data, int64_t, 0, r.num_reached);
+	mono_array_set(data, int64_t, 1, r.num_narrow);
+	mono_array_set(data, int64_t, 2, r.num_pockets);
+	mono_array_set(data, int64_t, 3, r.num_unreachable);
+	uintptr_t at = 4;
+	for (uint32_t i = 0; i < r.num_pockets; i++) {
+		struct walk_pocket *p = &r.pockets[i];
+		mono_array_set(data, int64_t, at++, p->e.row);
+		mono_array_set(data, int64_t, at++, p->e.column);
+		mono_array_set(data, int64_t, at++, p->e.height);
+		mono_array_set(data, int64_t, at++, p->e.width);
+		mono_array_set(data, int64_t, at++, p->tiles);
+	}
+	for (uint32_t i = 0; i < r.num_stands; i++) {
+		struct extent e;
+		get_stand_extent(main_grid->stands[i], &e);
+		mono_array_set(data, int64_t, at++, e.row);
+		mono_array_set(data, int64_t, at++, e.column);
+		mono_array_set(data, int64_t, at++, e.height);
+		mono_array_set(data, int64_t, at++, e.width);
+		int64_t distance = r.distance[i];
+		if (r.distance[i] == WALK_UNREACHABLE)
+			distance = -1;
+		else if (r.distance[i] == WALK_UNMEASURED)
+			distance = -2;
+		mono_array_set(data, int64_t, at++, distance);
+	}
+	free_walk_result(&r);
+	free(en);
+	return data;
+
+out_fail:;
+	free(en);
+	return mono_array_new(main_domain, mono_get_int64_class(), 0);
+}
@@ -27,5 +27,6 @@ extern int32_t num_main_templates;
 extern grid main_grid;
 
 void initialize_engine(void);
+bool use_template_library(const char *path);
 void initialize_mono(const char *filename);
 int execute_frontend(int argc, char* argv[]);
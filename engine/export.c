@@ -0,0 +1,307 @@
+/* export.c
+ *
+ * This file contains definitions for exporting a map as an image, so that
+ * maps can be printed in batch on machines without a display.
+ *
+ * Tiles are drawn as squares of scale pixels in the colours the frontend
+ * gives them, composited onto white. The image is produced one row of
+ * Tiles at a time and written out straight away, so memory use depends
+ * only on the width of the map. Each row is drawn as spans: runs of empty
+ * Tiles are found from the occupancy plane a word at a time, and runs of
+ * one Stand from the occupancy of its own shape, so a span costs a single
+ * lookup however long it is, and is filled by block copies.
+ *
+ * Images are written as binary PPM, or as PNG compressed with zlib.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <strings.h>
+#include <assert.h>
+#include <zlib.h>
+
+#include "global.h"
+#include "grid.h"
+#include "stand.h"
+#include "export.h"
+
+// PNG filter types a row of pixels is written with
+#define PNG_FILTER_NONE 0
+#define PNG_FILTER_UP   2
+
+/* An image being written, a row of pixels at a time. */
+struct image_writer {
+	FILE *f;
+	enum image_format format;
+	size_t row_bytes;
+	// PNG only: the compressor, and a row of zeroes, which is what a
+	// row identical to the one above looks like under the Up filter
+	z_stream z;
+	uint8_t *zeroes;
+	bool failed;
+	uint8_t out[EXPORT_CHUNK_BYTES];
+};
+
+static void blend(double red, double green, double blue, double alpha,
+                  uint8_t *rgb);
+static void draw_row(grid g, uint32_t row, uint32_t scale,
+                     const uint8_t *empty, uint8_t *pixels);
+static void fill_span(uint8_t *p, const uint8_t *rgb, size_t pixels);
+static bool begin_image(struct image_writer *w, uint32_t width,
+                        uint32_t height);
+static void put_row(struct image_writer *w, const uint8_t *pixels,
+                    bool repeat);
+static bool end_image(struct image_writer *w);
+static void put_deflated(struct image_writer *w, const uint8_t *data,
+                         size_t len, int flush);
+static void put_chunk(struct image_writer *w, const char *type,
+                      const uint8_t *data, size_t len);
+static void put_be32(uint8_t *p, uint32_t v);
+
+/* Picks the format of an image from the extension of its file name:
+ * PNG for ".png", and PPM for anything else.
+ */
+enum image_format image_format_for(const char *path) {
+	const char *dot = strrchr(path, '.');
+	return dot && strcasecmp(dot, ".png") == 0 ? IMAGE_PNG : IMAGE_PPM;
+}
+
+/* Writes a Grid to f as an image, with every Tile drawn as a square of
+ * scale by scale pixels.
+ *
+ * Returns false if the image would be too big, or couldn't be written.
+ */
+bool export_grid(FILE *f, grid g, uint32_t scale, enum image_format format) {
+	assert(g);
+
+	if (scale == 0 || scale > EXPORT_MAX_SCALE
+	    || (uint64_t) g->width * scale > INT32_MAX
+	    || (uint64_t) g->height * scale > INT32_MAX)
+		return false;
+	uint32_t width = g->width * scale;
+	uint32_t height = g->height * scale;
+
+	bool ok = false;
+	struct image_writer *w = malloc(sizeof(struct image_writer));
+	if (!w)
+		goto out_writer;
+	w->f = f;
+	w->format = format;
+	w->row_bytes = (size_t) width * 3;
+	uint8_t *pixels = malloc(w->row_bytes);
+	if (!pixels)
+		goto out_pixels;
+	if (!begin_image(w, width, height))
+		goto out_image;
+
+	uint8_t empty[3];
+	blend(TILE_EMPTY_RED, TILE_EMPTY_GREEN, TILE_EMPTY_BLUE,
+	      TILE_EMPTY_ALPHA, empty);
+	for (uint32_t row = 0; row < g->height && !w->failed; row++) {
+		draw_row(g, row, scale, empty, pixels);
+		for (uint32_t i = 0; i < scale; i++)
+			put_row(w, pixels, i > 0);
+	}
+	ok = end_image(w);
+
+out_image:;
+	free(pixels);
+out_pixels:;
+	free(w);
+out_writer:;
+	return ok;
+}
+
+/* Composites a colour with channels in [0, 1] onto white. */
+static void blend(double red, double green, double blue, double alpha,
+                  uint8_t *rgb) {
+	double channels[3] = {red, green, blue};
+	for (int i = 0; i < 3; i++)
+		rgb[i] = (uint8_t) (255.0 * (alpha * channels[i] + 1.0 - alpha)
+		                    + 0.5);
+}
+
+/* Draws one row of Tiles as a row of pixels, scale pixels per Tile. */
+static void draw_row(grid g, uint32_t row, uint32_t scale,
+                     const uint8_t *empty, uint8_t *pixels) {
+	// neighbouring spans are often the same Stand, so only blend its
+	// colour when it changes
+	stand last = NULL;
+	uint8_t color[3];
+	uint32_t column = 0;
+	while (column < g->width) {
+		uint32_t left = g->width - column;
+		uint64_t word = grid_row_window(g, row, column);
+		uint32_t run;
+		const uint8_t *rgb;
+		if (!(word & 1)) {
+			run = word ? __builtin_ctzll(word) : OCC_WORD_BITS;
+			rgb = empty;
+		} else {
+			// the Stand goes on for as long as its own shape does
+			stand s = grid_lookup(g, row, column)->stand.stand_stand.s;
+			uint64_t own = ~grid_row_window(s->source, row - s->row,
+			                                column - s->column);
+			run = own ? __builtin_ctzll(own) : OCC_WORD_BITS;
+			if (s != last) {
+				last = s;
+				blend(s->red, s->green, s->blue, s->alpha, color);
+			}
+			rgb = color;
+		}
+		if (run > left)
+			run = left;
+		fill_span(pixels + (size_t) column * scale * 3, rgb,
+		          (size_t) run * scale);
+		column += run;
+	}
+}
+
+/* Fills a span of pixels with one colour: the first pixel is written, then
+ * copied over the rest in doubling blocks.
+ */
+static void fill_span(uint8_t *p, const uint8_t *rgb, size_t pixels) {
+	size_t total = pixels * 3;
+	memcpy(p, rgb, 3);
+	for (size_t done = 3; done < total; ) {
+		size_t n = done < total - done ? done : total - done;
+		memcpy(p + done, p, n);
+		done += n;
+	}
+}
+
+static bool begin_image(struct image_writer *w, uint32_t width,
+                        uint32_t height) {
+	w->failed = false;
+	w->zeroes = NULL;
+	if (w->format == IMAGE_PPM) {
+		if (fprintf(w->f, "P6\n%u %u\n255\n", width, height) < 0)
+			return false;
+		return true;
+	}
+
+	static const uint8_t signature[8] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+	};
+	w->zeroes = calloc(w->row_bytes, 1);
+	if (!w->zeroes)
+		return false;
+	memset(&w->z, 0, sizeof(w->z));
+	if (deflateInit(&w->z, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		free(w->zeroes);
+		return false;
+	}
+	w->z.next_out = w->out;
+	w->z.avail_out = EXPORT_CHUNK_BYTES;
+
+	// 8-bit RGB, not interlaced
+	uint8_t header[13] = {0};
+	put_be32(header, width);
+	put_be32(header + 4, height);
+	header[8] = 8;
+	header[9] = 2;
+	if (fwrite(signature, 1, 8, w->f) != 8)
+		w->failed = true;
+	put_chunk(w, "IHDR", header, sizeof(header));
+	return true;
+}
+
+/* Writes a row of pixels. repeat says it is the same as the row before,
+ * which PNG stores as next to nothing.
+ */
+static void put_row(struct image_writer *w, const uint8_t *pixels,
+                    bool repeat) {
+	if (w->failed)
+		return;
+	if (w->format == IMAGE_PPM) {
+		if (fwrite(pixels, 1, w->row_bytes, w->f) != w->row_bytes)
+			w->failed = true;
+		return;
+	}
+
+	uint8_t filter = repeat ? PNG_FILTER_UP : PNG_FILTER_NONE;
+	put_deflated(w, &filter, 1, Z_NO_FLUSH);
+	put_deflated(w, repeat ? w->zeroes : pixels, w->row_bytes, Z_NO_FLUSH);
+}
+
+/* Finishes an image. Returns false if any of it couldn't be written. */
+static bool end_image(struct image_writer *w) {
+	if (w->format == IMAGE_PNG) {
+		put_deflated(w, NULL, 0, Z_FINISH);
+		put_chunk(w, "IEND", NULL, 0);
+		deflateEnd(&w->z);
+		free(w->zeroes);
+	}
+	return !w->failed && fflush(w->f) == 0;
+}
+
+/* Feeds data to the compressor, writing an IDAT chunk whenever the output
+ * buffer fills up, and whatever is left once flush is Z_FINISH.
+ */
+static void put_deflated(struct image_writer *w, const uint8_t *data,
+                         size_t len, int flush) {
+	w->z.next_in = (uint8_t *) data;
+	w->z.avail_in = len;
+	for (;;) {
+		int status = deflate(&w->z, flush);
+		if (status == Z_STREAM_ERROR) {
+			w->failed = true;
+			return;
+		}
+		bool done = flush == Z_FINISH ? status == Z_STREAM_END
+			: w->z.avail_in == 0 && w->z.avail_out > 0;
+		if (w->z.avail_out == 0 || (done && flush == Z_FINISH)) {
+			put_chunk(w, "IDAT", w->out,
+			          EXPORT_CHUNK_BYTES - w->z.avail_out);
+			w->z.next_out = w->out;
+			w->z.avail_out = EXPORT_CHUNK_BYTES;
+		}
+		if (done)
+			return;
+	}
+}
+
+static void put_chunk(struct image_writer *w, const char *type,
+                      const uint8_t *data, size_t len) {
+	if (w->failed)
+		return;
+	uint8_t head[8];
+	put_be32(head, len);
+	memcpy(head + 4, type, 4);
+	uint8_t tail[4];
+	uLong crc = crc32(0, head + 4, 4);
+	if (len)
+		crc = crc32(crc, data, len);
+	put_be32(tail, crc);
+	if (fwrite(head, 1, 8, w->f) != 8
+	    || (len && fwrite(data, 1, len, w->f) != len)
+	    || fwrite(tail, 1, 4, w->f) != 4)
+		w->failed = true;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
@@ -0,0 +1,44 @@
+/* export.h
+ *
+ * This file contains declarations for exporting a map as an image,
+ * without the frontend.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "grid.h"
+
+enum image_format {IMAGE_PPM, IMAGE_PNG};
+
+// largest number of pixels a Tile may be drawn as, across and down
+#define EXPORT_MAX_SCALE 64
+
+// compressed image data is written in chunks of this many bytes
+#define EXPORT_CHUNK_BYTES 65536
+
+enum image_format image_format_for(const char *path);
+bool export_grid(FILE *f, grid g, uint32_t scale, enum image_format format);
+
+#endif
@@ -28,7 +28,10 @@
  * C is at [0, 2].
  * H is at [2, 1].
  *
- * All of the memory occupied by a Grid exists on the heap.
+ * All of the memory occupied by a Grid exists on the heap. The Tiles of
+ * a Grid are allocated together in a single slab owned by the Grid, and
+ * the lookup table points into that slab; individual Tiles must never be
+ * free'd.
  * You must destroy a Grid by calling its destructor to avoid
  * leaking it.
  * 
@@ -51,35 +54,96 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <stdbool.h>
 #include "grid.h"
+#include "spatial.h"
+#include "origins.h"
 #include "global.h"
 
-static tile new_tile(uint32_t row, uint32_t column);
+/* A square block of Tiles in a sparse Grid. */
+struct grid_chunk {
+	// number of Tiles in the chunk holding a stand-like
+	uint32_t occupied;
+	struct grid_chunk *next_spare;
+	struct tile tiles[GRID_CHUNK_SIZE * GRID_CHUNK_SIZE];
+};
+
+// how many emptied chunks a sparse Grid keeps for reuse
+#define MAX_SPARE_CHUNKS 16
+
+/* Stands in for every Tile in the empty chunks of sparse Grids.
+ * It is never written to.
+ */
+static struct tile empty_tile = {
+	NULL, NULL, NULL, NULL, 0, 0,
+	{ .stand_stand = { STAND, NULL } }
+};
+
+static void init_tile(tile t, uint32_t row, uint32_t column);
+static grid alloc_grid(uint32_t width, uint32_t height, size_t occ_words);
+static struct grid_chunk **chunk_of(grid g, uint32_t row, uint32_t column);
+static struct grid_chunk *take_spare_chunk(grid g, uint32_t row,
+                                           uint32_t column);
+static grid clone_sparse_grid(grid g);
 static void rebuild_lookup(grid g);
 static void reset_origin(grid g);
+static void rebuild_occupancy(grid g);
 
-/* Creates a new tile on the heap, initializing its pointers to NULL */
-static tile new_tile(uint32_t row, uint32_t column) {
-	tile nt = malloc(sizeof(struct tile));
-	if (!nt)
-		goto out_nt;
+/* Initializes a Tile in place, setting its pointers to NULL */
+static void init_tile(tile t, uint32_t row, uint32_t column) {
+	t->up = NULL;
+	t->down = NULL;
+	t->left = NULL;
+	t->right = NULL;
 
-	nt->up = NULL;
-	nt->down = NULL;
-	nt->left = NULL;
-	nt->right = NULL;
+	t->row = row;
+	t->column = column;
 
-	nt->row = row;
-	nt->column = column;
+	t->stand.stand_proto.type = STAND;
+	t->stand.stand_stand.s = NULL;
+}
 
-	nt->stand.stand_proto.type = STAND;
-	nt->stand.stand_stand.s = NULL;
+/* Allocates a struct grid and its occupancy plane, and initializes
+ * everything but its Tiles.
+ * 
+ * The occupancy plane is given at least occ_words words.
+ * 
+ * Returns NULL if space could not be allocated.
+ */
+static grid alloc_grid(uint32_t width, uint32_t height, size_t occ_words) {
+	grid ng = malloc(sizeof(struct grid));
+	if (!ng)
+		goto out_ng;
+	ng->origin = NULL;
+	ng->height = height;
+	ng->width = width;
+	ng->lookup = NULL;
+	ng->tiles = NULL;
+	ng->chunks = NULL;
+	ng->chunk_columns = 0;
+	ng->spare_chunks = NULL;
+	ng->num_spare_chunks = 0;
+
+	ng->occupancy = calloc(occ_words, sizeof(uint64_t));
+	if (!ng->occupancy)
+		goto out_occupancy;
+	ng->occ_stride = (width + OCC_WORD_BITS - 1) / OCC_WORD_BITS;
+
+	ng->stands = NULL;
+	ng->num_stands = 0;
+	ng->stands_cap = 0;
+	ng->index = NULL;
+	ng->num_dirty = 0;
+	ng->generation = 0;
+	ng->origins = NULL;
 
-	return nt;
+	return ng;
 
-out_nt:
+out_occupancy:;
+	free(ng);
+out_ng:;
 	return NULL;
 }
 
@@ -88,74 +152,54 @@ grid new_grid(uint32_t width, uint32_t height) {
 	assert(width > 0);
 	assert(height > 0);
 
-	/* For error handling later if an allocation fails.
-	 * It holds references to the rightmost Tile in each
-	 * row of the Grid. This will allow us to deallocate our
-	 * constucted rows, as well as the portion of the row we
-	 * are currently working on.
+	size_t num_tiles = (size_t) width * height;
+
+	/* The occupancy plane is sized for whichever orientation of the
+	 * Grid needs more words, so that rotation never has to reallocate.
 	 */
-	tile rightends[height];
-	for (uint32_t i = 0; i < height; i++)
-		rightends[i] = NULL;
+	size_t words = (size_t) height * ((width + OCC_WORD_BITS - 1)
+	                                  / OCC_WORD_BITS);
+	size_t rwords = (size_t) width * ((height + OCC_WORD_BITS - 1)
+	                                  / OCC_WORD_BITS);
 
 	// allocate space for the struct grid and
 	// initialize its fields
-	grid ng = malloc(sizeof(struct grid));
+	grid ng = alloc_grid(width, height, words > rwords ? words : rwords);
 	if (!ng)
 		goto out_ng;
-	ng->origin = NULL;
-	ng->height = height;
-	ng->width = width;
 
-	ng->lookup = malloc(sizeof(tile *) * height * width);
+	ng->lookup = malloc(sizeof(tile) * num_tiles);
 	if (!ng->lookup)
 		goto out_lookup;
 
-	// Now we descend through the graph.
-	// Each pass through this loop completes a single row.
-	for (uint32_t j = 0; j < height; j++) {
-		tile above;
-		tile farleft;
-
-		// create the first tile in the current row so our
-		// inner loop has something to work with
-		if (j == 0) {
-			// create origin tile
-			ng->origin = new_tile(j, 0);
-			if (!ng->origin)
-				goto out_tiles;
-			rightends[j] = ng->origin;
-			ng->lookup[0] = ng->origin;
-			above = NULL;
-			farleft = ng->origin;
-		} else {
-			tile newrow = new_tile(j, 0);
-			if (!newrow)
-				goto out_tiles;
-			ng->lookup[j * width] = newrow;
-			rightends[j] = newrow;
-			farleft->down = newrow;
-			newrow->up = farleft;
-			above = farleft->right;
-			farleft = newrow;
-		}
+	/* All Tiles live in a single slab, so a Grid costs the same
+	 * handful of allocations no matter its size. The slab starts out
+	 * in row-major order, which means a freshly built Grid can be
+	 * scanned through either the slab or the lookup table without
+	 * jumping around in memory.
+	 */
+	ng->tiles = malloc(sizeof(struct tile) * num_tiles);
+	if (!ng->tiles)
+		goto out_tiles;
+	ng->origin = ng->tiles;
 
-		// this inner loop constructs all of the columns in the row,
-		// extending from the tile we just created.
-		tile t = farleft;
-		for (uint32_t i = 1; i < width; i++, rightends[j] = t) {
-			tile n = new_tile(j, i);
-			ng->lookup[j * width + i] = n;
-			if (!n)
-				goto out_tiles;
-			n->up = above;
-			if (above != NULL)
-				above->down = n;
-			t->right = n;
-			n->left = t;
-			t = n;
-			if (above != NULL)
-				above = above->right;
+	// Now we link up the graph.
+	// Each pass through the outer loop completes a single row.
+	for (uint32_t j = 0; j < height; j++) {
+		tile rowstart = ng->tiles + (size_t) j * width;
+		for (uint32_t i = 0; i < width; i++) {
+			tile t = rowstart + i;
+			init_tile(t, j, i);
+			ng->lookup[(size_t) j * width + i] = t;
+
+			if (i > 0) {
+				t->left = t - 1;
+				t->left->right = t;
+			}
+			if (j > 0) {
+				t->up = t - width;
+				t->up->down = t;
+			}
 		}
 	}
 
@@ -163,30 +207,12 @@ grid new_grid(uint32_t width, uint32_t height) {
 
 // Error handling routines:
 out_tiles:;
-	/* If we jumped here, then we need to delete every tile
-	 * structure we allocated, and the lookup table.
-	 * We accomplish this by traversing rightends, deleting every
-	 * row we completed as well as whatever portion of the current
-	 * row we have finished.
-	 *
-	 * Like the above routine, we move across the grid top-down
-	 * in the outer loop. However, in the inner loop, we move across
-	 * each row from right to left.
-	*/
-	uint32_t endi = 0;
-	while (rightends[endi] != NULL && endi < height) {
-		tile rend = rightends[endi];
-		while (rend != NULL) {
-			tile l = rend->left;
-			free(rend);
-			rend = l;
-		}
-		endi++;
-	}
+	// If we jumped here, we need to free the lookup table.
 	free(ng->lookup);
 
 out_lookup:;
 	// If we jumped here, we need only free the struct grid.
+	free(ng->occupancy);
 	free(ng);
 
 out_ng:;
@@ -194,47 +220,359 @@ out_ng:;
        return NULL;
 }
 
+grid new_sparse_grid(uint32_t width, uint32_t height) {
+	// test invariants
+	assert(width > 0);
+	assert(height > 0);
+
+	size_t words = (size_t) height * ((width + OCC_WORD_BITS - 1)
+	                                  / OCC_WORD_BITS);
+	grid ng = alloc_grid(width, height, words);
+	if (!ng)
+		goto out_ng;
+
+	// every chunk starts out empty
+	ng->chunk_columns = (width + GRID_CHUNK_SIZE - 1) >> GRID_CHUNK_SHIFT;
+	uint32_t chunk_rows = (height + GRID_CHUNK_SIZE - 1) >> GRID_CHUNK_SHIFT;
+	ng->chunks = calloc((size_t) chunk_rows * ng->chunk_columns,
+	                    sizeof(struct grid_chunk *));
+	if (!ng->chunks)
+		goto out_chunks;
+
+	return ng;
+
+out_chunks:;
+	free(ng->occupancy);
+	free(ng);
+out_ng:;
+	return NULL;
+}
+
 void del_grid(grid g) {
 	assert(g);
 	
-	/* we need to free every tile, then the lookup table,
-	 * then the struct grid itself
-	 * in the outer loop, we scan top-down
+	/* every Tile lives in the slab (or, for sparse Grids, in a chunk),
+	 * so we need only free those, then the lookup table, then the
+	 * struct grid itself
 	 */
-	tile l = g->origin;
-	while (l != NULL) {
-		tile below = l->down;
-
-		// in the inner loop, we scan left-right
-		tile now = l;
-		while (now != NULL) {
-			tile next = now->right;
-			free(now);
-			now = next;
+	if (g->chunks) {
+		size_t num_chunks = (size_t) g->chunk_columns
+			* ((g->height + GRID_CHUNK_SIZE - 1) >> GRID_CHUNK_SHIFT);
+		for (size_t i = 0; i < num_chunks; i++)
+			free(g->chunks[i]);
+		free(g->chunks);
+		while (g->spare_chunks) {
+			struct grid_chunk *next = g->spare_chunks->next_spare;
+			free(g->spare_chunks);
+			g->spare_chunks = next;
 		}
-
-		l = below;
 	}
-	
-	// now we just need to free the rest
+	free(g->tiles);
+	free(g->occupancy);
+	free(g->stands);
+	if (g->index)
+		del_spatial_index(g->index);
+	if (g->origins)
+		del_origin_cache(g->origins);
 	free(g->lookup);
 	free(g);
 }
 
+bool grid_reserve_stands(grid g, uint32_t extra) {
+	assert(g);
+
+	if (g->num_stands + extra <= g->stands_cap)
+		return true;
+
+	// grow geometrically, so that filling a Grid stays linear
+	uint32_t new_cap = g->stands_cap ? g->stands_cap * 2 : 16;
+	while (new_cap < g->num_stands + extra)
+		new_cap *= 2;
+	stand *new_stands = realloc(g->stands, sizeof(stand) * new_cap);
+	if (!new_stands)
+		return false;
+
+	g->stands = new_stands;
+	g->stands_cap = new_cap;
+	return true;
+}
+
 tile grid_lookup(grid g, uint32_t row, uint32_t column) {
 	// test invariants
 	assert(g);
 	assert(row < g->height);
 	assert(column < g->width);
 
-	return g->lookup[row * g->width + column];
+	if (!g->chunks)
+		return g->lookup[(size_t) row * g->width + column];
+
+	struct grid_chunk *c = *chunk_of(g, row, column);
+	if (!c)
+		return &empty_tile;
+	return &c->tiles[(row % GRID_CHUNK_SIZE) * GRID_CHUNK_SIZE
+	                 + column % GRID_CHUNK_SIZE];
+}
+
+void grid_set_stand(grid g, uint32_t row, uint32_t column, stand_like sl) {
+	uint64_t *word = g->occupancy + (size_t) row * g->occ_stride
+		+ column / OCC_WORD_BITS;
+	uint64_t bit = (uint64_t) 1 << (column % OCC_WORD_BITS);
+	bool was_occupied = *word & bit;
+	if (sl.stand_stand.s)
+		*word |= bit;
+	else
+		*word &= ~bit;
+	if (was_occupied != !!sl.stand_stand.s)
+		g->generation++;
+
+	if (!g->chunks) {
+		grid_lookup(g, row, column)->stand = sl;
+		return;
+	}
+
+	// sparse Grids keep a count of the occupied Tiles in each chunk,
+	// so that chunks can be handed out and given back as needed
+	struct grid_chunk **cp = chunk_of(g, row, column);
+	if (!*cp) {
+		if (!sl.stand_stand.s)
+			return; // already empty
+		*cp = take_spare_chunk(g, row, column);
+	}
+	struct grid_chunk *c = *cp;
+	c->tiles[(row % GRID_CHUNK_SIZE) * GRID_CHUNK_SIZE
+	         + column % GRID_CHUNK_SIZE].stand = sl;
+	if (sl.stand_stand.s && !was_occupied) {
+		c->occupied++;
+	} else if (!sl.stand_stand.s && was_occupied && --c->occupied == 0) {
+		// the chunk is empty again; keep a few around for reuse
+		*cp = NULL;
+		if (g->num_spare_chunks >= MAX_SPARE_CHUNKS) {
+			free(c);
+			return;
+		}
+		c->next_spare = g->spare_chunks;
+		g->spare_chunks = c;
+		g->num_spare_chunks++;
+	}
+}
+
+bool grid_reserve_region(grid g, int64_t row, int64_t column,
+                         uint32_t height, uint32_t width) {
+	assert(g);
+
+	if (!g->chunks || height == 0 || width == 0)
+		return true;
+
+	// clip the rectangle to the Grid
+	int64_t bottom = row + height;
+	int64_t right = column + width;
+	if (row < 0)
+		row = 0;
+	if (column < 0)
+		column = 0;
+	if (bottom > g->height)
+		bottom = g->height;
+	if (right > g->width)
+		right = g->width;
+	if (row >= bottom || column >= right)
+		return true;
+
+	// count the empty chunks the rectangle covers
+	uint32_t needed = 0;
+	for (int64_t r = row >> GRID_CHUNK_SHIFT;
+	     r <= (bottom - 1) >> GRID_CHUNK_SHIFT; r++)
+		for (int64_t c = column >> GRID_CHUNK_SHIFT;
+		     c <= (right - 1) >> GRID_CHUNK_SHIFT; c++)
+			if (!g->chunks[r * g->chunk_columns + c])
+				needed++;
+
+	while (g->num_spare_chunks < needed) {
+		struct grid_chunk *c = malloc(sizeof(struct grid_chunk));
+		if (!c)
+			return false;
+		c->next_spare = g->spare_chunks;
+		g->spare_chunks = c;
+		g->num_spare_chunks++;
+	}
+
+	return true;
+}
+
+void grid_mark_dirty(grid g, int64_t row, int64_t column,
+                     uint32_t height, uint32_t width) {
+	assert(g);
+
+	// work in half-open bounds, clipped to the Grid
+	int64_t top = row < 0 ? 0 : row;
+	int64_t left = column < 0 ? 0 : column;
+	int64_t bottom = row + height;
+	int64_t right = column + width;
+	if (bottom > g->height)
+		bottom = g->height;
+	if (right > g->width)
+		right = g->width;
+	if (top >= bottom || left >= right)
+		return;
+
+	for (;;) {
+		// find a recorded rectangle to fold into this one: the first
+		// one it overlaps or touches, or else (if the set is full)
+		// the one whose union with it is smallest
+		uint32_t merge = g->num_dirty;
+		uint64_t best_growth = UINT64_MAX;
+		for (uint32_t i = 0; i < g->num_dirty; i++) {
+			struct extent *d = &g->dirty[i];
+			int64_t d_bottom = d->row + d->height;
+			int64_t d_right = d->column + d->width;
+			if (d->row <= bottom && top <= d_bottom
+			    && d->column <= right && left <= d_right) {
+				merge = i;
+				break;
+			}
+			if (g->num_dirty < MAX_DIRTY_RECTS)
+				continue;
+
+			int64_t u_top = d->row < top ? d->row : top;
+			int64_t u_left = d->column < left ? d->column : left;
+			int64_t u_bottom = d_bottom > bottom ? d_bottom : bottom;
+			int64_t u_right = d_right > right ? d_right : right;
+			uint64_t growth = (uint64_t) (u_bottom - u_top)
+				* (u_right - u_left)
+				- (uint64_t) d->height * d->width;
+			if (growth < best_growth) {
+				best_growth = growth;
+				merge = i;
+			}
+		}
+		if (merge == g->num_dirty)
+			break;
+
+		// take the rectangle out of the set and grow ours to cover it;
+		// the union may now touch others, so look again
+		struct extent *d = &g->dirty[merge];
+		if (d->row < top)
+			top = d->row;
+		if (d->column < left)
+			left = d->column;
+		if (d->row + d->height > bottom)
+			bottom = d->row + d->height;
+		if (d->column + d->width > right)
+			right = d->column + d->width;
+		g->dirty[merge] = g->dirty[--g->num_dirty];
+	}
+
+	struct extent *n = &g->dirty[g->num_dirty++];
+	n->row = top;
+	n->column = left;
+	n->height = bottom - top;
+	n->width = right - left;
+}
+
+uint32_t grid_take_dirty(grid g, struct extent *out, uint32_t max) {
+	assert(g);
+
+	uint32_t num = g->num_dirty < max ? g->num_dirty : max;
+	memcpy(out, g->dirty, sizeof(struct extent) * num);
+	g->num_dirty = 0;
+	return num;
+}
+
+/* Returns the slot in a sparse Grid's chunk table that holds the chunk
+ * containing the given coordinates.
+ */
+static struct grid_chunk **chunk_of(grid g, uint32_t row, uint32_t column) {
+	return g->chunks + (size_t) (row >> GRID_CHUNK_SHIFT) * g->chunk_columns
+		+ (column >> GRID_CHUNK_SHIFT);
+}
+
+/* Takes a chunk from a sparse Grid's spare list and sets it up to hold the
+ * empty Tiles of the chunk containing the given coordinates.
+ */
+static struct grid_chunk *take_spare_chunk(grid g, uint32_t row,
+                                           uint32_t column) {
+	struct grid_chunk *c = g->spare_chunks;
+	assert(c); // grid_reserve_region should have been called
+	g->spare_chunks = c->next_spare;
+	g->num_spare_chunks--;
+
+	uint32_t top = row & ~(uint32_t) (GRID_CHUNK_SIZE - 1);
+	uint32_t left = column & ~(uint32_t) (GRID_CHUNK_SIZE - 1);
+	for (uint32_t r = 0; r < GRID_CHUNK_SIZE; r++)
+		for (uint32_t cl = 0; cl < GRID_CHUNK_SIZE; cl++)
+			init_tile(&c->tiles[r * GRID_CHUNK_SIZE + cl],
+			          top + r, left + cl);
+	c->occupied = 0;
+	c->next_spare = NULL;
+	return c;
+}
+
+uint64_t grid_row_window(grid g, uint32_t row, int64_t column) {
+	assert(g);
+	assert(row < g->height);
+
+	return occupancy_window(g->occupancy + (size_t) row * g->occ_stride,
+	                        g->occ_stride, column);
+}
+
+uint64_t occupancy_window(const uint64_t *bits, uint32_t occ_stride,
+                          int64_t column) {
+	// split the column into a word index and a shift, rounding
+	// towards negative infinity so off-grid columns work too
+	int64_t word = column >= 0 ? column / OCC_WORD_BITS
+		: -((-column + OCC_WORD_BITS - 1) / OCC_WORD_BITS);
+	uint32_t shift = (uint32_t) (column - word * OCC_WORD_BITS);
+
+	uint64_t lo = (word >= 0 && word < occ_stride) ? bits[word] : 0;
+	if (shift == 0)
+		return lo;
+	uint64_t hi = (word + 1 >= 0 && word + 1 < occ_stride)
+		? bits[word + 1] : 0;
+	return (lo >> shift) | (hi << (OCC_WORD_BITS - shift));
+}
+
+uint64_t occupancy_run_window(const uint64_t *bits, uint32_t occ_stride,
+                              int64_t column, uint32_t length) {
+	assert(length > 0 && length <= OCC_WORD_BITS);
+
+	uint64_t lo = occupancy_window(bits, occ_stride, column);
+	if (length == 1)
+		return lo;
+
+	// smear the 128 Tiles from the column on down by length - 1,
+	// doubling the distance covered each time
+	unsigned __int128 x = (unsigned __int128) occupancy_window(
+		bits, occ_stride, column + OCC_WORD_BITS) << OCC_WORD_BITS | lo;
+	for (uint32_t span = 1; span < length; ) {
+		uint32_t step = span < length - span ? span : length - span;
+		x |= x >> step;
+		span += step;
+	}
+	return (uint64_t) x;
+}
+
+uint64_t grid_window_mask(grid g, int64_t column) {
+	assert(g);
+
+	int64_t first = -column;          // first bit that is on the Grid
+	int64_t end = g->width - column;  // first bit past the Grid
+	if (first < 0)
+		first = 0;
+	if (end > OCC_WORD_BITS)
+		end = OCC_WORD_BITS;
+	if (first >= end)
+		return 0;
+
+	uint64_t upto_end = end == OCC_WORD_BITS ? ~(uint64_t) 0
+		: ((uint64_t) 1 << end) - 1;
+	return upto_end & ~(((uint64_t) 1 << first) - 1);
 }
 
 void rotate_grid(grid g, bool clockwise) {
 	assert(g);
+	assert(!g->chunks);
 	
 	// iterate through each tile in the grid
-	uint64_t num_tiles = g->width * g->height;
+	uint64_t num_tiles = (uint64_t) g->width * g->height;
 	uint64_t i = 0;
 	for(tile *t = g->lookup; i < num_tiles; t++, i++) {
 		tile cur = *t;
@@ -265,6 +603,7 @@ void rotate_grid(grid g, bool clockwise) {
 	reset_origin(g);
 
 	rebuild_lookup(g);
+	rebuild_occupancy(g);
 }
 
 /* Rebuilds all lookup data in a grid.
@@ -290,7 +629,7 @@ static void rebuild_lookup(grid g) {
 			now->row = row;
 			now->column = column;
 
-			g->lookup[row * g->width + column] = now;
+			g->lookup[(size_t) row * g->width + column] = now;
 
 			now = now->right;
 			column++;
@@ -302,6 +641,28 @@ static void rebuild_lookup(grid g) {
 	}
 }
 
+/* Rebuilds the occupancy plane of a Grid from its lookup table.
+ * The lookup table must be up to date.
+ */
+static void rebuild_occupancy(grid g) {
+	assert(g);
+
+	g->occ_stride = (g->width + OCC_WORD_BITS - 1) / OCC_WORD_BITS;
+	memset(g->occupancy, 0,
+	       sizeof(uint64_t) * g->occ_stride * g->height);
+	g->generation++;
+
+	tile *t = g->lookup;
+	for (uint32_t row = 0; row < g->height; row++) {
+		uint64_t *bits = g->occupancy + (size_t) row * g->occ_stride;
+		for (uint32_t column = 0; column < g->width; column++, t++) {
+			if ((*t)->stand.stand_stand.s)
+				bits[column / OCC_WORD_BITS] |=
+					(uint64_t) 1 << (column % OCC_WORD_BITS);
+		}
+	}
+}
+
 /* Finds the true origin tile, starting from the apparent origin
  * and moving northeast. Sets the origin pointer to the found Tile.
  */
@@ -317,18 +678,23 @@ static void reset_origin(grid g) {
 }
 
 grid clone_grid(grid g) {
+	if (g->chunks)
+		return clone_sparse_grid(g);
+
 	grid cg = new_grid(g->width, g->height);
 	if (!cg)
 		goto out_cg;
 
 	// copy stand references
-	uint64_t num_tiles = g->width * g->height;
+	uint64_t num_tiles = (uint64_t) g->width * g->height;
 	tile *old, *new;
 	uint64_t ti;
 	for (old = g->lookup, new = cg->lookup, ti = 0;
 	     ti < num_tiles; old++, new++, ti++) {
 		(*new)->stand = (*old)->stand;
 	}
+	memcpy(cg->occupancy, g->occupancy,
+	       sizeof(uint64_t) * g->occ_stride * g->height);
 
 	return cg;
 
@@ -338,9 +704,10 @@ grid clone_grid(grid g) {
 
 void mirror_grid(grid g) {
 	assert(g);
+	assert(!g->chunks);
 	
 	// iterate through each tile in the grid
-	uint64_t num_tiles = g->width * g->height;
+	uint64_t num_tiles = (uint64_t) g->width * g->height;
 	uint64_t i = 0;
 	for(tile *t = g->lookup; i < num_tiles; t++, i++) {
 		tile cur = *t;
@@ -357,4 +724,32 @@ void mirror_grid(grid g) {
 	// now we need to update the Grid structure's members
 	reset_origin(g);
 	rebuild_lookup(g);
+	rebuild_occupancy(g);
+}
+
+/* Clones a sparse Grid, copying only its occupied chunks. */
+static grid clone_sparse_grid(grid g) {
+	grid cg = new_sparse_grid(g->width, g->height);
+	if (!cg)
+		goto out_cg;
+
+	size_t num_chunks = (size_t) g->chunk_columns
+		* ((g->height + GRID_CHUNK_SIZE - 1) >> GRID_CHUNK_SHIFT);
+	for (size_t i = 0; i < num_chunks; i++) {
+		if (!g->chunks[i])
+			continue;
+		cg->chunks[i] = malloc(sizeof(struct grid_chunk));
+		if (!cg->chunks[i])
+			goto out_chunks;
+		memcpy(cg->chunks[i], g->chunks[i], sizeof(struct grid_chunk));
+	}
+	memcpy(cg->occupancy, g->occupancy,
+	       sizeof(uint64_t) * g->occ_stride * g->height);
+
+	return cg;
+
+	out_chunks:;
+		del_grid(cg);
+	out_cg:;
+		return NULL;
 }
@@ -31,6 +31,8 @@ typedef struct tile *tile;
 typedef struct grid *grid;
 typedef struct stand *stand;
 typedef struct stand_template *stand_template;
+typedef struct spatial_index *spatial_index;
+typedef struct origin_cache *origin_cache;
 
 /* The stand-like type can represent either a stand or a
  * stand_template, and should be used to pass these types to
@@ -51,6 +53,19 @@ typedef union stand_like {
 	} stand_st;
 } stand_like;
 
+/* A rectangle of Tiles: the bounding box of a shape or a region of a Grid.
+ * An empty shape has a height and width of 0.
+ */
+struct extent {
+	int64_t row;
+	int64_t column;
+	uint32_t height;
+	uint32_t width;
+};
+
+// most rectangles a Grid's dirty set is coalesced into
+#define MAX_DIRTY_RECTS 16
+
 struct tile {
 	tile up;
 	tile right;
@@ -67,8 +82,68 @@ struct grid {
 	uint32_t height;
 	uint32_t width;
 	tile *lookup;
+
+	// backing storage for every Tile in the Grid
+	struct tile *tiles;
+
+	/* Sparse Grids (see new_sparse_grid) have no lookup table, Tile
+	 * slab or origin. Instead, their Tiles are split into square chunks
+	 * of GRID_CHUNK_SIZE Tiles on a side, stored row-major in chunks.
+	 * A NULL chunk is entirely empty. Spare chunks are kept on a free
+	 * list so that filling a chunk never has to allocate.
+	 */
+	struct grid_chunk **chunks;
+	uint32_t chunk_columns;
+	struct grid_chunk *spare_chunks;
+	uint32_t num_spare_chunks;
+
+	/* The occupancy plane packs one bit per Tile, set when the Tile
+	 * holds a Stand or Stand Template. It is stored row-major, with
+	 * occ_stride 64-bit words per row; bit i of word w in a row is the
+	 * Tile in column (w * 64 + i). Bits past the last column are
+	 * always clear.
+	 */
+	uint64_t *occupancy;
+	uint32_t occ_stride;
+
+	/* Dense registry of the Stands applied to this Grid, in no
+	 * particular order. It is maintained by do_apply and remove_stand,
+	 * and lets callers visit every Stand without scanning the Tiles.
+	 */
+	stand *stands;
+	uint32_t num_stands;
+	uint32_t stands_cap;
+
+	// bounding boxes of the registered Stands, created on first use
+	spatial_index index;
+
+	/* Counts changes to the occupancy plane, so that anything worked
+	 * out from it can tell when it is stale. It goes up whenever a
+	 * Tile becomes occupied or empty.
+	 */
+	uint64_t generation;
+
+	// valid-origin bitmaps of recently placed shapes, created on first
+	// use (see origins.c)
+	origin_cache origins;
+
+	/* Regions whose Tiles have changed since they were last taken with
+	 * grid_take_dirty, coalesced into at most MAX_DIRTY_RECTS
+	 * rectangles. They are recorded per Stand by do_apply and
+	 * remove_stand, not per Tile.
+	 */
+	struct extent dirty[MAX_DIRTY_RECTS];
+	uint32_t num_dirty;
 };
 
+#define OCC_WORD_BITS 64
+
+#define GRID_CHUNK_SHIFT 6
+#define GRID_CHUNK_SIZE (1 << GRID_CHUNK_SHIFT)
+
+// Grids with more Tiles than this are built sparse by load_file
+#define SPARSE_GRID_MIN_TILES (1024 * 1024)
+
 /* Allocates and initializes a new Grid.
  * 
  * As all Grids are rectangular, this method accepts width
@@ -80,9 +155,28 @@ struct grid {
  */
 grid new_grid(uint32_t width, uint32_t height);
 
+/* Allocates and initializes a new sparse Grid.
+ * 
+ * A sparse Grid only allocates Tiles for the chunks of the Grid that
+ * Stands actually occupy, so its memory grows with the occupied area rather
+ * than with its dimensions. It is intended for very large maps.
+ * 
+ * grid_lookup, grid_set_stand and the occupancy plane work the same as on
+ * any other Grid. However, the Tiles of a sparse Grid are not linked to
+ * their neighbours, and the Tiles of empty chunks are all the same shared
+ * empty Tile, so their coordinates are meaningless. Sparse Grids cannot be
+ * rotated or mirrored.
+ * 
+ * Returns NULL if space could not be allocated.
+ */
+grid new_sparse_grid(uint32_t width, uint32_t height);
+
 /* Allocates and initializes a new Grid which is a clone of
  * an existing one.
  * 
+ * Only the Tiles are cloned; the new Grid starts with an empty Stand
+ * registry, as a Stand may only be applied to one Grid.
+ * 
  * Returns NULL if space could not be allocated.
  */
 grid clone_grid(grid g);
@@ -90,15 +184,100 @@ grid clone_grid(grid g);
 /* Deallocates a Grid. */
 void del_grid(grid g);
 
+/* Ensures the Stand registry of a Grid has room for the given number of
+ * additional Stands, so that registering them cannot fail.
+ * 
+ * Returns false if space could not be allocated.
+ */
+bool grid_reserve_stands(grid g, uint32_t extra);
+
+/* Ensures that every Tile in the given rectangle of a Grid can be given a
+ * stand-like by grid_set_stand without allocating.
+ * 
+ * This only does work on sparse Grids, where it sets aside the chunks the
+ * rectangle would need. The rectangle may extend off the Grid.
+ * 
+ * Returns false if space could not be allocated.
+ */
+bool grid_reserve_region(grid g, int64_t row, int64_t column,
+                         uint32_t height, uint32_t width);
+
+/* Records that the Tiles in the given rectangle of a Grid have changed.
+ * 
+ * The rectangle is clipped to the Grid, and merged with any recorded
+ * rectangle it overlaps or touches. If the set is full, it is merged with
+ * whichever rectangle grows the least.
+ */
+void grid_mark_dirty(grid g, int64_t row, int64_t column,
+                     uint32_t height, uint32_t width);
+
+/* Copies up to max of the recorded dirty rectangles of a Grid into out,
+ * then clears the set.
+ * 
+ * Returns the number of rectangles copied.
+ */
+uint32_t grid_take_dirty(grid g, struct extent *out, uint32_t max);
+
+/* Returns true if the Grid is sparse. */
+static inline bool grid_is_sparse(grid g) {
+	return g->chunks != NULL;
+}
+
 /* Convenience method for the lookup table.
  * Returns the Tile located at the specified coordinates.
  */
 tile grid_lookup(grid g, uint32_t row, uint32_t column);
 
-/* Rotates a grid 90 degrees */
+/* Sets the stand-like held by the Tile at the given coordinates,
+ * keeping the occupancy plane in sync.
+ * 
+ * All writes to the stand-like of a Tile in a Grid should go through this
+ * function. On a sparse Grid, grid_reserve_region must have been called
+ * for the Tile first.
+ */
+void grid_set_stand(grid g, uint32_t row, uint32_t column, stand_like sl);
+
+/* Returns true if the Tile at the given coordinates holds a stand-like. */
+static inline bool grid_occupied(grid g, uint32_t row, uint32_t column) {
+	return (g->occupancy[(size_t) row * g->occ_stride
+	                     + column / OCC_WORD_BITS]
+	        >> (column % OCC_WORD_BITS)) & 1;
+}
+
+/* Returns the occupancy of the 64 Tiles in the given row, starting at the
+ * given column, packed so that bit i is the Tile at (column + i).
+ * 
+ * The column may lie off the Grid in either direction; columns off the
+ * Grid read as empty.
+ */
+uint64_t grid_row_window(grid g, uint32_t row, int64_t column);
+
+/* Does the work of grid_row_window on one row of any occupancy plane laid
+ * out like a Grid's, given the row's words and its stride, for code that
+ * keeps copies of the plane.
+ */
+uint64_t occupancy_window(const uint64_t *bits, uint32_t occ_stride,
+                          int64_t column);
+
+/* Returns a word with bit i set if any of the length Tiles starting at
+ * (column + i) in one row of an occupancy plane is occupied, length being
+ * at most 64. These are the origins, relative to the first of its Tiles,
+ * at which a run of that many Tiles would overlap something.
+ */
+uint64_t occupancy_run_window(const uint64_t *bits, uint32_t occ_stride,
+                              int64_t column, uint32_t length);
+
+/* Returns a mask of the 64 columns starting at the given column, with
+ * bit i set if column (column + i) lies on the Grid.
+ */
+uint64_t grid_window_mask(grid g, int64_t column);
+
+/* Rotates a grid 90 degrees. The Grid must not be sparse. */
 void rotate_grid(grid g, bool clockwise);
 
-/* Reflects a Grid horizontally by swapping its columns. */
+/* Reflects a Grid horizontally by swapping its columns.
+ * The Grid must not be sparse.
+ */
 void mirror_grid(grid g);
 
 #endif
@@ -0,0 +1,410 @@
+/* history.c
+ *
+ * This file contains definitions for the undo history, which lets the user
+ * step back and forth through their edits to the Main Grid.
+ *
+ * The history never copies the Grid. Each edit is kept as a delta: the
+ * Stand it changed, and where and which way round it lay before and after,
+ * or its old and new names. Undoing or redoing a delta takes the Stand off
+ * the Grid and applies it where it should be, so it costs time in
+ * proportion to the area of the Stand, whatever the size of the map.
+ *
+ * A Stand an edit takes off the Grid is not deleted, but kept by the delta
+ * that took it off, so that undoing the edit can put the very same Stand
+ * back; later deltas can then keep referring to it. A Stand off the Grid
+ * is deleted once no delta could put it back: when the oldest step is
+ * forgotten, or when a new edit throws away the steps that were undone.
+ *
+ * Deltas are kept in a ring, HISTORY_MAX_DELTAS long, and grouped into
+ * steps, so that a batch of edits (such as a layout from the packer) is
+ * undone in one go. Once the ring or the number of steps is full, the
+ * oldest step is forgotten. A step too big to fit in the ring at all
+ * can't be undone, and neither can anything before it.
+ *
+ * Every change undo and redo make is recorded in the journal: a Stand
+ * that moves or turns is lifted and applied again, one that goes is
+ * removed, and one that comes back is applied as a new Stand of its Stand
+ * Template. The journal can only name a new Stand by its Stand Template,
+ * so taking off a Stand with a shape of its own, such as one loaded from
+ * a file, can't be undone. That edit clears the history instead, since
+ * undoing the steps before it would no longer give back the map they were
+ * made on.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "journal.h"
+#include "capi.h"
+#include "history.h"
+
+/* Where a Stand lies, if it is on the Main Grid at all. */
+struct spot {
+	int64_t row;
+	int64_t column;
+	uint8_t orientation;
+	bool applied;
+};
+
+/* One change to one Stand. */
+struct delta {
+	stand s;
+	// whether this is the first delta of its step
+	bool first;
+	bool rename;
+	union {
+		struct {
+			struct spot before;
+			struct spot after;
+		} place;
+		struct {
+			char *before;
+			char *after;
+		} name;
+	};
+};
+
+static void record(struct delta *d);
+static void drop_oldest_step(void);
+static void discard(struct delta *d, bool done);
+static bool apply_delta(struct delta *d, bool undo);
+static bool put_stand(stand s, struct spot *to, int32_t st_id);
+static bool put_lifted(stand s, struct spot *to);
+static int32_t template_of(stand s);
+static struct spot spot_of(stand s);
+static inline struct delta *slot(uint32_t i);
+
+// the ring of deltas, allocated on first use; the oldest is at head
+static struct delta *ring = NULL;
+static uint32_t head = 0;
+static uint32_t count = 0;
+// the first done deltas have been made (or redone); the rest were undone
+static uint32_t done = 0;
+// the number of deltas in ring that start a step
+static uint32_t steps = 0;
+
+// how deeply history_begin_step calls are nested, and whether the open
+// step has any deltas yet, or has outgrown the ring
+static uint32_t depth = 0;
+static bool step_started = false;
+static bool step_lost = false;
+
+/* Starts a step made of several edits, such as a batch of new Stands,
+ * which is undone all at once. Steps may be nested; the step ends with the
+ * outermost history_end_step.
+ */
+void history_begin_step(void) {
+	if (depth++ == 0) {
+		step_started = false;
+		step_lost = false;
+	}
+}
+
+void history_end_step(void) {
+	assert(depth > 0);
+	depth--;
+}
+
+/* Records that a Stand was applied to the Main Grid. */
+void history_add(stand s) {
+	struct delta d = {.s = s, .rename = false};
+	d.place.before.applied = false;
+	d.place.after = spot_of(s);
+	record(&d);
+}
+
+/* Records that a Stand was taken off the Main Grid, where its row, column
+ * and orientation still say it was.
+ *
+ * The history takes the Stand over: the caller must not delete it.
+ */
+void history_remove(stand s) {
+	struct delta d = {.s = s, .rename = false};
+	d.place.before = spot_of(s);
+	d.place.before.applied = true;
+	d.place.after.applied = false;
+	record(&d);
+}
+
+/* Records that a Stand on the Main Grid was moved, turned or both. */
+void history_move(stand s, int64_t old_row, int64_t old_column,
+                  uint8_t old_orientation) {
+	struct delta d = {.s = s, .rename = false};
+	d.place.before = (struct spot) {old_row, old_column, old_orientation,
+	                                true};
+	d.place.after = spot_of(s);
+	record(&d);
+}
+
+/* Records that a Stand on the Main Grid was renamed. */
+void history_rename(stand s, const char *old_name) {
+	struct delta d = {.s = s, .rename = true};
+	d.name.before = malloc(strlen(old_name) + 1);
+	d.name.after = malloc(strlen(s->name) + 1);
+	if (!d.name.before || !d.name.after) {
+		// without both names it can't be undone, and nor can
+		// anything before it
+		free(d.name.before);
+		free(d.name.after);
+		history_clear();
+		return;
+	}
+	strcpy(d.name.before, old_name);
+	strcpy(d.name.after, s->name);
+	record(&d);
+}
+
+/* Undoes the last step that was made or redone.
+ *
+ * Returns false if there is nothing to undo, or if the step couldn't be
+ * undone, in which case the Main Grid is left as it was.
+ */
+bool history_undo(void) {
+	if (done == 0 || depth > 0)
+		return false;
+
+	uint32_t start = done - 1;
+	while (!slot(start)->first)
+		start--;
+	for (uint32_t i = done; i > start; i--) {
+		if (apply_delta(slot(i - 1), true))
+			continue;
+		// put back the part of the step already undone
+		for (uint32_t j = i; j < done; j++)
+			apply_delta(slot(j), false);
+		return false;
+	}
+	done = start;
+	return true;
+}
+
+/* Redoes the last step that was undone.
+ *
+ * Returns false if there is nothing to redo, or if the step couldn't be
+ * redone, in which case the Main Grid is left as it was.
+ */
+bool history_redo(void) {
+	if (done == count || depth > 0)
+		return false;
+
+	uint32_t end = done + 1;
+	while (end < count && !slot(end)->first)
+		end++;
+	for (uint32_t i = done; i < end; i++) {
+		if (apply_delta(slot(i), false))
+			continue;
+		for (uint32_t j = i; j > done; j--)
+			apply_delta(slot(j - 1), true);
+		return false;
+	}
+	done = end;
+	return true;
+}
+
+bool history_can_undo(void) {
+	return done > 0;
+}
+
+bool history_can_redo(void) {
+	return done < count;
+}
+
+/* Forgets every step, deleting the Stands the history kept. This must be
+ * called whenever the Main Grid or the Stand Templates are replaced.
+ */
+void history_clear(void) {
+	while (count > done)
+		discard(slot(--count), false);
+	while (count > 0) {
+		discard(slot(0), true);
+		head = (head + 1) % HISTORY_MAX_DELTAS;
+		count--;
+	}
+	done = 0;
+	steps = 0;
+	if (depth > 0)
+		step_lost = true;
+}
+
+/* Adds a delta for an edit that has just been made, throwing away anything
+ * that was undone and making room as needed.
+ */
+static void record(struct delta *d) {
+	if (depth > 0 && step_lost) {
+		discard(d, true);
+		return;
+	}
+	if (!d->rename && d->place.before.applied && !d->place.after.applied
+	    && template_of(d->s) < 0) {
+		// the journal couldn't record putting it back
+		history_clear();
+		discard(d, true);
+		return;
+	}
+	if (!ring) {
+		ring = malloc(sizeof(struct delta) * HISTORY_MAX_DELTAS);
+		if (!ring) {
+			discard(d, true);
+			return;
+		}
+	}
+
+	// the steps that were undone can never be redone now
+	while (count > done) {
+		struct delta *undone = slot(--count);
+		if (undone->first)
+			steps--;
+		discard(undone, false);
+	}
+
+	d->first = depth == 0 || !step_started;
+	if (depth > 0)
+		step_started = true;
+	if (d->first && steps == HISTORY_MAX_STEPS)
+		drop_oldest_step();
+	while (count == HISTORY_MAX_DELTAS) {
+		if (!d->first && steps == 1) {
+			// the open step fills the whole ring by itself
+			history_clear();
+			discard(d, true);
+			return;
+		}
+		drop_oldest_step();
+	}
+
+	*slot(count++) = *d;
+	done = count;
+	if (d->first)
+		steps++;
+}
+
+/* Forgets the oldest step, which must have been made. */
+static void drop_oldest_step(void) {
+	assert(count > 0 && done > 0);
+	do {
+		discard(slot(0), true);
+		head = (head + 1) % HISTORY_MAX_DELTAS;
+		count--;
+		done--;
+	} while (count > 0 && !slot(0)->first);
+	steps--;
+}
+
+/* Lets go of a delta that is being forgotten, deleting its Stand if the
+ * delta, as made or as undone, left it off the Grid.
+ */
+static void discard(struct delta *d, bool done) {
+	if (d->rename) {
+		free(d->name.before);
+		free(d->name.after);
+		return;
+	}
+	struct spot *now = done ? &d->place.after : &d->place.before;
+	if (!now->applied)
+		del_stand(d->s);
+}
+
+/* Makes or undoes the change of one delta. */
+static bool apply_delta(struct delta *d, bool undo) {
+	stand s = d->s;
+	if (d->rename) {
+		const char *name = undo ? d->name.before : d->name.after;
+		char *copy = malloc(strlen(name) + 1);
+		if (!copy)
+			return false;
+		strcpy(copy, name);
+		free(s->name);
+		s->name = copy;
+		journal_rename_stand(s, copy);
+		return true;
+	}
+
+	struct spot *from = undo ? &d->place.after : &d->place.before;
+	struct spot *to = undo ? &d->place.before : &d->place.after;
+	if (from->applied && to->applied) {
+		journal_lift(s);
+		remove_stand(s);
+		s->g = NULL;
+		if (put_lifted(s, to))
+			return true;
+		put_lifted(s, from);
+		return false;
+	}
+	if (from->applied) {
+		journal_remove(s);
+		remove_stand(s);
+		s->g = NULL;
+		return true;
+	}
+	if (to->applied) {
+		int32_t st_id = template_of(s);
+		if (st_id < 0)
+			return false; // the journal couldn't record it
+		return put_stand(s, to, st_id);
+	}
+	return true;
+}
+
+/* Applies a Stand that is off the Main Grid at the given spot. */
+static bool put_stand(stand s, struct spot *to, int32_t st_id) {
+	set_stand_orientation(s, to->orientation);
+	if (!can_apply(s, main_grid, to->row, to->column))
+		return false;
+	do_apply(s);
+
+	journal_apply_new(st_id, s);
+	if (strcmp(s->name, main_templates[st_id].name) != 0)
+		journal_rename_stand(s, s->name);
+	return true;
+}
+
+/* Applies a Stand lifted from the Main Grid at the given spot. */
+static bool put_lifted(stand s, struct spot *to) {
+	set_stand_orientation(s, to->orientation);
+	if (!can_apply(s, main_grid, to->row, to->column))
+		return false;
+	do_apply(s);
+	journal_apply_lifted(s);
+	return true;
+}
+
+/* Returns the Stand Template a Stand was made from, as the journal knows
+ * it, or -1 if it isn't one of the current ones.
+ */
+static int32_t template_of(stand s) {
+	for (int32_t i = 0; i < num_main_templates; i++)
+		if (main_templates[i].orients == s->orients)
+			return i;
+	return -1;
+}
+
+static struct spot spot_of(stand s) {
+	return (struct spot) {s->row, s->column, s->orientation,
+	                      s->registry_index != STAND_UNREGISTERED};
+}
+
+static inline struct delta *slot(uint32_t i) {
+	return &ring[(head + i) % HISTORY_MAX_DELTAS];
+}
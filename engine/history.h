@@ -0,0 +1,52 @@
+/* history.h
+ *
+ * This file contains declarations for the undo history of the Main Grid.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stand.h"
+
+// most steps that can be undone
+#define HISTORY_MAX_STEPS 256
+
+// most changes to single Stands the history holds, over all its steps
+#define HISTORY_MAX_DELTAS (64 * 1024)
+
+void history_begin_step(void);
+void history_end_step(void);
+
+void history_add(stand s);
+void history_remove(stand s);
+void history_move(stand s, int64_t old_row, int64_t old_column,
+                  uint8_t old_orientation);
+void history_rename(stand s, const char *old_name);
+
+bool history_undo(void);
+bool history_redo(void);
+bool history_can_undo(void);
+bool history_can_redo(void);
+void history_clear(void);
+
+#endif
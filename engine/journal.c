@@ -0,0 +1,939 @@
+/* journal.c
+ *
+ * This file contains definitions for the edit journal, which records
+ * every change made to a map since it was last saved in full.
+ *
+ * A map saved at "sale.mmgs" is journaled to "sale.mmgs.journal". Every
+ * change the user makes through the API is appended to it as a small
+ * record, so an autosave costs a few bytes rather than a whole save_file,
+ * and a crash loses at most the records not yet synced to disk. When the
+ * map is next loaded, the journal is replayed on top of it.
+ *
+ * Records are synced once JOURNAL_SYNC_RECORDS of them build up, or once
+ * the oldest unsynced one is JOURNAL_SYNC_SECONDS old. A burst of edits
+ * shares one sync; a sync thread waits out the deadline of the last few,
+ * so they reach the disk even if no more edits follow.
+ *
+ * The journal starts with a header holding the hash of the snapshot it
+ * applies to, so a journal left over from some other version of the file
+ * is never replayed onto it. Each record is its type, the length of its
+ * payload, the payload and a checksum; replay stops at the first record
+ * that is torn or corrupt.
+ *
+ * Once the journal grows past JOURNAL_COMPACT_BYTES it is folded into a
+ * fresh snapshot. The snapshot is rendered into memory right away, and new
+ * records go to "sale.mmgs.journal.next", which starts from it. A
+ * background thread then writes the snapshot out and renames it over the
+ * map, and renames the next journal over the old one. If it is interrupted,
+ * journal_open finds both journals and works out which to replay: the next
+ * journal alone if the snapshot was replaced, or else the old journal
+ * followed by the next one, which carries on where the old one stopped.
+ *
+ * Stands are identified in records by their key Tile, the first Tile they
+ * occupy in row-major order.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "save_n_load.h"
+#include "binfile.h"
+#include "journal.h"
+#include "capi.h"
+
+#define JOURNAL_VERSION 1
+
+// "MMGJ", version, hash of the snapshot, hash of the previous snapshot
+#define HEADER_BYTES 16
+
+// type, payload length, checksum
+#define RECORD_OVERHEAD 7
+#define MAX_PAYLOAD 1024
+
+enum record_type {
+	RECORD_APPLY_NEW = 1,   // st_id:u32 row:i64 column:i64 orientation:u8
+	RECORD_LIFT,            // key
+	RECORD_APPLY_LIFTED,    // row:i64 column:i64 [turn:u8]
+	RECORD_DROP_LIFTED,     // nothing
+	RECORD_REMOVE,          // key
+	RECORD_ROTATE,          // key clockwise:u8
+	RECORD_MIRROR,          // key
+	RECORD_RENAME_STAND,    // key name
+	RECORD_RENAME_TEMPLATE  // st_id:u32 name
+};
+
+/* A record being assembled for appending. */
+struct record {
+	uint8_t type;
+	size_t len;
+	uint8_t payload[MAX_PAYLOAD];
+};
+
+/* A snapshot being written out by the background thread. */
+struct compaction {
+	char *snapshot_path;
+	char *journal_path;
+	char *next_path;
+	char *data;
+	size_t len;
+	bool done; // guarded by compaction_lock
+	bool ok;
+};
+
+static void put_le(struct record *r, uint64_t v, int bytes);
+static void put_key(struct record *r, stand s);
+static void put_name(struct record *r, const char *name);
+static void append_record(struct record *r);
+static uint64_t get_le(const uint8_t *p, int bytes);
+static size_t replay(const uint8_t *data, size_t len);
+static bool replay_record(uint8_t type, const uint8_t *p, size_t len);
+static stand stand_at(int64_t row, int64_t column);
+static void maybe_sync(void);
+static void sync_journal(void);
+static void start_syncer(void);
+static void stop_syncer(void);
+static void *run_syncer(void *arg);
+static void maybe_compact(void);
+static bool finish_compaction(bool wait);
+static void *run_compaction(void *arg);
+static bool render_snapshot(char **data, size_t *len);
+static int create_journal(const char *path, uint32_t base, uint32_t prev);
+static bool parse_header(const uint8_t *data, size_t len,
+                         uint32_t *base, uint32_t *prev);
+static char *path_with(const char *path, const char *suffix);
+static bool read_file(const char *path, uint8_t **data, size_t *len);
+static bool write_all(int fd, const void *buf, size_t len);
+static bool write_file_atomic(const char *path, const void *data,
+                              size_t len);
+static bool sync_dir(const char *path);
+static double seconds_since(const struct timespec *then);
+
+// the map being journaled, and the journal records are appended to
+static char *snapshot_path = NULL;
+static int journal_fd = -1;
+static uint32_t journal_base;
+static uint64_t journal_bytes;
+static uint32_t unsynced_records;
+static struct timespec last_sync;
+
+// guards journal_fd, unsynced_records and last_sync against the sync
+// thread, which waits on sync_cond for records to be left unsynced
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t sync_thread;
+static bool sync_running = false;
+static bool sync_stop;
+
+// whether a lifted Stand has yet to be applied or dropped; no snapshot is
+// taken meanwhile, as it couldn't include the Stand
+static bool lift_pending = false;
+// the orientation the lifted Stand had when it was lifted
+static uint8_t lifted_orientation;
+
+// Stand lifted by the records being replayed
+static stand replay_lifted = NULL;
+
+static pthread_mutex_t compaction_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t compaction_thread;
+static struct compaction *compaction = NULL;
+
+// set once a compaction fails; the files it left behind can still be
+// recovered from, but not compacted again until the map is reopened
+static bool compaction_failed = false;
+
+/* Attaches the journal to a map just loaded from snapshot_path, first
+ * replaying any changes recorded since the snapshot was written.
+ *
+ * Returns false if the journal couldn't be set up, in which case changes
+ * are not journaled.
+ */
+bool journal_open(const char *path) {
+	journal_close();
+
+	uint8_t *snapshot;
+	size_t snapshot_len;
+	if (!read_file(path, &snapshot, &snapshot_len))
+		return false;
+	uint32_t snapshot_hash = hash_bytes(snapshot, snapshot_len);
+	free(snapshot);
+
+	char *jpath = path_with(path, JOURNAL_SUFFIX);
+	char *npath = path_with(path, JOURNAL_NEXT_SUFFIX);
+	snapshot_path = malloc(strlen(path) + 1);
+	if (!jpath || !npath || !snapshot_path)
+		goto out_fail;
+	strcpy(snapshot_path, path);
+
+	uint8_t *j = NULL;
+	uint8_t *n = NULL;
+	size_t jlen = 0;
+	size_t nlen = 0;
+	uint32_t jbase, jprev, nbase, nprev;
+	bool have_next = read_file(npath, &n, &nlen);
+	bool j_ok = read_file(jpath, &j, &jlen)
+		&& parse_header(j, jlen, &jbase, &jprev)
+		&& jbase == snapshot_hash;
+	bool n_ok = have_next && parse_header(n, nlen, &nbase, &nprev);
+
+	size_t j_end = HEADER_BYTES;
+	if (n_ok && nbase == snapshot_hash) {
+		// the snapshot was replaced, but not the journal
+		replay(n, nlen);
+	} else if (j_ok) {
+		j_end = replay(j, jlen);
+		// the next journal carries on where this one stopped
+		if (n_ok && nprev == jbase && j_end == jlen)
+			replay(n, nlen);
+	}
+	free(j);
+	free(n);
+
+	// a Stand lifted and never put down goes back where it was
+	if (replay_lifted) {
+		if (can_apply(replay_lifted, main_grid,
+		              replay_lifted->row, replay_lifted->column))
+			do_apply(replay_lifted);
+		else
+			del_stand(replay_lifted);
+		replay_lifted = NULL;
+	}
+
+	if (have_next) {
+		// settle an interrupted compaction with a fresh snapshot, so
+		// there is one journal again
+		char *data;
+		size_t len;
+		if (!render_snapshot(&data, &len))
+			goto out_fail;
+		bool ok = write_file_atomic(path, data, len);
+		snapshot_hash = hash_bytes(data, len);
+		free(data);
+		if (!ok)
+			goto out_fail;
+		journal_fd = create_journal(jpath, snapshot_hash, snapshot_hash);
+		unlink(npath);
+	} else if (j_ok) {
+		// carry on after the last good record, dropping any torn one
+		journal_fd = open(jpath, O_WRONLY);
+		if (journal_fd >= 0
+		    && (ftruncate(journal_fd, j_end) != 0
+		        || lseek(journal_fd, 0, SEEK_END) < 0)) {
+			close(journal_fd);
+			journal_fd = -1;
+		}
+	} else {
+		journal_fd = create_journal(jpath, snapshot_hash, snapshot_hash);
+	}
+	if (journal_fd < 0)
+		goto out_fail;
+
+	journal_base = snapshot_hash;
+	journal_bytes = j_ok && !have_next ? j_end : HEADER_BYTES;
+	unsynced_records = 0;
+	clock_gettime(CLOCK_MONOTONIC, &last_sync);
+	start_syncer();
+	free(jpath);
+	free(npath);
+	return true;
+
+out_fail:;
+	free(jpath);
+	free(npath);
+	free(snapshot_path);
+	snapshot_path = NULL;
+	return false;
+}
+
+/* Starts an empty journal for a map just saved in full to path. */
+bool journal_reset(const char *path) {
+	journal_close();
+
+	uint8_t *snapshot;
+	size_t snapshot_len;
+	if (!read_file(path, &snapshot, &snapshot_len))
+		return false;
+	uint32_t snapshot_hash = hash_bytes(snapshot, snapshot_len);
+	free(snapshot);
+
+	char *jpath = path_with(path, JOURNAL_SUFFIX);
+	char *npath = path_with(path, JOURNAL_NEXT_SUFFIX);
+	snapshot_path = malloc(strlen(path) + 1);
+	if (jpath && npath && snapshot_path) {
+		strcpy(snapshot_path, path);
+		journal_fd = create_journal(jpath, snapshot_hash,
+		                            snapshot_hash);
+		unlink(npath);
+	}
+	free(jpath);
+	free(npath);
+	if (journal_fd < 0) {
+		free(snapshot_path);
+		snapshot_path = NULL;
+		return false;
+	}
+
+	journal_base = snapshot_hash;
+	journal_bytes = HEADER_BYTES;
+	unsynced_records = 0;
+	clock_gettime(CLOCK_MONOTONIC, &last_sync);
+	start_syncer();
+	return true;
+}
+
+/* Syncs and detaches the journal, waiting for any compaction to finish. */
+void journal_close(void) {
+	finish_compaction(true);
+	stop_syncer();
+	if (journal_fd >= 0) {
+		fdatasync(journal_fd);
+		close(journal_fd);
+		journal_fd = -1;
+	}
+	free(snapshot_path);
+	snapshot_path = NULL;
+	lift_pending = false;
+	compaction_failed = false;
+}
+
+/* Records that a new Stand made from Stand Template st_id was applied. */
+void journal_apply_new(int32_t st_id, stand s) {
+	struct record r = {.type = RECORD_APPLY_NEW};
+	put_le(&r, (uint32_t) st_id, 4);
+	put_le(&r, (uint64_t) s->row, 8);
+	put_le(&r, (uint64_t) s->column, 8);
+	put_le(&r, s->orientation, 1);
+	append_record(&r);
+	maybe_compact();
+}
+
+/* Records that a Stand is about to be lifted from the Main Grid. */
+void journal_lift(stand s) {
+	maybe_compact();
+	struct record r = {.type = RECORD_LIFT};
+	put_key(&r, s);
+	append_record(&r);
+	lift_pending = true;
+	lifted_orientation = s->orientation;
+}
+
+/* Records that the lifted Stand was applied again, possibly turned.
+ *
+ * The turn is kept as the symmetry that takes the Stand from the way it
+ * was lifted to the way it is now, rather than as the orientation itself,
+ * since the orientation set of a Stand with a shape of its own is rebuilt
+ * from whichever way it lay when the map was saved.
+ */
+void journal_apply_lifted(stand s) {
+	struct record r = {.type = RECORD_APPLY_LIFTED};
+	put_le(&r, (uint64_t) s->row, 8);
+	put_le(&r, (uint64_t) s->column, 8);
+	put_le(&r, symmetry_between(lifted_orientation, s->orientation), 1);
+	lift_pending = false;
+	append_record(&r);
+	maybe_compact();
+}
+
+/* Records that the lifted Stand was deleted. */
+void journal_drop_lifted(void) {
+	struct record r = {.type = RECORD_DROP_LIFTED};
+	lift_pending = false;
+	append_record(&r);
+	maybe_compact();
+}
+
+/* Records that a Stand is about to be deleted from the Main Grid. */
+void journal_remove(stand s) {
+	maybe_compact();
+	struct record r = {.type = RECORD_REMOVE};
+	put_key(&r, s);
+	append_record(&r);
+}
+
+/* Records that a Stand is about to be rotated. */
+void journal_rotate(stand s, bool clockwise) {
+	maybe_compact();
+	struct record r = {.type = RECORD_ROTATE};
+	put_key(&r, s);
+	put_le(&r, clockwise, 1);
+	append_record(&r);
+}
+
+/* Records that a Stand is about to be mirrored. */
+void journal_mirror(stand s) {
+	maybe_compact();
+	struct record r = {.type = RECORD_MIRROR};
+	put_key(&r, s);
+	append_record(&r);
+}
+
+/* Records that a Stand on the Main Grid was renamed. */
+void journal_rename_stand(stand s, const char *name) {
+	struct record r = {.type = RECORD_RENAME_STAND};
+	put_key(&r, s);
+	put_name(&r, name);
+	append_record(&r);
+	maybe_compact();
+}
+
+/* Records that a Stand Template was renamed. */
+void journal_rename_template(int32_t st_id, const char *name) {
+	struct record r = {.type = RECORD_RENAME_TEMPLATE};
+	put_le(&r, (uint32_t) st_id, 4);
+	put_name(&r, name);
+	append_record(&r);
+	maybe_compact();
+}
+
+static void append_record(struct record *r) {
+	if (journal_fd < 0)
+		return;
+
+	uint8_t buf[RECORD_OVERHEAD + MAX_PAYLOAD];
+	buf[0] = r->type;
+	buf[1] = r->len;
+	buf[2] = r->len >> 8;
+	memcpy(buf + 3, r->payload, r->len);
+	uint32_t checksum = hash_bytes(buf, 3 + r->len);
+	for (int i = 0; i < 4; i++)
+		buf[3 + r->len + i] = checksum >> (8 * i);
+
+	size_t n = RECORD_OVERHEAD + r->len;
+	bool ok = write_all(journal_fd, buf, n);
+	pthread_mutex_lock(&sync_lock);
+	if (!ok) {
+		// nothing after a failed write could be replayed, so stop
+		printf("journal write failed, changes are no longer journaled\n");
+		close(journal_fd);
+		journal_fd = -1;
+	} else {
+		journal_bytes += n;
+		if (unsynced_records++ == 0)
+			pthread_cond_signal(&sync_cond);
+		maybe_sync();
+	}
+	pthread_mutex_unlock(&sync_lock);
+}
+
+/* Syncs the journal to disk if enough records or time have built up.
+ * A record after a quiet spell is synced straight away, while a burst of
+ * them shares one sync. Called with sync_lock held.
+ */
+static void maybe_sync(void) {
+	if (unsynced_records < JOURNAL_SYNC_RECORDS
+	    && seconds_since(&last_sync) < JOURNAL_SYNC_SECONDS)
+		return;
+	sync_journal();
+}
+
+/* Syncs the journal to disk. Called with sync_lock held. */
+static void sync_journal(void) {
+	fdatasync(journal_fd);
+	unsynced_records = 0;
+	clock_gettime(CLOCK_MONOTONIC, &last_sync);
+}
+
+/* Starts the sync thread for a journal just opened. Without one, records
+ * are still synced as later ones are appended, and when the journal is
+ * closed.
+ */
+static void start_syncer(void) {
+	sync_stop = false;
+	sync_running = pthread_create(&sync_thread, NULL,
+	                              run_syncer, NULL) == 0;
+}
+
+static void stop_syncer(void) {
+	if (!sync_running)
+		return;
+	pthread_mutex_lock(&sync_lock);
+	sync_stop = true;
+	pthread_cond_signal(&sync_cond);
+	pthread_mutex_unlock(&sync_lock);
+	pthread_join(sync_thread, NULL);
+	sync_running = false;
+}
+
+/* Syncs the records left over from the end of a burst once they are
+ * JOURNAL_SYNC_SECONDS old, when no later record has done it already.
+ */
+static void *run_syncer(void *arg) {
+	(void) arg;
+	pthread_mutex_lock(&sync_lock);
+	while (!sync_stop) {
+		if (journal_fd < 0 || unsynced_records == 0) {
+			pthread_cond_wait(&sync_cond, &sync_lock);
+			continue;
+		}
+
+		// the condition variable waits on the real time clock
+		double wait = JOURNAL_SYNC_SECONDS - seconds_since(&last_sync);
+		if (wait <= 0) {
+			sync_journal();
+			continue;
+		}
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		long ns = deadline.tv_nsec + (long) (wait * 1e9);
+		deadline.tv_sec += ns / 1000000000;
+		deadline.tv_nsec = ns % 1000000000;
+		if (pthread_cond_timedwait(&sync_cond, &sync_lock,
+		                           &deadline) == ETIMEDOUT)
+			maybe_sync();
+	}
+	pthread_mutex_unlock(&sync_lock);
+	return NULL;
+}
+
+/* Starts folding the journal into a fresh snapshot if it has grown too
+ * big, and the last compaction is done.
+ *
+ * The snapshot has to hold exactly the changes in the journal so far, so
+ * this runs after a record is appended if the change has been made
+ * already, or before it is appended if the change is about to be made.
+ */
+static void maybe_compact(void) {
+	if (journal_fd < 0 || journal_bytes < JOURNAL_COMPACT_BYTES
+	    || lift_pending || !finish_compaction(false) || compaction_failed)
+		return;
+
+	char *data;
+	size_t len;
+	if (!render_snapshot(&data, &len))
+		return;
+	uint32_t hash = hash_bytes(data, len);
+
+	struct compaction *job = calloc(1, sizeof(struct compaction));
+	if (!job)
+		goto out_data;
+	job->data = data;
+	job->len = len;
+	job->snapshot_path = path_with(snapshot_path, "");
+	job->journal_path = path_with(snapshot_path, JOURNAL_SUFFIX);
+	job->next_path = path_with(snapshot_path, JOURNAL_NEXT_SUFFIX);
+	if (!job->snapshot_path || !job->journal_path || !job->next_path)
+		goto out_job;
+
+	// new records go to the next journal from here on
+	int next_fd = create_journal(job->next_path, hash, journal_base);
+	if (next_fd < 0)
+		goto out_job;
+	pthread_mutex_lock(&sync_lock);
+	fdatasync(journal_fd);
+	close(journal_fd);
+	journal_fd = next_fd;
+	unsynced_records = 0;
+	pthread_mutex_unlock(&sync_lock);
+	journal_base = hash;
+	journal_bytes = HEADER_BYTES;
+
+	compaction = job;
+	if (pthread_create(&compaction_thread, NULL,
+	                   run_compaction, job) != 0) {
+		// no thread to be had, so do it here instead
+		run_compaction(job);
+		compaction_thread = pthread_self();
+	}
+	return;
+
+out_job:;
+	free(job->snapshot_path);
+	free(job->journal_path);
+	free(job->next_path);
+	free(job);
+out_data:;
+	free(data);
+}
+
+/* Writes out a compaction's snapshot, then puts its journal in place. */
+static void *run_compaction(void *arg) {
+	struct compaction *job = arg;
+
+	// if this fails part way, journal_open can still piece things
+	// together from whatever files are left
+	bool ok = write_file_atomic(job->snapshot_path, job->data, job->len)
+		&& rename(job->next_path, job->journal_path) == 0;
+	if (ok)
+		sync_dir(job->snapshot_path);
+
+	pthread_mutex_lock(&compaction_lock);
+	job->ok = ok;
+	job->done = true;
+	pthread_mutex_unlock(&compaction_lock);
+	return NULL;
+}
+
+/* Cleans up after the last compaction, if there was one. If wait is false
+ * and it is still running, returns false instead of waiting for it.
+ */
+static bool finish_compaction(bool wait) {
+	if (!compaction)
+		return true;
+
+	pthread_mutex_lock(&compaction_lock);
+	bool done = compaction->done;
+	pthread_mutex_unlock(&compaction_lock);
+	if (!done && !wait)
+		return false;
+
+	if (!pthread_equal(compaction_thread, pthread_self()))
+		pthread_join(compaction_thread, NULL);
+	if (!compaction->ok)
+		compaction_failed = true;
+	free(compaction->snapshot_path);
+	free(compaction->journal_path);
+	free(compaction->next_path);
+	free(compaction->data);
+	free(compaction);
+	compaction = NULL;
+	return true;
+}
+
+/* Renders the program state into memory, in the format of the map being
+ * journaled.
+ */
+static bool render_snapshot(char **data, size_t *len) {
+	FILE *f = open_memstream(data, len);
+	if (!f)
+		return false;
+
+	size_t path_len = strlen(snapshot_path);
+	size_t ext_len = strlen(BINARY_FILE_EXTENSION);
+	bool ok;
+	if (path_len >= ext_len
+	    && strcmp(snapshot_path + path_len - ext_len,
+	              BINARY_FILE_EXTENSION) == 0)
+		ok = save_file_binary(f);
+	else
+		ok = save_file(f);
+
+	if (fclose(f) != 0)
+		ok = false;
+	if (!ok)
+		free(*data);
+	return ok;
+}
+
+/* Replays the records of a journal, stopping at the first one that is
+ * torn, corrupt or can't be carried out. Returns the offset just past the
+ * last record replayed.
+ */
+static size_t replay(const uint8_t *data, size_t len) {
+	size_t at = HEADER_BYTES;
+	while (len - at >= RECORD_OVERHEAD) {
+		uint8_t type = data[at];
+		size_t payload_len = get_le(data + at + 1, 2);
+		if (len - at < RECORD_OVERHEAD + payload_len)
+			break;
+		uint32_t checksum = get_le(data + at + 3 + payload_len, 4);
+		if (checksum != hash_bytes(data + at, 3 + payload_len))
+			break;
+		if (!replay_record(type, data + at + 3, payload_len))
+			break;
+		at += RECORD_OVERHEAD + payload_len;
+	}
+	return at;
+}
+
+static bool replay_record(uint8_t type, const uint8_t *p, size_t len) {
+	stand s = NULL;
+	switch (type) {
+	case RECORD_APPLY_NEW: {
+		if (len != 21 || p[20] >= NUM_SYMMETRIES)
+			return false;
+		uint32_t st_id = get_le(p, 4);
+		if (st_id >= (uint32_t) num_main_templates)
+			return false;
+		s = new_stand(main_templates + st_id);
+		if (!s)
+			return false;
+		set_stand_orientation(s, p[20]);
+		if (!can_apply(s, main_grid, (int64_t) get_le(p + 4, 8),
+		               (int64_t) get_le(p + 12, 8))) {
+			del_stand(s);
+			return false;
+		}
+		do_apply(s);
+		return true;
+	}
+	case RECORD_LIFT:
+		if (len != 16 || !(s = stand_at(get_le(p, 8), get_le(p + 8, 8))))
+			return false;
+		if (replay_lifted)
+			del_stand(replay_lifted);
+		remove_stand(s);
+		s->g = NULL;
+		replay_lifted = s;
+		return true;
+	case RECORD_APPLY_LIFTED:
+		// older journals leave out the turn, as they never turned a
+		// lifted Stand
+		if ((len != 16 && len != 17) || !replay_lifted
+		    || (len == 17 && p[16] >= NUM_SYMMETRIES))
+			return false;
+		uint8_t lifted_sym = replay_lifted->orientation;
+		if (len == 17)
+			set_stand_orientation(replay_lifted,
+				transformed_symmetry(lifted_sym, p[16]));
+		if (!can_apply(replay_lifted, main_grid, (int64_t) get_le(p, 8),
+		               (int64_t) get_le(p + 8, 8))) {
+			set_stand_orientation(replay_lifted, lifted_sym);
+			return false;
+		}
+		do_apply(replay_lifted);
+		replay_lifted = NULL;
+		return true;
+	case RECORD_DROP_LIFTED:
+		if (replay_lifted)
+			del_stand(replay_lifted);
+		replay_lifted = NULL;
+		return true;
+	case RECORD_REMOVE:
+		if (len != 16 || !(s = stand_at(get_le(p, 8), get_le(p + 8, 8))))
+			return false;
+		del_stand(s);
+		return true;
+	case RECORD_ROTATE:
+		if (len != 17 || !(s = stand_at(get_le(p, 8), get_le(p + 8, 8))))
+			return false;
+		rotate_stand(s, p[16]);
+		return true;
+	case RECORD_MIRROR:
+		if (len != 16 || !(s = stand_at(get_le(p, 8), get_le(p + 8, 8))))
+			return false;
+		mirror_stand(s);
+		return true;
+	case RECORD_RENAME_STAND:
+	case RECORD_RENAME_TEMPLATE: {
+		size_t skip = type == RECORD_RENAME_STAND ? 16 : 4;
+		if (len < skip)
+			return false;
+		stand_template t = NULL;
+		if (type == RECORD_RENAME_STAND) {
+			if (!(s = stand_at(get_le(p, 8), get_le(p + 8, 8))))
+				return false;
+		} else {
+			uint32_t st_id = get_le(p, 4);
+			if (st_id >= (uint32_t) num_main_templates)
+				return false;
+			t = main_templates + st_id;
+		}
+		char *new_name = malloc(len - skip + 1);
+		if (!new_name)
+			return false;
+		memcpy(new_name, p + skip, len - skip);
+		new_name[len - skip] = '\0';
+		if (t) {
+			rename_stand_template(t, new_name);
+		} else {
+			free(s->name);
+			s->name = new_name;
+		}
+		return true;
+	}
+	default:
+		// a record from a newer version; nothing after it can be
+		// trusted to make sense
+		return false;
+	}
+}
+
+/* Returns the Stand on the Main Grid occupying the given Tile, if any. */
+static stand stand_at(int64_t row, int64_t column) {
+	if (row < 0 || row >= main_grid->height
+	    || column < 0 || column >= main_grid->width)
+		return NULL;
+	return grid_lookup(main_grid, row, column)->stand.stand_stand.s;
+}
+
+/* Appends the key Tile of a Stand applied to the Main Grid. */
+static void put_key(struct record *r, stand s) {
+	// the top row of the bounding box holds the key Tile
+	struct extent e = s->orients->extents[s->orients->index[s->orientation]];
+	grid src = s->source;
+	int64_t row = s->row + e.row;
+	int64_t column = s->column;
+	if (e.height > 0) {
+		const uint64_t *bits =
+			src->occupancy + (size_t) e.row * src->occ_stride;
+		uint32_t w = 0;
+		while (!bits[w])
+			w++;
+		column += w * OCC_WORD_BITS + __builtin_ctzll(bits[w]);
+	}
+	put_le(r, (uint64_t) row, 8);
+	put_le(r, (uint64_t) column, 8);
+}
+
+static void put_name(struct record *r, const char *name) {
+	size_t len = strlen(name);
+	if (len > MAX_PAYLOAD - r->len)
+		len = MAX_PAYLOAD - r->len;
+	memcpy(r->payload + r->len, name, len);
+	r->len += len;
+}
+
+static void put_le(struct record *r, uint64_t v, int bytes) {
+	for (int i = 0; i < bytes; i++)
+		r->payload[r->len++] = v >> (8 * i);
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes) {
+	uint64_t v = 0;
+	for (int i = 0; i < bytes; i++)
+		v |= (uint64_t) p[i] << (8 * i);
+	return v;
+}
+
+/* Creates (or truncates) a journal holding just a header, synced to disk.
+ * Returns its descriptor, or -1.
+ */
+static int create_journal(const char *path, uint32_t base, uint32_t prev) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+
+	uint8_t header[HEADER_BYTES] = {'M', 'M', 'G', 'J'};
+	uint32_t fields[3] = {JOURNAL_VERSION, base, prev};
+	for (int f = 0; f < 3; f++)
+		for (int i = 0; i < 4; i++)
+			header[4 + 4 * f + i] = fields[f] >> (8 * i);
+	if (!write_all(fd, header, HEADER_BYTES) || fsync(fd) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool parse_header(const uint8_t *data, size_t len,
+                         uint32_t *base, uint32_t *prev) {
+	if (len < HEADER_BYTES || memcmp(data, "MMGJ", 4) != 0
+	    || get_le(data + 4, 4) != JOURNAL_VERSION)
+		return false;
+	*base = get_le(data + 8, 4);
+	*prev = get_le(data + 12, 4);
+	return true;
+}
+
+/* Returns a new string of path followed by suffix, or NULL. */
+static char *path_with(const char *path, const char *suffix) {
+	char *p = malloc(strlen(path) + strlen(suffix) + 1);
+	if (p) {
+		strcpy(p, path);
+		strcat(p, suffix);
+	}
+	return p;
+}
+
+/* Reads a whole file into a new buffer. Returns false if it doesn't exist
+ * or can't be read.
+ */
+static bool read_file(const char *path, uint8_t **data, size_t *len) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return false;
+
+	size_t cap = 65536;
+	*len = 0;
+	*data = malloc(cap);
+	while (*data) {
+		size_t got = fread(*data + *len, 1, cap - *len, f);
+		*len += got;
+		if (got == 0 || *len < cap)
+			break;
+		cap *= 2;
+		uint8_t *nd = realloc(*data, cap);
+		if (!nd)
+			free(*data);
+		*data = nd;
+	}
+	bool ok = *data && !ferror(f);
+	fclose(f);
+	if (!ok) {
+		free(*data);
+		*data = NULL;
+	}
+	return ok;
+}
+
+static bool write_all(int fd, const void *buf, size_t len) {
+	const char *p = buf;
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+/* Replaces a file with new contents, so that it holds either the old or
+ * the new contents even if we crash part way.
+ */
+static bool write_file_atomic(const char *path, const void *data,
+                              size_t len) {
+	char *tmp = path_with(path, ".tmp");
+	if (!tmp)
+		return false;
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	bool ok = fd >= 0 && write_all(fd, data, len) && fsync(fd) == 0;
+	if (fd >= 0 && close(fd) != 0)
+		ok = false;
+	ok = ok && rename(tmp, path) == 0 && sync_dir(path);
+	if (!ok)
+		unlink(tmp);
+	free(tmp);
+	return ok;
+}
+
+/* Syncs the directory holding a file, so renames within it are durable. */
+static bool sync_dir(const char *path) {
+	char *dir = path_with(path, "");
+	if (!dir)
+		return false;
+	char *slash = strrchr(dir, '/');
+	if (slash == dir)
+		slash[1] = '\0';
+	else if (slash)
+		*slash = '\0';
+	int fd = open(slash ? dir : ".", O_RDONLY);
+	free(dir);
+	if (fd < 0)
+		return false;
+	bool ok = fsync(fd) == 0;
+	close(fd);
+	return ok;
+}
+
+static double seconds_since(const struct timespec *then) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - then->tv_sec) + (now.tv_nsec - then->tv_nsec) / 1e9;
+}
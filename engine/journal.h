@@ -0,0 +1,57 @@
+/* journal.h
+ *
+ * This file contains declarations for the edit journal, which records
+ * every change made to a map since it was last saved in full.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stand.h"
+
+// suffixes of the files kept next to a map
+#define JOURNAL_SUFFIX      ".journal"
+#define JOURNAL_NEXT_SUFFIX ".journal.next"
+
+// the journal is folded into a fresh snapshot once it grows past this
+#define JOURNAL_COMPACT_BYTES (256 * 1024)
+
+// records are forced to disk at least this often
+#define JOURNAL_SYNC_RECORDS 64
+#define JOURNAL_SYNC_SECONDS 1.0
+
+bool journal_open(const char *snapshot_path);
+bool journal_reset(const char *snapshot_path);
+void journal_close(void);
+
+void journal_apply_new(int32_t st_id, stand s);
+void journal_lift(stand s);
+void journal_apply_lifted(stand s);
+void journal_drop_lifted(void);
+void journal_remove(stand s);
+void journal_rotate(stand s, bool clockwise);
+void journal_mirror(stand s);
+void journal_rename_stand(stand s, const char *name);
+void journal_rename_template(int32_t st_id, const char *name);
+
+#endif
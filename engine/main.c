@@ -21,19 +21,118 @@
  * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "global.h"
 #include "grid.h"
 #include "stand.h"
 #include "capi.h"
+#include "save_n_load.h"
+#include "export.h"
+
+static int export_maps(int argc, char *argv[]);
 
 int main(int argc, char* argv[]) {
-	// initialize Mono runtime
-	const char *filename = "frontend.exe";
+	// exporting images needs neither the frontend nor a display
+	if (argc > 1 && strcmp(argv[1], "--export") == 0)
+		return export_maps(argc - 2, argv + 2);
 	
 	initialize_engine();
+
+	// a compiled template library replaces the default Stand Templates;
+	// the frontend never sees the option
+	if (argc > 2 && strcmp(argv[1], "--template-library") == 0) {
+		if (!use_template_library(argv[2])) {
+			fprintf(stderr, "could not open template library %s\n",
+			        argv[2]);
+			return 1;
+		}
+		argv[2] = argv[0];
+		argv += 2;
+		argc -= 2;
+	}
+
+	// initialize Mono runtime
+	const char *filename = "frontend.exe";
 	initialize_mono(filename);
 	return execute_frontend(argc, argv);
-}
\ No newline at end of file
+}
+
+/* Handles --export [--scale N] [--template-library PATH] map image
+ * [map image ...], loading each map in turn into main_grid and writing it
+ * out as an image; see export.c. A template library stays in use for every
+ * map that has no Stand Templates of its own.
+ *
+ * Returns the exit status: 0 if every image was written.
+ */
+static int export_maps(int argc, char *argv[]) {
+	unsigned long scale = 8;
+	for (;;) {
+		if (argc > 1 && strcmp(argv[0], "--scale") == 0) {
+			char *end;
+			scale = strtoul(argv[1], &end, 10);
+			if (*argv[1] == '\0' || *end != '\0' || scale == 0
+			    || scale > EXPORT_MAX_SCALE) {
+				fprintf(stderr, "scale must be from 1 to %d\n",
+				        EXPORT_MAX_SCALE);
+				return 2;
+			}
+		} else if (argc > 1
+		           && strcmp(argv[0], "--template-library") == 0) {
+			if (!use_template_library(argv[1])) {
+				fprintf(stderr,
+				        "could not open template library %s\n",
+				        argv[1]);
+				return 1;
+			}
+		} else {
+			break;
+		}
+		argv += 2;
+		argc -= 2;
+	}
+	if (argc == 0 || argc % 2 != 0) {
+		fprintf(stderr, "usage: --export [--scale N] "
+		        "[--template-library PATH] map image [map image ...]\n");
+		return 2;
+	}
+
+	int status = 0;
+	for (int i = 0; i < argc; i += 2) {
+		const char *map = argv[i], *image = argv[i + 1];
+		FILE *f = fopen(map, "rb");
+		if (!f) {
+			perror(map);
+			status = 1;
+			continue;
+		}
+		bool ok = load_file(f);
+		fclose(f);
+		if (!ok) {
+			size_t offset;
+			const char *why = get_load_error(&offset);
+			fprintf(stderr, "%s: %s at byte %zu\n", map, why, offset);
+			status = 1;
+			continue;
+		}
+
+		f = fopen(image, "wb");
+		if (!f) {
+			perror(image);
+			status = 1;
+			continue;
+		}
+		ok = export_grid(f, main_grid, scale, image_format_for(image));
+		if (fclose(f) != 0)
+			ok = false;
+		if (!ok) {
+			fprintf(stderr, "could not write %s\n", image);
+			remove(image);
+			status = 1;
+		}
+	}
+	return status;
+}
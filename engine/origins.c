@@ -0,0 +1,477 @@
+/* origins.c
+ *
+ * This file contains definitions for finding every place a shape can be
+ * applied to a Grid at once, so that the frontend can shade them all while
+ * a Stand is dragged, and each position the mouse passes over costs a
+ * single bit lookup instead of a can_apply.
+ *
+ * The valid origins of a shape are the erosion of the empty Tiles of the
+ * Grid by the shape. The shape is split into bands, rectangles of rows
+ * that share the same run of occupied Tiles, and each band is handled
+ * separably: every row of the Grid is smeared across by the length of the
+ * run, 64 origins a word, then the smeared rows are ORed down by the
+ * height of the band, with the distance doubling each pass. An origin at
+ * which no band meets an occupied Tile is valid.
+ *
+ * Each Grid caches the maps of the last few shapes asked about. A map
+ * remembers the generation of the Grid it was made from, and is made
+ * again the first time it is asked for after the Grid changes.
+ *
+ * The maps also answer where the nearest place a Stand fits is, so that a
+ * drop that collides can snap to it. Rows of the map are visited outward
+ * from the target, each searched a word at a time for the nearest valid
+ * origin on either side, and the search stops once the rows alone are
+ * further away than the best origin found so far.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <math.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "origins.h"
+
+struct origin_cache {
+	struct origin_map maps[ORIGIN_CACHE_ENTRIES];
+	// the entry to be replaced next
+	uint32_t next;
+};
+
+/* Rows row to (row + height - 1) of a shape, relative to its origin, all
+ * occupied from column for length Tiles. length is at most a word.
+ */
+struct band {
+	uint32_t row;
+	uint32_t height;
+	uint32_t column;
+	uint32_t length;
+};
+
+static bool build_map(grid g, origin_map m);
+static struct band *shape_bands(grid shape, uint32_t *num);
+static int compare_bands(const void *a, const void *b);
+static void clear_map(origin_map m);
+static int64_t nearest_in_row(const uint64_t *bits, uint32_t width,
+                              int64_t column, uint64_t reach);
+static uint64_t distance(enum snap_metric metric, uint64_t rows,
+                         uint64_t columns);
+static uint64_t reach(enum snap_metric metric, uint64_t rows,
+                      uint64_t within);
+
+/* Finds every origin at which symmetry sym of a shape fits onto Grid g,
+ * as can_apply would decide it.
+ *
+ * The map is cached with g, and made again only once g has changed, so
+ * calling this for every mouse motion is cheap. It stays valid until g
+ * next changes or another shape is asked about.
+ *
+ * Returns NULL if space could not be allocated.
+ */
+origin_map valid_origins(grid g, orientation_set os, uint8_t sym) {
+	assert(g);
+	assert(os);
+	assert(sym < NUM_SYMMETRIES);
+
+	if (!g->origins) {
+		g->origins = calloc(1, sizeof(struct origin_cache));
+		if (!g->origins)
+			return NULL;
+	}
+	origin_cache oc = g->origins;
+	uint8_t index = os->index[sym];
+
+	origin_map m = NULL;
+	for (uint32_t i = 0; i < ORIGIN_CACHE_ENTRIES; i++) {
+		if (oc->maps[i].os == os && oc->maps[i].index == index) {
+			m = &oc->maps[i];
+			if (m->generation == g->generation)
+				return m;
+			break;
+		}
+	}
+	if (!m) {
+		m = &oc->maps[oc->next];
+		oc->next = (oc->next + 1) % ORIGIN_CACHE_ENTRIES;
+		clear_map(m);
+		// held so that no other set can turn up at the same address
+		m->os = share_orientation_set(os);
+		m->index = index;
+	}
+
+	if (!build_map(g, m)) {
+		clear_map(m);
+		return NULL;
+	}
+	return m;
+}
+
+/* Deallocates the cache of a Grid. */
+void del_origin_cache(origin_cache oc) {
+	assert(oc);
+
+	for (uint32_t i = 0; i < ORIGIN_CACHE_ENTRIES; i++)
+		clear_map(&oc->maps[i]);
+	free(oc);
+}
+
+/* Finds the valid origin in a map nearest to the given coordinates, if it
+ * is closer than best->distance, and puts its coordinates and distance in
+ * best. best->sym is left for the caller. Between origins equally far
+ * away, the one in the nearest row wins, then the one further left.
+ *
+ * Returns true if best was changed.
+ */
+bool nearest_origin(origin_map m, int64_t row, int64_t column,
+                    enum snap_metric metric, struct snap *best) {
+	assert(m);
+	assert(best);
+
+	int64_t target = row - m->row0;
+	int64_t c = column - m->column0;
+	bool found = false;
+	if (m->height == 0)
+		return false;
+
+	// start from the nearest row of the map, even if the target is off it
+	uint64_t first = target < 0 ? (uint64_t) -target
+		: target >= m->height ? (uint64_t) (target - m->height + 1) : 0;
+	for (uint64_t dr = first; ; dr++) {
+		if (distance(metric, dr, 0) >= best->distance)
+			break;
+		int64_t above = target - (int64_t) dr;
+		int64_t below = target + (int64_t) dr;
+		if (above < 0 && below >= m->height)
+			break;
+
+		for (int side = 0; side < 2; side++) {
+			int64_t r = side ? below : above;
+			if ((side && dr == 0) || r < 0 || r >= m->height)
+				continue;
+			uint64_t within = reach(metric, dr, best->distance);
+			int64_t hit = nearest_in_row(m->bits + (size_t) r * m->stride,
+			                             m->width, c, within);
+			if (hit < 0)
+				continue;
+			uint64_t dc = hit > c ? hit - c : c - hit;
+			uint64_t d = distance(metric, dr, dc);
+			if (d < best->distance) {
+				best->row = m->row0 + r;
+				best->column = m->column0 + hit;
+				best->distance = d;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+/* Finds the nearest place Stand s fits onto Grid g to the given origin,
+ * in its current orientation or, if any_orientation is set, in whichever
+ * of its orientations has the nearest. The current orientation wins ties.
+ *
+ * Returns false if it fits nowhere, or space could not be allocated.
+ */
+bool snap_stand(grid g, stand s, int64_t row, int64_t column,
+                enum snap_metric metric, bool any_orientation,
+                struct snap *out) {
+	assert(g);
+	assert(s);
+	assert(out);
+
+	out->distance = UINT64_MAX;
+	bool found = false;
+	uint8_t seen = 0;
+	for (uint8_t i = 0; i < NUM_SYMMETRIES; i++) {
+		// the current orientation goes first
+		uint8_t sym = i == 0 ? s->orientation
+			: i <= s->orientation ? i - 1 : i;
+		uint8_t index = s->orients->index[sym];
+		if (seen & (1 << index))
+			continue;
+		seen |= 1 << index;
+
+		origin_map m = valid_origins(g, s->orients, sym);
+		if (!m)
+			return false;
+		if (nearest_origin(m, row, column, metric, out)) {
+			out->sym = sym;
+			found = true;
+		}
+		if (!any_orientation)
+			break;
+	}
+	return found;
+}
+
+/* Works out the valid origins of a map's shape on Grid g. */
+static bool build_map(grid g, origin_map m) {
+	grid shape = m->os->grids[m->index];
+	struct extent e = m->os->extents[m->index];
+
+	// origins keeping the bounding box of the shape on the Grid
+	m->row0 = -e.row;
+	m->column0 = -e.column;
+	m->height = 0;
+	m->width = 0;
+	m->stride = 0;
+	m->generation = g->generation;
+	if (e.height == 0 || e.height > g->height || e.width > g->width)
+		return true;
+	uint32_t height = g->height - e.height + 1;
+	uint32_t width = g->width - e.width + 1;
+	uint32_t stride = (width + OCC_WORD_BITS - 1) / OCC_WORD_BITS;
+
+	bool ok = false;
+	uint32_t num_bands;
+	struct band *bands = shape_bands(shape, &num_bands);
+	if (!bands)
+		goto out_bands;
+	uint64_t *bits = realloc(m->bits,
+	                         sizeof(uint64_t) * height * stride);
+	if (!bits)
+		goto out_bits;
+	m->bits = bits;
+	// the smeared rows of one band; no band is taller than the shape
+	size_t tmp_rows = (size_t) height + e.height - 1;
+	uint64_t *tmp = malloc(sizeof(uint64_t) * tmp_rows * stride);
+	if (!tmp)
+		goto out_bits;
+
+	// collect the blocked origins first, then flip them
+	memset(bits, 0, sizeof(uint64_t) * height * stride);
+	for (uint32_t i = 0; i < num_bands; i++) {
+		struct band *b = &bands[i];
+		size_t rows = (size_t) height + b->height - 1;
+		const uint64_t *grid_row = g->occupancy
+			+ (size_t) (m->row0 + b->row) * g->occ_stride;
+		int64_t column = m->column0 + b->column;
+		for (size_t r = 0; r < rows; r++, grid_row += g->occ_stride)
+			for (uint32_t w = 0; w < stride; w++)
+				tmp[r * stride + w] = occupancy_run_window(
+					grid_row, g->occ_stride,
+					column + (int64_t) w * OCC_WORD_BITS,
+					b->length);
+
+		// row r ends up covering rows r to (r + height - 1)
+		for (uint32_t span = 1; span < b->height; ) {
+			uint32_t step = span < b->height - span
+				? span : b->height - span;
+			size_t words = (rows - step) * stride;
+			for (size_t k = 0; k < words; k++)
+				tmp[k] |= tmp[k + (size_t) step * stride];
+			span += step;
+		}
+
+		for (size_t k = 0; k < (size_t) height * stride; k++)
+			bits[k] |= tmp[k];
+	}
+
+	uint64_t tail = width % OCC_WORD_BITS
+		? ((uint64_t) 1 << (width % OCC_WORD_BITS)) - 1 : ~(uint64_t) 0;
+	for (uint32_t r = 0; r < height; r++) {
+		uint64_t *row = bits + (size_t) r * stride;
+		for (uint32_t w = 0; w < stride; w++)
+			row[w] = ~row[w];
+		row[stride - 1] &= tail;
+	}
+	m->height = height;
+	m->width = width;
+	m->stride = stride;
+	ok = true;
+
+	free(tmp);
+out_bits:;
+	free(bands);
+out_bands:;
+	return ok;
+}
+
+/* Splits the occupied Tiles of a shape into bands, merging runs which
+ * repeat from one row to the next.
+ *
+ * Returns an array of num bands, to be freed by the caller, or NULL if
+ * space could not be allocated.
+ */
+static struct band *shape_bands(grid shape, uint32_t *num) {
+	uint32_t cap = 16;
+	uint32_t n = 0;
+	struct band *bands = malloc(sizeof(struct band) * cap);
+	if (!bands)
+		return NULL;
+
+	for (uint32_t row = 0; row < shape->height; row++) {
+		const uint64_t *bits =
+			shape->occupancy + (size_t) row * shape->occ_stride;
+		for (uint32_t w = 0; w < shape->occ_stride; w++) {
+			uint64_t word = bits[w];
+			while (word) {
+				uint32_t start = __builtin_ctzll(word);
+				uint64_t rest = ~(word >> start);
+				uint32_t length = rest
+					? (uint32_t) __builtin_ctzll(rest)
+					: OCC_WORD_BITS - start;
+				if (n == cap) {
+					cap *= 2;
+					struct band *more = realloc(bands,
+						sizeof(struct band) * cap);
+					if (!more) {
+						free(bands);
+						return NULL;
+					}
+					bands = more;
+				}
+				bands[n++] = (struct band) {
+					row, 1, w * OCC_WORD_BITS + start, length
+				};
+				word &= start + length == OCC_WORD_BITS
+					? ((uint64_t) 1 << start) - 1
+					: ~((((uint64_t) 1 << length) - 1) << start);
+			}
+		}
+	}
+
+	// runs at the same columns end up next to each other, in row order
+	qsort(bands, n, sizeof(struct band), compare_bands);
+	uint32_t merged = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		struct band *last = merged ? &bands[merged - 1] : NULL;
+		if (last && last->column == bands[i].column
+		    && last->length == bands[i].length
+		    && last->row + last->height == bands[i].row)
+			last->height++;
+		else
+			bands[merged++] = bands[i];
+	}
+	*num = merged;
+	return bands;
+}
+
+static int compare_bands(const void *a, const void *b) {
+	const struct band *ba = a, *bb = b;
+	if (ba->column != bb->column)
+		return ba->column < bb->column ? -1 : 1;
+	if (ba->length != bb->length)
+		return ba->length < bb->length ? -1 : 1;
+	return (ba->row > bb->row) - (ba->row < bb->row);
+}
+
+/* Finds the set bit of a row of width bits nearest to the given column,
+ * no more than reach columns away, preferring the left one of a tie.
+ *
+ * Returns its column, or -1 if there is none.
+ */
+static int64_t nearest_in_row(const uint64_t *bits, uint32_t width,
+                              int64_t column, uint64_t reach) {
+	// columns worth looking at, clipped to the row
+	int64_t lo = column - (int64_t) (reach < (uint64_t) INT32_MAX * 4
+	                                 ? reach : (uint64_t) INT32_MAX * 4);
+	int64_t hi = column + (int64_t) (reach < (uint64_t) INT32_MAX * 4
+	                                 ? reach : (uint64_t) INT32_MAX * 4);
+	if (lo < 0)
+		lo = 0;
+	if (hi >= width)
+		hi = (int64_t) width - 1;
+	if (lo > hi)
+		return -1;
+
+	// the nearest at or right of the column
+	int64_t right = -1;
+	int64_t from = column > lo ? column : lo;
+	for (int64_t w = from / OCC_WORD_BITS;
+	     from <= hi && w <= hi / OCC_WORD_BITS; w++) {
+		uint64_t word = bits[w];
+		if (w == from / OCC_WORD_BITS)
+			word &= ~(uint64_t) 0 << (from % OCC_WORD_BITS);
+		if (word) {
+			right = w * OCC_WORD_BITS + __builtin_ctzll(word);
+			break;
+		}
+	}
+	if (right > hi)
+		right = -1;
+
+	// the nearest left of it, no further away than the right one
+	int64_t left = -1;
+	int64_t to = column - 1 < hi ? column - 1 : hi;
+	if (right >= 0 && column - (right - column) > lo)
+		lo = column - (right - column);
+	for (int64_t w = to / OCC_WORD_BITS;
+	     to >= lo && w >= lo / OCC_WORD_BITS; w--) {
+		uint64_t word = bits[w];
+		if (w == to / OCC_WORD_BITS && to % OCC_WORD_BITS != 63)
+			word &= ((uint64_t) 2 << (to % OCC_WORD_BITS)) - 1;
+		if (word) {
+			left = w * OCC_WORD_BITS + 63 - __builtin_clzll(word);
+			break;
+		}
+	}
+	if (left < lo)
+		left = -1;
+
+	return left >= 0 ? left : right;
+}
+
+/* Returns the distance covered by moving the given number of rows and
+ * columns, saturating rather than overflowing.
+ */
+static uint64_t distance(enum snap_metric metric, uint64_t rows,
+                         uint64_t columns) {
+	if (metric == SNAP_MANHATTAN)
+		return rows + columns < rows ? UINT64_MAX : rows + columns;
+	const uint64_t limit = (uint64_t) 1 << 31;
+	if (rows >= limit || columns >= limit)
+		return UINT64_MAX;
+	return rows * rows + columns * columns;
+}
+
+/* Returns how many columns away an origin in a row that many rows away
+ * can be, and still be nearer than within.
+ */
+static uint64_t reach(enum snap_metric metric, uint64_t rows,
+                      uint64_t within) {
+	uint64_t d = distance(metric, rows, 0);
+	if (d >= within)
+		return 0;
+	uint64_t left = within - d - 1;
+	if (metric == SNAP_MANHATTAN)
+		return left;
+	// distance saturates this far out anyway
+	const uint64_t limit = (uint64_t) 1 << 31;
+	uint64_t r = (uint64_t) sqrt((double) left);
+	if (r >= limit)
+		return limit;
+	while (r * r > left)
+		r--;
+	while ((r + 1) * (r + 1) <= left)
+		r++;
+	return r;
+}
+
+/* Empties a cache entry. */
+static void clear_map(origin_map m) {
+	free(m->bits);
+	if (m->os)
+		del_orientation_set(m->os);
+	memset(m, 0, sizeof(struct origin_map));
+}
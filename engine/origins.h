@@ -0,0 +1,92 @@
+/* origins.h
+ *
+ * This file contains declarations for finding every place a shape can be
+ * applied to a Grid at once.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ORIGINS_H
+#define ORIGINS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "grid.h"
+#include "stand.h"
+
+// most valid-origin maps a Grid keeps at once: enough for every
+// orientation of one shape
+#define ORIGIN_CACHE_ENTRIES NUM_SYMMETRIES
+
+typedef struct origin_map *origin_map;
+
+/* The valid origins of one orientation of a shape on a Grid: the
+ * coordinates at which can_apply would find it fits.
+ *
+ * Bit c of word row of bits is the origin (row0 + row, column0 + c), with
+ * stride words per row; every origin outside the map is invalid. A map
+ * belongs to the cache of its Grid, and is only good until the Grid next
+ * changes.
+ */
+struct origin_map {
+	int64_t row0;
+	int64_t column0;
+	uint32_t height;
+	uint32_t width;
+	uint32_t stride;
+	uint64_t *bits;
+
+	// what the map was made from
+	orientation_set os;
+	uint8_t index;
+	uint64_t generation;
+};
+
+// how the distance to an origin is measured when snapping
+enum snap_metric {SNAP_MANHATTAN, SNAP_EUCLIDEAN};
+
+/* The nearest valid origin found by a snap. distance is in Tiles for
+ * SNAP_MANHATTAN, and squared for SNAP_EUCLIDEAN.
+ */
+struct snap {
+	int64_t row;
+	int64_t column;
+	uint8_t sym;
+	uint64_t distance;
+};
+
+origin_map valid_origins(grid g, orientation_set os, uint8_t sym);
+void del_origin_cache(origin_cache oc);
+bool nearest_origin(origin_map m, int64_t row, int64_t column,
+                    enum snap_metric metric, struct snap *best);
+bool snap_stand(grid g, stand s, int64_t row, int64_t column,
+                enum snap_metric metric, bool any_orientation,
+                struct snap *out);
+
+/* Returns true if the shape of a map fits at the given origin. */
+static inline bool origin_valid(origin_map m, int64_t row, int64_t column) {
+	int64_t r = row - m->row0;
+	int64_t c = column - m->column0;
+	if (r < 0 || r >= m->height || c < 0 || c >= m->width)
+		return false;
+	return (m->bits[(size_t) r * m->stride + c / OCC_WORD_BITS]
+	        >> (c % OCC_WORD_BITS)) & 1;
+}
+
+#endif
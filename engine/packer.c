@@ -0,0 +1,592 @@
+/* packer.c
+ *
+ * This file contains definitions for laying out Stands automatically:
+ * given a bill of materials of Stand Templates and how many Stands of each
+ * are wanted, the packer fits as many of them onto a Grid as it can,
+ * around whatever Stands are already there.
+ *
+ * Each layout is built greedily. Stands are taken largest first, and each
+ * orientation of a Stand is tried at the first place, in reading order,
+ * where it fits. The Stand goes to the earliest of those places, or for
+ * PACK_MIN_AREA to the one that grows the layout the least; places further
+ * on are never compared.
+ * Apart from the first, every layout shuffles the order a little and
+ * prefers orientations in a different order, and many layouts are tried
+ * on worker threads, each with its own copy of the occupancy plane. The
+ * best one is then applied with can_apply and do_apply like any other
+ * Stand, so the result always obeys the same rules as dragging by hand.
+ *
+ * The search only ever looks at occupancy. A shape is kept as runs of
+ * occupied Tiles, and whether it fits at 64 neighbouring origins is worked
+ * out at once, by spreading each run over the window of the plane below
+ * it and ORing the results together. Within a layout the plane only fills
+ * up, so a shape that didn't fit somewhere never will; each shape carries
+ * on searching from where it last fitted rather than from the top.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "templib.h"
+#include "workers.h"
+#include "packer.h"
+
+/* A run of occupied Tiles in one row of a shape, relative to its origin.
+ * Runs are never longer than a word.
+ */
+struct run {
+	uint32_t row;
+	uint32_t column;
+	uint32_t length;
+};
+
+/* One distinct orientation of a Stand Template. */
+struct shape {
+	// bounding box of the occupied Tiles, relative to the origin
+	struct extent e;
+	// a symmetry that gives this orientation
+	uint8_t sym;
+	uint32_t first_run;
+	uint32_t num_runs;
+	// the origins that keep the shape on the Grid
+	int64_t row_lo, row_hi;
+	int64_t column_lo, column_hi;
+};
+
+/* The shapes of one item of the bill of materials. */
+struct kind {
+	uint32_t first_shape;
+	uint32_t num_shapes;
+	uint32_t area;
+};
+
+/* Where a shape search has got to in the current layout. */
+struct cursor {
+	int64_t row;
+	int64_t column;
+	bool done;
+};
+
+struct placement {
+	uint32_t item;
+	uint32_t shape;
+	int64_t row;
+	int64_t column;
+};
+
+struct score {
+	uint64_t fill;
+	uint32_t count;
+	uint64_t bounds_area;
+};
+
+struct order_key {
+	double key;
+	uint32_t unit;
+	uint32_t item;
+};
+
+/* What a worker found: the best of the layouts it tried. */
+struct worker_result {
+	bool ok;
+	uint32_t attempt;
+	struct score score;
+	struct placement *best;
+	uint32_t num_best;
+	// scratch for the layout being built
+	struct placement *current;
+};
+
+struct pack_job {
+	grid g;
+	enum pack_objective objective;
+	uint32_t attempts;
+	uint64_t seed;
+
+	struct kind *kinds;
+	struct shape *shapes;
+	struct run *runs;
+	uint32_t num_shapes;
+	uint32_t num_runs;
+	uint32_t runs_cap;
+
+	// the item of every Stand wanted, one entry per Stand
+	uint32_t *units;
+	uint32_t num_units;
+
+	struct worker_result results[MAX_WORKERS];
+};
+
+static bool add_shapes(struct pack_job *job, struct kind *k,
+                       orientation_set os, bool keep_orientation);
+static bool add_run(struct pack_job *job, uint32_t row, uint32_t column,
+                    uint32_t length);
+static void pack_worker(void *data, unsigned worker, unsigned num_workers);
+static void build_layout(struct pack_job *job, uint64_t *plane,
+                         struct order_key *order, struct cursor *cursors,
+                         uint32_t attempt, struct placement *out,
+                         uint32_t *num_out, struct score *score);
+static bool first_fit(struct pack_job *job, const uint64_t *plane,
+                      const struct shape *s, struct cursor *c);
+static void mark_shape(struct pack_job *job, uint64_t *plane,
+                       const struct shape *s, int64_t row, int64_t column);
+static bool better_candidate(enum pack_objective objective,
+                             const struct extent *bounds, bool have_bounds,
+                             const struct extent *a, const struct extent *b);
+static bool better_score(enum pack_objective objective,
+                         const struct score *a, const struct score *b);
+static void grow_extent(struct extent *bounds, const struct extent *e);
+static int compare_order(const void *a, const void *b);
+static uint64_t next_random(uint64_t *state);
+
+/* Fits as many Stands from a bill of materials onto Grid g as it can,
+ * leaving the Stands already on g where they are, and applies them.
+ *
+ * placed must have room for as many placements as the items ask for in
+ * all; it receives each new Stand and the index of its item, and
+ * num_placed the number of them. opts may be NULL for the defaults.
+ *
+ * Returns false, with g as it was, if memory runs out.
+ */
+bool pack_stands(grid g, const struct pack_item *items, uint32_t num_items,
+                 const struct pack_options *opts,
+                 struct pack_placement *placed, uint32_t *num_placed) {
+	assert(g);
+	assert(items || num_items == 0);
+	assert(num_placed);
+
+	struct pack_options defaults = {PACK_MAX_FILL, 0, 0, false};
+	if (!opts)
+		opts = &defaults;
+	*num_placed = 0;
+
+	bool ok = false;
+	struct pack_job *job = calloc(1, sizeof(struct pack_job));
+	if (!job)
+		goto out_job;
+	job->g = g;
+	job->objective = opts->objective;
+	job->attempts = opts->attempts ? opts->attempts : PACK_DEFAULT_ATTEMPTS;
+	job->seed = opts->seed;
+
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < num_items; i++)
+		total += items[i].count;
+	if (total > UINT32_MAX)
+		goto out_shapes;
+	job->num_units = total;
+	job->kinds = malloc(sizeof(struct kind) * (num_items ? num_items : 1));
+	job->shapes = malloc(sizeof(struct shape) * NUM_SYMMETRIES
+	                     * (num_items ? num_items : 1));
+	job->units = malloc(sizeof(uint32_t) * (total ? total : 1));
+	if (!job->kinds || !job->shapes || !job->units)
+		goto out_shapes;
+
+	for (uint32_t i = 0, u = 0; i < num_items; i++) {
+		orientation_set os = template_orients(items[i].t);
+		if (!os || !add_shapes(job, &job->kinds[i], os,
+		                       opts->keep_orientation))
+			goto out_shapes;
+		for (uint32_t n = 0; n < items[i].count; n++)
+			job->units[u++] = i;
+	}
+	if (total == 0) {
+		ok = true;
+		goto out_shapes;
+	}
+
+	unsigned workers = num_workers_for(job->attempts, 1);
+	run_workers(pack_worker, job, workers);
+
+	struct worker_result *best = NULL;
+	for (unsigned w = 0; w < workers; w++) {
+		struct worker_result *r = &job->results[w];
+		if (!r->ok)
+			continue;
+		// ties go to the earliest attempt, so the result doesn't
+		// depend on how many workers there were
+		if (!best || better_score(job->objective, &r->score, &best->score)
+		    || (!better_score(job->objective, &best->score, &r->score)
+		        && r->attempt < best->attempt))
+			best = r;
+	}
+	if (!best)
+		goto out_workers;
+
+	// apply the winning layout for real
+	for (uint32_t i = 0; i < best->num_best; i++) {
+		struct placement *p = &best->best[i];
+		struct shape *sh = &job->shapes[p->shape];
+		stand s = new_stand(items[p->item].t);
+		if (!s)
+			goto out_apply;
+		set_stand_orientation(s, sh->sym);
+		if (!can_apply(s, g, p->row, p->column)) {
+			del_stand(s);
+			goto out_apply;
+		}
+		do_apply(s);
+		placed[i].item = p->item;
+		placed[i].s = s;
+		*num_placed = i + 1;
+	}
+	ok = true;
+	goto out_workers;
+
+out_apply:;
+	for (uint32_t i = *num_placed; i > 0; i--)
+		del_stand(placed[i - 1].s);
+	*num_placed = 0;
+out_workers:;
+	for (unsigned w = 0; w < MAX_WORKERS; w++) {
+		free(job->results[w].best);
+		free(job->results[w].current);
+	}
+out_shapes:;
+	free(job->units);
+	free(job->runs);
+	free(job->shapes);
+	free(job->kinds);
+	free(job);
+out_job:;
+	return ok;
+}
+
+/* Adds the distinct orientations of an item to the job, as runs. */
+static bool add_shapes(struct pack_job *job, struct kind *k,
+                       orientation_set os, bool keep_orientation) {
+	k->first_shape = job->num_shapes;
+	k->num_shapes = 0;
+	k->area = 0;
+
+	uint8_t num = keep_orientation ? 1 : os->num_grids;
+	for (uint8_t i = 0; i < num; i++) {
+		uint8_t index = keep_orientation ? os->index[0] : i;
+		grid src = os->grids[index];
+		struct shape *s = &job->shapes[job->num_shapes];
+		s->e = os->extents[index];
+		for (s->sym = 0; os->index[s->sym] != index; s->sym++)
+			;
+		s->first_run = job->num_runs;
+
+		uint32_t area = 0;
+		for (uint32_t row = 0; row < src->height; row++) {
+			const uint64_t *bits =
+				src->occupancy + (size_t) row * src->occ_stride;
+			for (uint32_t w = 0; w < src->occ_stride; w++) {
+				uint64_t word = bits[w];
+				while (word) {
+					uint32_t start = __builtin_ctzll(word);
+					uint64_t rest = ~(word >> start);
+					uint32_t length = rest
+						? (uint32_t) __builtin_ctzll(rest)
+						: OCC_WORD_BITS - start;
+					if (!add_run(job, row,
+					             w * OCC_WORD_BITS + start, length))
+						return false;
+					area += length;
+					word &= length + start == OCC_WORD_BITS
+						? ((uint64_t) 1 << start) - 1
+						: ~((((uint64_t) 1 << length) - 1) << start);
+				}
+			}
+		}
+		s->num_runs = job->num_runs - s->first_run;
+		// an empty shape has nowhere to go
+		if (area == 0)
+			continue;
+		k->area = area;
+
+		grid g = job->g;
+		s->row_lo = -s->e.row;
+		s->row_hi = (int64_t) g->height - s->e.row - s->e.height;
+		s->column_lo = -s->e.column;
+		s->column_hi = (int64_t) g->width - s->e.column - s->e.width;
+		k->num_shapes++;
+		job->num_shapes++;
+	}
+	return true;
+}
+
+static bool add_run(struct pack_job *job, uint32_t row, uint32_t column,
+                    uint32_t length) {
+	if (job->num_runs == job->runs_cap) {
+		uint32_t cap = job->runs_cap ? job->runs_cap * 2 : 64;
+		struct run *runs = realloc(job->runs, sizeof(struct run) * cap);
+		if (!runs)
+			return false;
+		job->runs = runs;
+		job->runs_cap = cap;
+	}
+	job->runs[job->num_runs++] = (struct run) {row, column, length};
+	return true;
+}
+
+/* Tries every num_workers'th layout, starting with layout worker, and
+ * keeps the best.
+ */
+static void pack_worker(void *data, unsigned worker, unsigned num_workers) {
+	struct pack_job *job = data;
+	struct worker_result *r = &job->results[worker];
+	grid g = job->g;
+	size_t plane_words = (size_t) g->occ_stride * g->height;
+
+	uint64_t *plane = malloc(sizeof(uint64_t) * (plane_words ? plane_words
+	                                                        : 1));
+	struct order_key *order =
+		malloc(sizeof(struct order_key) * job->num_units);
+	struct cursor *cursors =
+		malloc(sizeof(struct cursor) * (job->num_shapes ? job->num_shapes
+		                                                : 1));
+	r->best = malloc(sizeof(struct placement) * job->num_units);
+	r->current = malloc(sizeof(struct placement) * job->num_units);
+	if (!plane || !order || !cursors || !r->best || !r->current)
+		goto out;
+
+	for (uint32_t a = worker; a < job->attempts; a += num_workers) {
+		struct score score;
+		uint32_t num;
+		build_layout(job, plane, order, cursors, a, r->current, &num,
+		             &score);
+		if (!r->ok || better_score(job->objective, &score, &r->score)) {
+			struct placement *swap = r->best;
+			r->best = r->current;
+			r->current = swap;
+			r->num_best = num;
+			r->score = score;
+			r->attempt = a;
+			r->ok = true;
+		}
+	}
+
+out:;
+	free(cursors);
+	free(order);
+	free(plane);
+}
+
+/* Builds one layout on a copy of the occupancy plane of the job's Grid,
+ * writing where each Stand went to out.
+ */
+static void build_layout(struct pack_job *job, uint64_t *plane,
+                         struct order_key *order, struct cursor *cursors,
+                         uint32_t attempt, struct placement *out,
+                         uint32_t *num_out, struct score *score) {
+	grid g = job->g;
+	memcpy(plane, g->occupancy,
+	       sizeof(uint64_t) * g->occ_stride * g->height);
+
+	uint64_t rng = job->seed ^ ((uint64_t) attempt * 0x9e3779b97f4a7c15ull);
+	for (uint32_t i = 0; i < job->num_units; i++) {
+		uint32_t item = job->units[i];
+		double key = job->kinds[item].area;
+		// largest first, then the same with a little noise
+		if (attempt)
+			key *= 0.5 + (next_random(&rng) >> 11) * 0x1.0p-53;
+		order[i] = (struct order_key) {key, i, item};
+	}
+	qsort(order, job->num_units, sizeof(struct order_key), compare_order);
+
+	for (uint32_t i = 0; i < job->num_shapes; i++) {
+		struct shape *s = &job->shapes[i];
+		cursors[i].row = s->row_lo;
+		cursors[i].column = s->column_lo;
+		cursors[i].done = s->row_lo > s->row_hi
+		                  || s->column_lo > s->column_hi;
+	}
+
+	struct extent bounds = {0, 0, 0, 0};
+	bool have_bounds = false;
+	*score = (struct score) {0, 0, 0};
+	*num_out = 0;
+	for (uint32_t i = 0; i < job->num_units; i++) {
+		struct kind *k = &job->kinds[order[i].item];
+		if (k->num_shapes == 0)
+			continue;
+		uint32_t start = attempt ? next_random(&rng) % k->num_shapes : 0;
+
+		int64_t chosen = -1;
+		struct extent chosen_e;
+		for (uint32_t n = 0; n < k->num_shapes; n++) {
+			uint32_t j = k->first_shape + (start + n) % k->num_shapes;
+			struct cursor *c = &cursors[j];
+			if (c->done || !first_fit(job, plane, &job->shapes[j], c))
+				continue;
+			struct extent e = job->shapes[j].e;
+			e.row += c->row;
+			e.column += c->column;
+			if (chosen < 0 || better_candidate(job->objective, &bounds,
+			                                   have_bounds, &e,
+			                                   &chosen_e)) {
+				chosen = j;
+				chosen_e = e;
+			}
+		}
+		if (chosen < 0)
+			continue;
+
+		struct cursor *c = &cursors[chosen];
+		mark_shape(job, plane, &job->shapes[chosen], c->row, c->column);
+		out[(*num_out)++] = (struct placement) {
+			order[i].item, chosen, c->row, c->column
+		};
+		if (have_bounds)
+			grow_extent(&bounds, &chosen_e);
+		else
+			bounds = chosen_e;
+		have_bounds = true;
+		score->fill += k->area;
+		score->count++;
+	}
+	score->bounds_area = (uint64_t) bounds.height * bounds.width;
+}
+
+/* Finds the first origin, in reading order from the cursor on, at which
+ * a shape fits the plane, and moves the cursor there.
+ *
+ * Returns false, and marks the cursor done, if there is none.
+ */
+static bool first_fit(struct pack_job *job, const uint64_t *plane,
+                      const struct shape *s, struct cursor *c) {
+	uint32_t stride = job->g->occ_stride;
+	const struct run *runs = job->runs + s->first_run;
+
+	for (int64_t row = c->row; row <= s->row_hi; row++) {
+		int64_t from = row == c->row ? c->column : s->column_lo;
+		for (int64_t column = from; column <= s->column_hi;
+		     column += OCC_WORD_BITS) {
+			// origins from here to the end of the range
+			int64_t left = s->column_hi - column + 1;
+			uint64_t want = left >= OCC_WORD_BITS ? ~(uint64_t) 0
+				: ((uint64_t) 1 << left) - 1;
+			uint64_t blocked = 0;
+			for (uint32_t i = 0; i < s->num_runs
+			                     && (blocked & want) != want; i++) {
+				const uint64_t *bits = plane
+					+ (size_t) (row + runs[i].row) * stride;
+				blocked |= occupancy_run_window(
+					bits, stride, column + runs[i].column,
+					runs[i].length);
+			}
+			uint64_t fits = want & ~blocked;
+			if (fits) {
+				c->row = row;
+				c->column = column + __builtin_ctzll(fits);
+				return true;
+			}
+		}
+	}
+	c->done = true;
+	return false;
+}
+
+/* Marks the Tiles of a shape at the given origin as occupied. */
+static void mark_shape(struct pack_job *job, uint64_t *plane,
+                       const struct shape *s, int64_t row, int64_t column) {
+	uint32_t stride = job->g->occ_stride;
+	const struct run *runs = job->runs + s->first_run;
+	for (uint32_t i = 0; i < s->num_runs; i++) {
+		uint64_t *bits = plane + (size_t) (row + runs[i].row) * stride;
+		uint64_t at = column + runs[i].column;
+		uint32_t word = at / OCC_WORD_BITS;
+		uint32_t shift = at % OCC_WORD_BITS;
+		uint64_t mask = runs[i].length == OCC_WORD_BITS ? ~(uint64_t) 0
+			: ((uint64_t) 1 << runs[i].length) - 1;
+		bits[word] |= mask << shift;
+		if (shift && shift + runs[i].length > OCC_WORD_BITS)
+			bits[word + 1] |= mask >> (OCC_WORD_BITS - shift);
+	}
+}
+
+/* Decides whether placing a Stand so it covers extent a makes a better
+ * layout than covering extent b.
+ */
+static bool better_candidate(enum pack_objective objective,
+                             const struct extent *bounds, bool have_bounds,
+                             const struct extent *a, const struct extent *b) {
+	if (objective == PACK_MIN_AREA && have_bounds) {
+		struct extent ga = *bounds, gb = *bounds;
+		grow_extent(&ga, a);
+		grow_extent(&gb, b);
+		uint64_t area_a = (uint64_t) ga.height * ga.width;
+		uint64_t area_b = (uint64_t) gb.height * gb.width;
+		if (area_a != area_b)
+			return area_a < area_b;
+	}
+	// otherwise whichever comes first in reading order
+	if (a->row != b->row)
+		return a->row < b->row;
+	return a->column < b->column;
+}
+
+static bool better_score(enum pack_objective objective,
+                         const struct score *a, const struct score *b) {
+	if (objective == PACK_MAX_FILL) {
+		if (a->fill != b->fill)
+			return a->fill > b->fill;
+		if (a->count != b->count)
+			return a->count > b->count;
+		return a->bounds_area < b->bounds_area;
+	}
+	if (a->count != b->count)
+		return a->count > b->count;
+	if (a->bounds_area != b->bounds_area)
+		return a->bounds_area < b->bounds_area;
+	return a->fill > b->fill;
+}
+
+/* Grows an extent to cover another. */
+static void grow_extent(struct extent *bounds, const struct extent *e) {
+	int64_t bottom = bounds->row + bounds->height;
+	int64_t right = bounds->column + bounds->width;
+	if (e->row + e->height > bottom)
+		bottom = e->row + e->height;
+	if (e->column + e->width > right)
+		right = e->column + e->width;
+	if (e->row < bounds->row)
+		bounds->row = e->row;
+	if (e->column < bounds->column)
+		bounds->column = e->column;
+	bounds->height = bottom - bounds->row;
+	bounds->width = right - bounds->column;
+}
+
+/* Orders Stands by descending key, keeping the bill of materials order
+ * between equal keys.
+ */
+static int compare_order(const void *a, const void *b) {
+	const struct order_key *ka = a, *kb = b;
+	if (ka->key != kb->key)
+		return ka->key < kb->key ? 1 : -1;
+	return (ka->unit > kb->unit) - (ka->unit < kb->unit);
+}
+
+/* splitmix64, which is fine with any seed, including 0 */
+static uint64_t next_random(uint64_t *state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
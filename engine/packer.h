@@ -0,0 +1,70 @@
+/* packer.h
+ *
+ * This file contains declarations for laying out Stands automatically.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKER_H
+#define PACKER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "grid.h"
+#include "stand.h"
+
+// what makes one layout better than another
+enum pack_objective {
+	// cover as many Tiles as possible
+	PACK_MAX_FILL,
+	// place as many Stands as possible, in as small a rectangle as possible
+	PACK_MIN_AREA
+};
+
+// layouts tried when the options don't say
+#define PACK_DEFAULT_ATTEMPTS 64
+
+/* A line of the bill of materials: count Stands of one Stand Template. */
+struct pack_item {
+	stand_template t;
+	uint32_t count;
+};
+
+struct pack_options {
+	enum pack_objective objective;
+	// number of layouts to try; 0 means PACK_DEFAULT_ATTEMPTS
+	uint32_t attempts;
+	// layouts are chosen at random from this; the same seed, items
+	// and Grid always give the same result
+	uint64_t seed;
+	// place every Stand the way its template is drawn
+	bool keep_orientation;
+};
+
+/* A Stand the packer made and applied, and the item it was made for. */
+struct pack_placement {
+	uint32_t item;
+	stand s;
+};
+
+bool pack_stands(grid g, const struct pack_item *items, uint32_t num_items,
+                 const struct pack_options *opts,
+                 struct pack_placement *placed, uint32_t *num_placed);
+
+#endif
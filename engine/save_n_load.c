@@ -22,501 +22,1278 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdbool.h>
+#include <assert.h>
+#include <time.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "grid.h"
 #include "stand.h"
 #include "save_n_load.h"
+#include "binfile.h"
 #include "capi.h"
+#include "workers.h"
+#include "templib.h"
 
-static void scan_whitespace(FILE *f);
-static int32_t read_stand_templates(FILE *f, struct stand_template **st);
-static grid read_grid(FILE *f, uint32_t height,
-                      uint32_t width, stand_like stand);
-static int32_t read_stands(FILE *f, stand **s);
-static void print_stand_templates(FILE *f);
-static void print_stands(FILE *f);
-static void print_grid(FILE *f, grid g);
+/* A position in the text of a file being loaded. Once a parse error has
+ * been recorded, failed is set and later errors are not recorded. A quiet
+ * cursor doesn't record errors at all.
+ */
+struct cursor {
+	const char *start;
+	const char *p;
+	const char *end;
+	bool failed;
+	bool quiet;
+};
+
+/* Reads one definition of a block into element i of an array of records,
+ * and clears element i again, if it has been read. context is whatever
+ * else the definitions of the block can refer to.
+ */
+typedef bool (*record_reader)(struct cursor *c, void *context,
+                              void *records, uint64_t i);
+typedef void (*record_clearer)(void *records, uint64_t i);
+
+// blocks are read by a pool of workers once each worker would get at
+// least this many definitions, which they take off the list in batches
+#define PARALLEL_MIN_RECORDS 512
+#define RECORD_BATCH 64
+
+/* The definitions of a block being read by a pool of workers. */
+struct record_job {
+	const char *start;
+	const char **starts;
+	uint64_t num;
+	void *context;
+	void *records;
+	record_reader read;
+	uint64_t next;  // first definition not yet taken by a worker
+	bool failed;    // set once any definition fails to parse
+};
+
+/* What the definitions of a stands block can refer to. */
+struct stand_context {
+	struct stand_template *templates;
+	int32_t num_templates;
+	// whether the file version allows a Stand to be given as a
+	// reference to one of templates
+	bool references;
+};
+
+static bool parse_error(struct cursor *c, const char *message);
+static void skip_space(struct cursor *c);
+static bool expect(struct cursor *c, char ch);
+static bool read_number(struct cursor *c, uint64_t max, uint64_t *out);
+static bool read_field(struct cursor *c, uint64_t max, uint64_t *out);
+static char *read_name(struct cursor *c);
+static bool read_text(struct cursor *c, uint64_t version);
+static bool read_stand_templates(struct cursor *c,
+                                 struct stand_template **st, int32_t *num);
+static bool read_stand_template(struct cursor *c, void *context,
+                                void *records, uint64_t i);
+static void clear_stand_template(void *records, uint64_t i);
+static bool read_stands(struct cursor *c, struct stand_context *ctx,
+                        stand **stand_arr, int32_t *num);
+static bool read_stand(struct cursor *c, void *context,
+                       void *records, uint64_t i);
+static bool read_stand_reference(struct cursor *c, struct stand_context *ctx,
+                                 stand s);
+static bool read_stand_shape(struct cursor *c, struct stand_context *ctx,
+                             stand s);
+static void clear_stand(void *records, uint64_t i);
+static bool read_records(struct cursor *c, uint64_t num, const char *what,
+                         void *context, void *records,
+                         record_reader read, record_clearer clear);
+static bool read_records_parallel(struct cursor *c, uint64_t num,
+                                  void *context, void *records,
+                                  record_reader read, record_clearer clear);
+static bool find_records(const char *p, const char *end, uint64_t num,
+                         const char **starts);
+static void read_record_batches(void *job, unsigned worker,
+                                unsigned num_workers);
+static grid read_grid(struct cursor *c, uint32_t width,
+                      uint32_t height, stand_like stand);
+struct text_writer;
+static void print_stand_templates(struct text_writer *w);
+static void print_stands(struct text_writer *w);
+static bool find_stand_template(stand s, int32_t *t, uint8_t *sym);
+static void print_grid(struct text_writer *w, grid g);
+
+// why and where the last load_file call failed; empty if it didn't
+static char load_error[128];
+static size_t load_error_offset;
 
 bool load_file(FILE *f) {
-	int c;
-	char filetype[5];
-	for (int i = 0; i < 4; i++) {
-		// did we get EOF?
-		if ((c = fgetc(f)) == EOF) return false;
-		filetype[i] = (char) c;
-	}
-	filetype[4] = '\0';
-	// wrong filetype?
-	if (strcmp("MMGS", filetype) != 0) return false;
-
-	(void) fgetc(f); //skip next colon
-	int file_version = 0;
-	while ((c = fgetc(f)) != EOF && c != ';') {
-		// non-numeric character?
-		if (!isdigit(c)) return false;
-		file_version = file_version * 10 + (c - '0');
+	load_error[0] = '\0';
+
+	// the whole file is parsed from memory rather than a character
+	// at a time from the stream
+	struct file_view v;
+	if (!open_view(f, &v)) {
+		set_load_error(0, "could not read the file");
+		return false;
+	}
+	struct cursor c = {v.data, v.data, v.data + v.len, false, false};
+
+	bool ok = false;
+	uint64_t file_version = 0;
+	if (v.len < 4 || memcmp(v.data, "MMGS", 4) != 0) {
+		parse_error(&c, "not a map file");
+	} else {
+		c.p += 4;
+		ok = expect(&c, ':')
+			&& read_number(&c, INT32_MAX, &file_version)
+			&& expect(&c, ';');
+	}
+
+	if (ok) {
+		switch (file_version) {
+		case 1:
+		case 3:
+			ok = read_text(&c, file_version);
+			break;
+		case 2:
+			ok = load_file_binary((const uint8_t *) v.data, v.len,
+			                      c.p - v.data);
+			break;
+		default:
+			ok = parse_error(&c, "unsupported file version");
+		}
+	}
+
+	close_view(&v);
+	return ok;
+}
+
+const char *get_load_error(size_t *offset) {
+	if (!load_error[0])
+		return NULL;
+	if (offset)
+		*offset = load_error_offset;
+	return load_error;
+}
+
+void set_load_error(size_t offset, const char *message) {
+	// the first problem found is the one worth reporting
+	if (load_error[0])
+		return;
+	snprintf(load_error, sizeof(load_error), "%s", message);
+	load_error_offset = offset;
+}
+
+/* Applies freshly loaded Stands to a freshly loaded Grid, then makes them
+ * and the loaded Stand Templates the program state, replacing the old.
+ * 
+ * Takes ownership of everything passed in: if a Stand can't be applied
+ * (or there is no Grid), it is all deallocated, the program state is left
+ * alone and false is returned. st and stand_arr may be NULL if the file
+ * held none; the old Stand Templates are kept if st is NULL.
+ */
+bool install_loaded_map(struct stand_template *st, int32_t num_templates,
+                        stand *stand_arr, int32_t num_stands, grid g) {
+	// apply new stands
+	if (!g)
+		goto out_fail;
+	// a big map is checked for overlaps in parallel, leaving only the
+	// bookkeeping of applying each Stand to do one at a time
+	bool checked = false;
+	if (num_stands >= 2 * PARALLEL_MIN_RECORDS) {
+		bool fit;
+		checked = check_stands_fit(g, stand_arr, num_stands, &fit);
+		if (checked && !fit)
+			goto out_fail;
+	}
+	for (int32_t i = 0; i < num_stands; i++) {
+		stand cur = stand_arr[i];
+		bool ok = checked
+			? prepare_apply(cur, g, cur->row, cur->column)
+			: can_apply(cur, g, cur->row, cur->column);
+		if (!ok)
+			goto out_fail;
+		do_apply(cur);
+	}
+	// the whole map is new to the renderer
+	grid_mark_dirty(g, 0, 0, g->height, g->width);
+
+	// copy other data
+	// (Stands made from the old templates, such as a grabbed Stand,
+	// hold their own references to the shapes they use, so the old
+	// templates can go right away.)
+	if (st) {
+		del_stand_templates(main_templates, num_main_templates);
+		main_templates = st;
+		num_main_templates = num_templates;
+	}
+	if (main_grid) {
+		// deleting the last Stand in the registry leaves the others
+		// where they are
+		while (main_grid->num_stands > 0)
+			del_stand(main_grid->stands[main_grid->num_stands - 1]);
+		del_grid(main_grid);
 	}
+	main_grid = g;
+
+	//cleanup
+	free(stand_arr); // only removes the container, the stands inside
+	                 // are safely in the grid
 	
+	return true;
+
+out_fail:;
+	del_stand_templates(st, num_templates);
+	if (stand_arr) {
+		for (int32_t i = 0; i < num_stands; i++)
+			del_stand(stand_arr[i]);
+		free(stand_arr);
+	}
+	if (g)
+		del_grid(g);
+	return false;
+}
+
+/* Deallocates an array of Stand Templates, along with their names and
+ * their references to their shapes. Does nothing if the array is NULL.
+ */
+void del_stand_templates(struct stand_template *st, int32_t num) {
+	if (!st)
+		return;
+	for (int32_t i = 0; i < num; i++) {
+		if (!st[i].borrowed_name)
+			free(st[i].name);
+		// templates from a library that were never used have no shape
+		if (st[i].orients)
+			del_orientation_set(st[i].orients);
+	}
+	free(st);
+}
+
+/* Makes the contents of a file, from its current position on, available
+ * in memory.
+ */
+bool open_view(FILE *f, struct file_view *v) {
+	v->map = NULL;
+	v->copy = NULL;
+
+	// regular files are mapped, so nothing is copied up front; anything
+	// else (a pipe, say) is read into memory
+	struct stat st;
+	if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode)) {
+		long start = ftell(f);
+		if (start < 0 || st.st_size <= start)
+			return false;
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+		                 fileno(f), 0);
+		if (map != MAP_FAILED) {
+			v->map = map;
+			v->map_len = st.st_size;
+			v->data = (const char *) map + start;
+			v->len = st.st_size - start;
+			return true;
+		}
+	}
+
+	size_t len = 0;
+	size_t cap = 0;
+	char *data = NULL;
+	for (;;) {
+		if (len == cap) {
+			cap = cap ? cap * 2 : 65536;
+			char *nd = realloc(data, cap);
+			if (!nd) {
+				free(data);
+				return false;
+			}
+			data = nd;
+		}
+		size_t got = fread(data + len, 1, cap - len, f);
+		if (got == 0)
+			break;
+		len += got;
+	}
+	if (ferror(f) || len == 0) {
+		free(data);
+		return false;
+	}
+	v->copy = data;
+	v->data = data;
+	v->len = len;
+	return true;
+}
+
+void close_view(struct file_view *v) {
+	if (v->map)
+		munmap(v->map, v->map_len);
+	free(v->copy);
+}
+
+/* Records a parse error at the cursor. Always returns false. */
+static bool parse_error(struct cursor *c, const char *message) {
+	if (!c->failed) {
+		c->failed = true;
+		if (!c->quiet)
+			set_load_error(c->p - c->start, message);
+	}
+	return false;
+}
+
+static void skip_space(struct cursor *c) {
+	while (c->p < c->end && isspace((unsigned char) *c->p))
+		c->p++;
+}
+
+/* Consumes the given character, or records an error if it isn't next. */
+static bool expect(struct cursor *c, char ch) {
+	if (c->p < c->end && *c->p == ch) {
+		c->p++;
+		return true;
+	}
+	char message[32];
+	snprintf(message, sizeof(message), "expected '%c'", ch);
+	return parse_error(c, message);
+}
+
+/* Reads a decimal number no greater than max, after any whitespace. */
+static bool read_number(struct cursor *c, uint64_t max, uint64_t *out) {
+	skip_space(c);
+	if (c->p == c->end || !isdigit((unsigned char) *c->p))
+		return parse_error(c, "expected a number");
+
+	uint64_t n = 0;
+	const char *digits = c->p;
+	while (c->p < c->end && isdigit((unsigned char) *c->p)) {
+		unsigned d = *c->p - '0';
+		if (d > max || n > (max - d) / 10) {
+			c->p = digits;
+			return parse_error(c, "number out of range");
+		}
+		n = n * 10 + d;
+		c->p++;
+	}
+	*out = n;
+	return true;
+}
+
+/* Reads a colon followed by a number no greater than max. */
+static bool read_field(struct cursor *c, uint64_t max, uint64_t *out) {
+	return expect(c, ':') && read_number(c, max, out);
+}
+
+/* Reads a length-prefixed name, such as "7:L Block", into a new
+ * NUL-terminated string. Returns NULL on failure.
+ */
+static char *read_name(struct cursor *c) {
+	uint64_t len;
+	if (!read_number(c, SIZE_MAX - 1, &len) || !expect(c, ':'))
+		return NULL;
+	if ((uint64_t) (c->end - c->p) < len) {
+		parse_error(c, "name runs past the end of the file");
+		return NULL;
+	}
+
+	char *name = malloc(len + 1);
+	if (!name) {
+		parse_error(c, "out of memory");
+		return NULL;
+	}
+	memcpy(name, c->p, len);
+	name[len] = '\0';
+	c->p += len;
+	return name;
+}
+
+/* Returns true if a block name read from a file is the given one. */
+static bool is_block(const char *name, size_t len, const char *want) {
+	return len == strlen(want) && memcmp(name, want, len) == 0;
+}
+
+/* Reads the blocks of a text file of the given version, then installs
+ * what they held as the program state.
+ */
+static bool read_text(struct cursor *c, uint64_t version) {
 	// new data, to be moved if successful
 	int32_t new_num_templates = 0;
 	struct stand_template *new_st_arr = NULL;
 	int32_t new_num_stands = 0;
 	stand *new_stand_arr = NULL;
 	grid new_main_grid = NULL;
+	const char *stands_at = NULL;
 
-	scan_whitespace(f);
-	while ((c = fgetc(f)) != EOF) {
-		char blockname[101];
-		blockname[0] = c;
-		int i = 0;
-		while (++i < 100 && (c = fgetc(f)) != EOF
-		       && c != '(' && c != '[') {
-			blockname[i] = c;
+	skip_space(c);
+	while (c->p < c->end) {
+		const char *blockname = c->p;
+		while (c->p < c->end && c->p - blockname < 100
+		       && *c->p != '(' && *c->p != '[')
+			c->p++;
+		size_t name_len = c->p - blockname;
+		if (c->p == c->end || name_len == 100) {
+			c->p = blockname;
+			parse_error(c, "unrecognized block");
+			goto out_fail;
 		}
-		blockname[i] = '\0';
-		if (i == 100 && !(c == '(' || c == '['))
-			return false;
-		ungetc(c, f);
 		
-		if (strcmp("standtemplates", blockname) == 0) {
-			new_num_templates =
-				read_stand_templates(f, &new_st_arr);
-			if (!new_num_templates)
+		if (is_block(blockname, name_len, "standtemplates")) {
+			if (new_st_arr) {
+				c->p = blockname;
+				parse_error(c, "repeated block");
+				goto out_fail;
+			}
+			if (!read_stand_templates(c, &new_st_arr,
+			                          &new_num_templates))
+				goto out_fail;
+		} else if (is_block(blockname, name_len, "stands")) {
+			if (new_stand_arr) {
+				c->p = blockname;
+				parse_error(c, "repeated block");
+				goto out_fail;
+			}
+			stands_at = blockname;
+			// only templates read before the block can be
+			// referred to, which is why the saver writes them first
+			struct stand_context ctx = {new_st_arr, new_num_templates,
+			                            version >= 3};
+			if (!read_stands(c, &ctx, &new_stand_arr, &new_num_stands))
 				goto out_fail;
-		} else if (strcmp("stands", blockname) == 0) {
-			new_num_stands =
-				read_stands(f, &new_stand_arr);
-			if (!new_num_stands)
+		} else if (is_block(blockname, name_len, "maingrid")) {
+			if (new_main_grid) {
+				c->p = blockname;
+				parse_error(c, "repeated block");
 				goto out_fail;
-		} else if (strcmp("maingrid", blockname) == 0) {
-			if (!(c = fgetc(f)) || c != '(')
+			}
+			uint64_t new_width;
+			uint64_t new_height;
+			if (!expect(c, '(')
+			    || !read_number(c, UINT32_MAX, &new_width)
+			    || !read_field(c, UINT32_MAX, &new_height))
 				goto out_fail;
-			uint32_t new_height;
-			uint32_t new_width;
-			int scan_val =
-				fscanf(f, "%" SCNu32 ":%" SCNu32,
-						&new_width, &new_height);
-			if (scan_val == EOF || scan_val < 2)
+			if (new_width == 0 || new_height == 0) {
+				parse_error(c, "the Main Grid has no Tiles");
 				goto out_fail;
-			scan_whitespace(f);
-			if (!(c = fgetc(f)) || c != ')')
+			}
+			skip_space(c);
+			if (!expect(c, ')'))
 				goto out_fail;
 
-			if (!(new_main_grid = new_grid(new_width, new_height)))
+			// very large maps are mostly empty space, so we
+			// only materialize the parts that hold Stands
+			if (new_width * new_height > SPARSE_GRID_MIN_TILES)
+				new_main_grid =
+					new_sparse_grid(new_width, new_height);
+			else
+				new_main_grid = new_grid(new_width, new_height);
+			if (!new_main_grid) {
+				parse_error(c, "out of memory");
 				goto out_fail;
+			}
 		} else {
-			// unrecognized block
+			c->p = blockname;
+			parse_error(c, "unrecognized block");
 			goto out_fail;
 		}
 
-		scan_whitespace(f);
+		skip_space(c);
 	}
 
-	// apply new stands
-	if (!new_main_grid)
+	if (!new_main_grid) {
+		parse_error(c, "no maingrid block");
 		goto out_fail;
-	for (int32_t i = 0; i < new_num_stands; i++) {
-		stand cur = new_stand_arr[i];
-		bool ok = can_apply(cur, new_main_grid, cur->row, cur->column);
-		if (!ok)
-			goto out_fail;
-		do_apply(cur);
 	}
-
-	// copy other data
-	if (new_st_arr)
-		main_templates = new_st_arr;
-		num_main_templates = new_num_templates;
-	if (main_grid) {
-		tile *t = main_grid->lookup;
-		uint64_t len = main_grid->height * main_grid->width;
-		for (uint64_t i = 0; i < len; i++) {
-			if ((*t)->stand.stand_stand.s)
-				del_stand((*t)->stand.stand_stand.s);
-			t++;
-		}
-		del_grid(main_grid);
+	if (!install_loaded_map(new_st_arr, new_num_templates,
+	                        new_stand_arr, new_num_stands,
+	                        new_main_grid)) {
+		set_load_error(stands_at ? stands_at - c->start : 0,
+		               "a Stand overlaps another or lies off the Main Grid");
+		return false;
 	}
-	main_grid = new_main_grid;
-
-	//cleanup
-	free(new_stand_arr); // only removes the container, the stands inside
-	                     // are safely in the grid
-	
 	return true;
 
 out_fail:;
-	 if (new_st_arr) {
-		 for (int i = 0; i < new_num_templates; i++) {
-			free(new_st_arr[i].name);
-			del_grid(new_st_arr[i].t);
-		 }
-		 free(new_st_arr);
-	 }
-	 if (new_stand_arr) {
-		 for (int i = 0; i < new_num_stands; i++) {
-			 del_stand(new_stand_arr[i]);
-		 }
-		 free(new_stand_arr);
-	 }
-	 if (new_main_grid) {
-		 del_grid(new_main_grid);
-	 }
-	 return false;
-}
-
-static void scan_whitespace(FILE *f) {
-	int c;
-	while((c = fgetc(f)) != EOF && isspace(c));
-	ungetc(c, f);
-}
-
-/* Reads the standtemplates block.
- * 
- * Requires a FILE * and the location of where to store the stand_template
- * array, allocated on the heap.
+	del_stand_templates(new_st_arr, new_num_templates);
+	if (new_stand_arr) {
+		for (int32_t i = 0; i < new_num_stands; i++)
+			del_stand(new_stand_arr[i]);
+		free(new_stand_arr);
+	}
+	if (new_main_grid)
+		del_grid(new_main_grid);
+	return false;
+}
+
+/* Reads the standtemplates block, from just after its name.
  * 
- * Returns the number of templates read, or 0 if the read failed,
- * in which case st will be set to NULL.
+ * On success, stores the array of templates, allocated on the heap, and
+ * how many it holds. On failure, nothing is left allocated.
  */
-static int32_t read_stand_templates(FILE *f, struct stand_template **st) {
-	int32_t num_templates;
-	int scan_val = fscanf(f, "[%i](", &num_templates);
-	if (scan_val == EOF || scan_val < 1)
+static bool read_stand_templates(struct cursor *c,
+                                 struct stand_template **st, int32_t *num) {
+	uint64_t num_templates;
+	if (!expect(c, '[') || !read_number(c, INT32_MAX, &num_templates)
+	    || !expect(c, ']') || !expect(c, '('))
 		return false;
+	// each definition takes at least a dozen characters, so a count
+	// beyond that is a bad file rather than a big allocation
+	if (num_templates > (uint64_t) (c->end - c->p) / 12)
+		return parse_error(c, "more Stand Templates than the file holds");
+
 	struct stand_template *new_stand_templates =
-		(struct stand_template *) malloc(
-		sizeof(struct stand_template) * num_templates);
+		calloc(num_templates ? num_templates : 1,
+		       sizeof(struct stand_template));
 	if (!new_stand_templates)
-		goto out_templates;
-
-	int templates_i = 0;
-	int c;
-	char *name;
-	while ((c = fgetc(f)) != EOF && c != ')') {
-		if (isspace(c)) continue;
-		int name_len = 0;
-		do {
-			name_len = name_len * 10 + (c - '0');
-		} while ((c = fgetc(f)) != EOF && c != ':');
-		
-		name = (char *) malloc(sizeof(char) * (name_len + 1));
-		if (!name)
-			goto out_name;
-		for (int i = 0; i < name_len; i++) {
-			name[i] = fgetc(f);
-		}
-		name[name_len] = '\0';
-		
-		uint8_t red;
-		uint8_t green;
-		uint8_t blue;
-		uint8_t alpha;
-		uint32_t height;
-		uint32_t width;
-		scan_val = 
-			fscanf(f, ":%" SCNu8 ":%" SCNu8 ":%" SCNu8 ":%" SCNu8
-				":%" SCNu32 ":%" SCNu32 ":",
-				&red, &green, &blue, &alpha, &height, &width);
-		if (scan_val == EOF || scan_val < 6)
-			goto out_new_source;
-
-		stand_template t = &new_stand_templates[templates_i++];
-		stand_like tl;
-		tl.stand_proto.type = STAND_TEMPLATE;
-		tl.stand_st.st = t;
-
-		grid new_source = read_grid(f, height, width, tl);
-		if (!new_source)
-			goto out_new_source;
-
-		t->name = name;
-		t->t = new_source;
-		t->red = red / 255.0;
-		t->green = green / 255.0;
-		t->blue = blue / 255.0;
-		t->alpha = alpha / 255.0;
-		
+		return parse_error(c, "out of memory");
+
+	if (!read_records(c, num_templates, "Stand Templates", NULL,
+	                  new_stand_templates, read_stand_template,
+	                  clear_stand_template)) {
+		free(new_stand_templates);
+		return false;
 	}
 	*st = new_stand_templates;
-	return num_templates;
+	*num = num_templates;
+	return true;
+}
 
-	out_new_source:;
-		free(name);
-	out_name:;
-		free(new_stand_templates);
-	out_templates:;
-		*st = NULL;
-		return 0;
+/* Reads a Stand Template definition into element i of an array of them. */
+static bool read_stand_template(struct cursor *c, void *context,
+                                void *records, uint64_t i) {
+	(void) context;
+	stand_template t = (struct stand_template *) records + i;
+	char *name = read_name(c);
+	if (!name)
+		return false;
+	uint64_t red, green, blue, alpha, width, height;
+	if (!read_field(c, UINT8_MAX, &red)
+	    || !read_field(c, UINT8_MAX, &green)
+	    || !read_field(c, UINT8_MAX, &blue)
+	    || !read_field(c, UINT8_MAX, &alpha)
+	    || !read_field(c, UINT32_MAX, &width)
+	    || !read_field(c, UINT32_MAX, &height)
+	    || !expect(c, ':'))
+		goto out_name;
+
+	stand_like tl;
+	tl.stand_proto.type = STAND_TEMPLATE;
+	tl.stand_st.st = t;
+
+	grid new_source = read_grid(c, width, height, tl);
+	if (!new_source)
+		goto out_name;
+	orientation_set orients = new_orientation_set(new_source);
+	if (!orients) {
+		del_grid(new_source);
+		parse_error(c, "out of memory");
+		goto out_name;
+	}
+
+	t->name = name;
+	t->t = new_source;
+	t->orients = orients;
+	t->red = red / 255.0;
+	t->green = green / 255.0;
+	t->blue = blue / 255.0;
+	t->alpha = alpha / 255.0;
+	return true;
+
+out_name:;
+	free(name);
+	return false;
 }
 
-/* Reads the stands block.
- * 
- * Requires a FILE * and the location of where to store the stand
- * array, allocated on the heap.
+/* Deallocates element i of an array of Stand Templates being read, if it
+ * has been read.
+ */
+static void clear_stand_template(void *records, uint64_t i) {
+	stand_template t = (struct stand_template *) records + i;
+	if (!t->orients)
+		return;
+	free(t->name);
+	del_orientation_set(t->orients);
+	t->name = NULL;
+	t->orients = NULL;
+}
+
+/* Reads the stands block, from just after its name.
  * 
- * Returns the number of stands read, or 0 if the read failed,
- * in which case st will be set to NULL.
+ * On success, stores the array of Stands, allocated on the heap, and how
+ * many it holds. On failure, nothing is left allocated.
  */
-static int32_t read_stands(FILE *f, stand **stand_arr) {
-	int32_t num_stands;
-	int scan_val = fscanf(f, "[%i](", &num_stands);
-	if (scan_val == EOF || scan_val < 1)
+static bool read_stands(struct cursor *c, struct stand_context *ctx,
+                        stand **stand_arr, int32_t *num) {
+	uint64_t num_stands;
+	if (!expect(c, '[') || !read_number(c, INT32_MAX, &num_stands)
+	    || !expect(c, ']') || !expect(c, '('))
 		return false;
-	stand *new_stands =
-		(stand *) calloc(num_stands, sizeof(stand));
+	// a reference to a template and a position take at least that
+	if (num_stands > (uint64_t) (c->end - c->p) / 16)
+		return parse_error(c, "more Stands than the file holds");
+
+	stand *new_stands = calloc(num_stands ? num_stands : 1, sizeof(stand));
 	if (!new_stands)
-		goto out_stands;
-
-	int stands_i = 0;
-	int c;
-	char *name;
-	stand s = NULL;
-	while ((c = fgetc(f)) != EOF && c != ')') {
-		if (isspace(c)) continue;
-		int name_len = 0;
-		do {
-			name_len = name_len * 10 + (c - '0');
-		} while ((c = fgetc(f)) != ':');
-		
-		name = (char *) malloc(sizeof(char) * (name_len + 1));
-		if (!name)
-			goto out_name;
-		for (int i = 0; i < name_len; i++) {
-			name[i] = fgetc(f);
-		}
-		name[name_len] = '\0';
-
-		uint8_t red;
-		uint8_t green;
-		uint8_t blue;
-		uint8_t alpha;
-		uint32_t height;
-		uint32_t width;
-		scan_val = 
-			fscanf(f, ":%" SCNu8 ":%" SCNu8 ":%" SCNu8 ":%" SCNu8
-				":%" SCNu32 ":%" SCNu32 ":",
-				&red, &green, &blue, &alpha, &height, &width);
-		if (scan_val == EOF || scan_val < 6)
-			goto out_new_source;
-
-		s = (stand) calloc(1, sizeof(struct stand));
-		if (!s)
-			goto out_new_stand;
-		stand_like sl;
-		sl.stand_proto.type = STAND;
-		sl.stand_stand.s = s;
-		
-		grid new_source = read_grid(f, height, width, sl);
-		if (!new_source)
-			goto out_new_source;
-
-		uint64_t row;
-		uint64_t column;
-		scan_val = fscanf(f, "%" SCNu64 ":%" SCNu64 ";", &row, &column);
-		if (scan_val == EOF || scan_val < 2)
-			goto out_new_source;
-
-		s->name = name;
-		s->source = new_source;
-		s->red = red / 255.0;
-		s->green = green / 255.0;
-		s->blue = blue / 255.0;
-		s->alpha = alpha / 255.0;
-		s->row = row;
-		s->column = column;
-		new_stands[stands_i++] = s;
+		return parse_error(c, "out of memory");
+
+	if (!read_records(c, num_stands, "Stands", ctx,
+	                  new_stands, read_stand, clear_stand)) {
+		free(new_stands);
+		return false;
 	}
 	*stand_arr = new_stands;
-	return num_stands;
-
-	out_new_source:;
-		free(s);
-	out_new_stand:;
-		free(name);
-	out_name:;
-		while (--stands_i >= 0) {
-			del_stand(new_stands[stands_i]);
+	*num = num_stands;
+	return true;
+}
+
+/* Reads a Stand definition into a new Stand, stored as element i of an
+ * array of them.
+ */
+static bool read_stand(struct cursor *c, void *context,
+                       void *records, uint64_t i) {
+	struct stand_context *ctx = context;
+	char *name = read_name(c);
+	if (!name)
+		return false;
+	uint64_t red, green, blue, alpha;
+	if (!read_field(c, UINT8_MAX, &red)
+	    || !read_field(c, UINT8_MAX, &green)
+	    || !read_field(c, UINT8_MAX, &blue)
+	    || !read_field(c, UINT8_MAX, &alpha)
+	    || !expect(c, ':'))
+		goto out_name;
+
+	stand s = (stand) calloc(1, sizeof(struct stand));
+	if (!s) {
+		parse_error(c, "out of memory");
+		goto out_name;
+	}
+
+	skip_space(c);
+	bool shaped = c->p < c->end && *c->p == '@' && ctx->references
+		? read_stand_reference(c, ctx, s)
+		: read_stand_shape(c, ctx, s);
+	if (!shaped)
+		goto out_new_stand;
+
+	// an origin above or left of the Grid is written as its unsigned
+	// two's complement, so any 64-bit value is allowed here
+	uint64_t row;
+	uint64_t column;
+	if (!read_number(c, UINT64_MAX, &row)
+	    || !read_field(c, UINT64_MAX, &column)
+	    || !expect(c, ';')) {
+		del_orientation_set(s->orients);
+		goto out_new_stand;
+	}
+
+	s->name = name;
+	s->registry_index = STAND_UNREGISTERED;
+	s->red = red / 255.0;
+	s->green = green / 255.0;
+	s->blue = blue / 255.0;
+	s->alpha = alpha / 255.0;
+	s->row = (int64_t) row;
+	s->column = (int64_t) column;
+	((stand *) records)[i] = s;
+	return true;
+
+out_new_stand:;
+	free(s);
+out_name:;
+	free(name);
+	return false;
+}
+
+/* Reads the shape of a Stand given as "@template:symmetry:", sharing the
+ * orientation set of that Stand Template.
+ */
+static bool read_stand_reference(struct cursor *c, struct stand_context *ctx,
+                                 stand s) {
+	c->p++;
+	uint64_t t, sym;
+	if (!read_number(c, INT32_MAX, &t))
+		return false;
+	if (t >= (uint64_t) ctx->num_templates)
+		return parse_error(c, "no such Stand Template");
+	if (!read_field(c, NUM_SYMMETRIES - 1, &sym) || !expect(c, ':'))
+		return false;
+
+	s->orients = share_orientation_set(ctx->templates[t].orients);
+	set_stand_orientation(s, sym);
+	return true;
+}
+
+/* Reads the shape of a Stand given as its size and a Grid Definition.
+ * 
+ * Older files spell out every Stand this way, even ones that are just a
+ * template turned around, so a shape one of the templates already has
+ * shares that template's orientation set rather than building another.
+ */
+static bool read_stand_shape(struct cursor *c, struct stand_context *ctx,
+                             stand s) {
+	uint64_t width, height;
+	if (!read_number(c, UINT32_MAX, &width)
+	    || !read_field(c, UINT32_MAX, &height)
+	    || !expect(c, ':'))
+		return false;
+
+	stand_like sl;
+	sl.stand_proto.type = STAND;
+	sl.stand_stand.s = s;
+
+	grid new_source = read_grid(c, width, height, sl);
+	if (!new_source)
+		return false;
+
+	for (int32_t t = 0; t < ctx->num_templates; t++) {
+		orientation_set orients = ctx->templates[t].orients;
+		uint8_t sym;
+		if (find_orientation(orients, new_source, &sym)) {
+			del_grid(new_source);
+			s->orients = share_orientation_set(orients);
+			set_stand_orientation(s, sym);
+			return true;
 		}
-		free(new_stands);
-	out_stands:;
-		*stand_arr = NULL;
-		return 0;
-}
-
-static grid read_grid(FILE *f, uint32_t height,
-	              uint32_t width, stand_like stand) {
-	grid ng = new_grid(height, width);
-	if (!ng)
-		goto out_ng;
-
-	int c;
-	// exploits the row-major order of the lookup table
-	tile *t = ng->lookup;
-	while ((c = fgetc(f)) != EOF && c != ';' && c != ':') {
-		if (isspace(c)) continue;
-		if (c == '0') {
-			// nothing to do here, as tiles' stand pointers
-			// are NULL by default
-		} else if (c == 'S') {
-			(*t)->stand = stand;
-		} else {
-			// unrecognized char
+	}
+
+	s->orients = new_orientation_set(new_source);
+	if (!s->orients) {
+		del_grid(new_source);
+		return parse_error(c, "out of memory");
+	}
+	set_stand_orientation(s, 0);
+	return true;
+}
+
+/* Deallocates element i of an array of Stands being read, if it has been
+ * read.
+ */
+static void clear_stand(void *records, uint64_t i) {
+	stand *s = (stand *) records + i;
+	if (*s)
+		del_stand(*s);
+	*s = NULL;
+}
+
+/* Reads the num definitions of a block, and its closing parenthesis, into
+ * an array of records with read. what names them for error messages.
+ * On failure, every record is cleared again with clear.
+ * 
+ * Definitions are independent of each other until their Stands are
+ * applied, so a big block is read by a pool of workers (see
+ * read_records_parallel). If that fails for any reason, or the block is
+ * small, it is read in order instead, which also finds the first problem
+ * in the file to report.
+ */
+static bool read_records(struct cursor *c, uint64_t num, const char *what,
+                         void *context, void *records,
+                         record_reader read, record_clearer clear) {
+	if (num >= 2 * PARALLEL_MIN_RECORDS
+	    && read_records_parallel(c, num, context, records, read, clear))
+		return true;
+
+	char message[64];
+	uint64_t i = 0;
+	for (;;) {
+		skip_space(c);
+		if (c->p == c->end) {
+			parse_error(c, "expected ')'");
 			goto out_fail;
 		}
-		t++;
+		if (*c->p == ')') {
+			if (i != num) {
+				snprintf(message, sizeof(message),
+				         "fewer %s than the block declares", what);
+				parse_error(c, message);
+				goto out_fail;
+			}
+			c->p++;
+			return true;
+		}
+		if (i == num) {
+			snprintf(message, sizeof(message),
+			         "more %s than the block declares", what);
+			parse_error(c, message);
+			goto out_fail;
+		}
+		if (!read(c, context, records, i))
+			goto out_fail;
+		i++;
 	}
-	if (c == EOF)
-		goto out_fail;
 
-	return ng;
+out_fail:;
+	while (i-- > 0)
+		clear(records, i);
+	return false;
+}
+
+/* Reads the definitions of a block on a pool of workers.
+ * 
+ * A first pass finds where each definition starts, without parsing it:
+ * names are length-prefixed, and the fields and Grid Definition that
+ * follow end at known punctuation. The workers then take definitions off
+ * the list a batch at a time, each parsing into its own slot of records.
+ * 
+ * Returns false if the block doesn't look as expected, or any definition
+ * fails to parse, without reporting anything; read_records reads the
+ * block again in order to do that.
+ */
+static bool read_records_parallel(struct cursor *c, uint64_t num,
+                                  void *context, void *records,
+                                  record_reader read, record_clearer clear) {
+	const char **starts = malloc(sizeof(const char *) * (num + 1));
+	if (!starts)
+		return false;
+
+	bool ok = false;
+	if (!find_records(c->p, c->end, num, starts))
+		goto out_starts;
+
+	struct record_job job = {c->start, starts, num, context, records, read,
+	                         0, false};
+	run_workers(read_record_batches, &job,
+	            num_workers_for(num, PARALLEL_MIN_RECORDS));
+	if (job.failed) {
+		for (uint64_t i = 0; i < num; i++)
+			clear(records, i);
+		goto out_starts;
+	}
+	c->p = starts[num] + 1;
+	ok = true;
+
+out_starts:;
+	free(starts);
+	return ok;
+}
+
+/* Finds where each of num definitions starts, for read_records_parallel.
+ * Definition i runs up to starts[i + 1]; starts[num] is the closing
+ * parenthesis of the block. Returns false if the text doesn't look like
+ * num definitions followed by the end of the block.
+ */
+static bool find_records(const char *p, const char *end, uint64_t num,
+                         const char **starts) {
+	for (uint64_t i = 0; i < num; i++) {
+		while (p < end && isspace((unsigned char) *p))
+			p++;
+		starts[i] = p;
+
+		// the name, which can hold any character at all
+		uint64_t len = 0;
+		const char *digits = p;
+		while (p < end && isdigit((unsigned char) *p) && p - digits < 18)
+			len = len * 10 + (*p++ - '0');
+		if (p == digits || p == end || *p != ':'
+		    || (uint64_t) (end - p - 1) < len)
+			return false;
+		p += 1 + len;
+
+		// the colour fields, then either the size fields or a
+		// reference to a template; no semicolon comes before the
+		// one that ends the definition
+		for (int colons = 0; colons < 7; p++) {
+			if (p == end)
+				return false;
+			if (*p == ':')
+				colons++;
+		}
+		p = memchr(p, ';', end - p);
+		if (!p)
+			return false;
+		p++;
+	}
+	while (p < end && isspace((unsigned char) *p))
+		p++;
+	if (p == end || *p != ')')
+		return false;
+	starts[num] = p;
+	return true;
+}
 
+static void read_record_batches(void *arg, unsigned worker,
+                                unsigned num_workers) {
+	(void) worker;
+	(void) num_workers;
+	struct record_job *job = arg;
+	for (;;) {
+		uint64_t first = __atomic_fetch_add(&job->next, RECORD_BATCH,
+		                                    __ATOMIC_RELAXED);
+		if (first >= job->num)
+			return;
+		uint64_t last = first + RECORD_BATCH < job->num
+			? first + RECORD_BATCH : job->num;
+		for (uint64_t i = first; i < last; i++) {
+			if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED))
+				return;
+			// each definition is read on its own, so a bad one
+			// can't run on into the next
+			struct cursor c = {job->start, job->starts[i],
+			                   job->starts[i + 1], false, true};
+			if (!job->read(&c, job->context, job->records, i)) {
+				__atomic_store_n(&job->failed, true,
+				                 __ATOMIC_RELAXED);
+				return;
+			}
+			skip_space(&c);
+			if (c.p != c.end) {
+				__atomic_store_n(&job->failed, true,
+				                 __ATOMIC_RELAXED);
+				return;
+			}
+		}
+	}
+}
+
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BYTE_ONES  0x0101010101010101ull
+#define BYTE_HIGHS 0x8080808080808080ull
+
+/* Returns a word with the high bit set in each byte of w equal to ch,
+ * and every other bit clear.
+ */
+static inline uint64_t bytes_equal(uint64_t w, unsigned char ch) {
+	uint64_t x = w ^ (BYTE_ONES * ch);
+	return ~(((x & ~BYTE_HIGHS) + ~BYTE_HIGHS) | x) & BYTE_HIGHS;
+}
+
+/* Decodes the Tiles of a Grid Definition eight characters at a time, for
+ * as long as the characters are only Tiles and ordinary whitespace.
+ * Returns the new number of Tiles read; read_grid takes over from wherever
+ * this stops.
+ */
+static uint64_t read_tile_words(struct cursor *c, grid g, uint64_t i,
+                                uint64_t tiles, stand_like stand) {
+	while (c->end - c->p >= 8) {
+		uint64_t w;
+		memcpy(&w, c->p, 8);
+		uint64_t occupied = bytes_equal(w, 'S');
+		uint64_t tile = occupied | bytes_equal(w, '0');
+		uint64_t space = bytes_equal(w, ' ') | bytes_equal(w, '\n')
+			| bytes_equal(w, '\r') | bytes_equal(w, '\t');
+		uint64_t count = __builtin_popcountll(tile);
+		if ((tile | space) != BYTE_HIGHS || count > tiles - i)
+			break;
+
+		while (occupied) {
+			// an occupied Tile's index is the number of Tiles
+			// before it in the word
+			uint64_t before = (occupied & -occupied) - 1;
+			uint64_t at = i + __builtin_popcountll(tile & before);
+			grid_set_stand(g, at / g->width, at % g->width, stand);
+			occupied &= occupied - 1;
+		}
+		i += count;
+		c->p += 8;
+	}
+	return i;
+}
+#endif
+
+/* Reads a Grid Definition and its terminating colon or semicolon into a
+ * new Grid whose occupied Tiles hold stand. Returns NULL on failure.
+ */
+static grid read_grid(struct cursor *c, uint32_t width,
+                      uint32_t height, stand_like stand) {
+	// shapes are nowhere near as big as a map that needs a sparse Grid,
+	// so anything that size is a bad file asking for a huge allocation
+	uint64_t tiles = (uint64_t) width * height;
+	if (tiles == 0 || tiles > SPARSE_GRID_MIN_TILES) {
+		parse_error(c, "bad shape size");
+		return NULL;
+	}
+	grid ng = new_grid(width, height);
+	if (!ng) {
+		parse_error(c, "out of memory");
+		return NULL;
+	}
+
+	// tiles are read in row-major order
+	uint64_t i = 0;
+	for (;;) {
+#ifdef BYTE_HIGHS
+		i = read_tile_words(c, ng, i, tiles, stand);
+#endif
+		if (c->p == c->end) {
+			parse_error(c, "unterminated Grid Definition");
+			goto out_fail;
+		}
+		char ch = *c->p;
+		if (ch == ';' || ch == ':') {
+			c->p++;
+			break;
+		} else if (ch == 'S' || ch == '0') {
+			if (i == tiles) {
+				parse_error(c, "too many Tiles for the shape");
+				goto out_fail;
+			}
+			// '0' Tiles are already empty
+			if (ch == 'S')
+				grid_set_stand(ng, i / width, i % width, stand);
+			i++;
+		} else if (!isspace((unsigned char) ch)) {
+			parse_error(c, "unexpected character in Grid Definition");
+			goto out_fail;
+		}
+		c->p++;
+	}
+
+	return ng;
 
 out_fail:;
 	del_grid(ng);
-out_ng:;
 	return NULL;
 }
 
-#define FILE_VERSION 1
+#define FILE_VERSION 3
+
+// size of the block text is rendered into before each fwrite
+#define WRITER_BUFFER_SIZE 65536
+
+/* Collects the text of a file being saved, writing it out in large blocks
+ * instead of a few bytes at a time.
+ */
+struct text_writer {
+	FILE *f;
+	size_t len;
+	uint64_t written;
+	bool failed;
+	char buf[WRITER_BUFFER_SIZE];
+};
+
+static void flush_writer(struct text_writer *w);
+static char *reserve(struct text_writer *w, size_t n);
+static void put_text(struct text_writer *w, const char *s, size_t n);
+static void put_format(struct text_writer *w, const char *format, ...);
+
+// what the last successful save wrote, and how long it took
+static uint64_t save_bytes;
+static double save_seconds;
 
 bool save_file(FILE *f) {
-	fprintf(f, "MMGS:%i;\n\n", FILE_VERSION);
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	print_stand_templates(f);
-	print_stands(f);
+	struct text_writer *w = malloc(sizeof(struct text_writer));
+	if (!w)
+		return false;
+	w->f = f;
+	w->len = 0;
+	w->written = 0;
+	w->failed = false;
+
+	put_format(w, "MMGS:%i;\n\n", FILE_VERSION);
 
-	fprintf(f, "maingrid(\n%" PRIu32 ":%" PRIu32 "\n)\n\n",
+	print_stand_templates(w);
+	print_stands(w);
+
+	put_format(w, "maingrid(\n%" PRIu32 ":%" PRIu32 "\n)\n\n",
 			main_grid->width, main_grid->height);
 
-	return true;
+	flush_writer(w);
+	bool ok = !w->failed;
+	if (ok)
+		record_save(w->written, &start);
+	free(w);
+	return ok;
 }
 
-static void print_stand_templates(FILE *f) {
+void record_save(uint64_t bytes, const struct timespec *start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	save_bytes = bytes;
+	save_seconds = (end.tv_sec - start->tv_sec)
+		+ (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void get_save_stats(uint64_t *bytes, double *seconds) {
+	*bytes = save_bytes;
+	*seconds = save_seconds;
+}
+
+uint32_t hash_bytes(const void *data, size_t len) {
+	const uint8_t *bytes = data;
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void print_stand_templates(struct text_writer *w) {
 	if (num_main_templates < 1)
 		return;
 
-	fprintf(f, "standtemplates[%" PRIi32 "](\n", num_main_templates);
+	put_format(w, "standtemplates[%" PRIi32 "](\n", num_main_templates);
 
 	for (int32_t i = 0; i < num_main_templates; i++) {
 		stand_template tt = main_templates + i;
+		if (!template_orients(tt)) {
+			w->failed = true;
+			return;
+		}
 		grid tgrid = tt->t;
-		fprintf(f, "%zu:%s:%" PRIu8 ":%" PRIu8 ":%" PRIu8 ":%" PRIu8
+		size_t name_len = strlen(tt->name);
+		put_format(w, "%zu:", name_len);
+		put_text(w, tt->name, name_len);
+		put_format(w, ":%" PRIu8 ":%" PRIu8 ":%" PRIu8 ":%" PRIu8
 			":%" PRIu32 ":%" PRIu32 ":\n",
-				strlen(tt->name), tt->name,
 				(uint8_t) (tt->red * 255.0),
 				(uint8_t) (tt->green * 255.0),
 				(uint8_t) (tt->blue * 255.0),
 				(uint8_t) (tt->alpha * 255.0),
 				tgrid->width, tgrid->height);
-		print_grid(f, tgrid);
-		fprintf(f, ";\n\n");
+		print_grid(w, tgrid);
+		put_text(w, ";\n\n", 3);
 	}
 
-	fprintf(f, ")\n\n");
+	put_text(w, ")\n\n", 3);
 }
 
-static void print_grid(FILE *f, grid g) {
-	// exploits the row-major order of the lookup table
-	tile *t = g->lookup;
-	uint64_t len = g->height * g->width;
-	for (uint64_t i = 0; i < len; i++) {
-		if ((*t)->stand.stand_proto.type == STAND) {
-			if ((*t)->stand.stand_stand.s) {
-				fprintf(f, "S");
-			} else {
-				fprintf(f, "0");
-			}
-		} else {
-			if ((*t)->stand.stand_st.st) {
-				fprintf(f, "S");
-			} else {
-				fprintf(f, "0");
+/* Writes a Grid Definition, one row of Tiles per line. */
+static void print_grid(struct text_writer *w, grid g) {
+	// the text of every combination of eight Tiles, each followed by
+	// a space; built on first use
+	static char tile_text[256][16];
+	static bool tile_text_ready = false;
+	if (!tile_text_ready) {
+		for (int bits = 0; bits < 256; bits++) {
+			for (int i = 0; i < 8; i++) {
+				tile_text[bits][2 * i] =
+					(bits >> i & 1) ? 'S' : '0';
+				tile_text[bits][2 * i + 1] = ' ';
 			}
 		}
-		if ((*t)->column == g->width - 1)
-			fprintf(f, "\n");
-		else
-			fprintf(f, " ");
-		t++;
-	}
-}
-
-// for keeping track of stands
-typedef struct stand_node {
-	stand s;
-	struct stand_node *next;
-} *stand_node;
-static void print_stands(FILE *f) {
-	// get a list of all stands in main_grid
-	tile *t = main_grid->lookup;
-	uint64_t len = main_grid->height * main_grid->width;
-	stand_node head = NULL;
-	stand_node tail = NULL;
-	uint64_t num_stands = 0;
-	for (uint64_t i = 0; i < len; i++, t++) {
-		stand current;
-		if ((current = (*t)->stand.stand_stand.s)) {
-			// check if encountered stand is already in our queue
-			stand_node check = head;
-			while (check && check->s != current)
-				check = check->next;
-			if (check && check->s == current)
-				continue;
-
-			num_stands++;
-			if (!head) {
-				head = (stand_node)
-					malloc(sizeof(struct stand_node));
-				if (!head) // out of mem
-					goto out_fail;
-				tail = head;
-				head->s = current;
-				head->next = NULL;
-			} else {
-				tail->next = (stand_node)
-					malloc(sizeof(struct stand_node));
-				if (!tail->next) // out of mem
-					goto out_fail;
-				tail = tail->next;
-				tail->s = current;
-				tail->next = NULL;
+		tile_text_ready = true;
+	}
+
+	// reads the occupancy plane, so it works on any kind of Grid
+	for (uint32_t row = 0; row < g->height; row++) {
+		for (uint32_t column = 0; column < g->width;
+		     column += OCC_WORD_BITS) {
+			uint64_t word = grid_row_window(g, row, column);
+			uint32_t left = g->width - column;
+			if (left > OCC_WORD_BITS)
+				left = OCC_WORD_BITS;
+			for (uint32_t i = 0; i < left; i += 8) {
+				uint32_t n = left - i < 8 ? left - i : 8;
+				char *out = reserve(w, 16);
+				if (!out)
+					return;
+				memcpy(out, tile_text[word >> i & 0xff], 16);
+				w->len += 2 * n;
 			}
 		}
+		// the last Tile of a row ends the line instead
+		w->buf[w->len - 1] = '\n';
 	}
+}
 
-	fprintf(f, "stands[%" PRIi64 "](\n", num_stands);
+static void print_stands(struct text_writer *w) {
+	// the registry of main_grid already lists every stand exactly once
+	put_format(w, "stands[%" PRIu32 "](\n", main_grid->num_stands);
 	
-	// print stands in list
-	stand_node sn = head;
-	while (sn) {
-		stand ss = sn->s;
+	for (uint32_t i = 0; i < main_grid->num_stands; i++) {
+		stand ss = main_grid->stands[i];
 		grid sgrid = ss->source;
-		fprintf(f, "%zu:%s:%" PRIu8 ":%" PRIu8 ":%" PRIu8 ":%" PRIu8
-			":%" PRIu32 ":%" PRIu32 ":\n",
-				strlen(ss->name), ss->name,
+		size_t name_len = strlen(ss->name);
+		put_format(w, "%zu:", name_len);
+		put_text(w, ss->name, name_len);
+		put_format(w, ":%" PRIu8 ":%" PRIu8 ":%" PRIu8 ":%" PRIu8 ":",
 				(uint8_t) (ss->red * 255.0),
 				(uint8_t) (ss->green * 255.0),
 				(uint8_t) (ss->blue * 255.0),
-				(uint8_t) (ss->alpha * 255.0),
-				sgrid->width, sgrid->height);
-		print_grid(f, sgrid);
-		fprintf(f, ":%" PRIu64 ":%" PRIu64 ";\n\n",
+				(uint8_t) (ss->alpha * 255.0));
+
+		// most Stands are a template, perhaps turned around, so
+		// they refer to it instead of spelling out its shape
+		int32_t t;
+		uint8_t sym;
+		if (find_stand_template(ss, &t, &sym)) {
+			put_format(w, "@%" PRIi32 ":%" PRIu8 ":", t, sym);
+		} else {
+			put_format(w, "%" PRIu32 ":%" PRIu32 ":\n",
+			           sgrid->width, sgrid->height);
+			print_grid(w, sgrid);
+			put_text(w, ":", 1);
+		}
+		put_format(w, "%" PRIu64 ":%" PRIu64 ";\n\n",
 			ss->row, ss->column);
-		sn = sn->next;
 	}
 
-	fprintf(f, ")\n\n");
+	put_text(w, ")\n\n", 3);
+}
 
-	out_fail:;
-		stand_node del = head;
-		while (del) {
-			stand_node temp = del->next;
-			free(del);
-			del = temp;
+/* Finds a Stand Template which, under some symmetry, has the shape a
+ * Stand has now. Returns false if there is none.
+ */
+static bool find_stand_template(stand s, int32_t *t, uint8_t *sym) {
+	// Stands made from a template still share its orientation set
+	for (int32_t i = 0; i < num_main_templates; i++) {
+		if (main_templates[i].orients == s->orients) {
+			*t = i;
+			*sym = s->orientation;
+			return true;
+		}
+	}
+	for (int32_t i = 0; i < num_main_templates; i++) {
+		// library templates nobody has used yet are skipped rather
+		// than built just to be compared
+		if (main_templates[i].orients
+		    && find_orientation(main_templates[i].orients,
+		                        s->source, sym)) {
+			*t = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void flush_writer(struct text_writer *w) {
+	if (!w->failed && w->len > 0
+	    && fwrite(w->buf, 1, w->len, w->f) != w->len)
+		w->failed = true;
+	w->written += w->len;
+	w->len = 0;
+}
+
+/* Makes room for n more bytes at the end of the buffer, flushing it if
+ * need be, and returns where they go. n must fit in an empty buffer.
+ * Returns NULL once writing has failed.
+ */
+static char *reserve(struct text_writer *w, size_t n) {
+	if (w->len + n > WRITER_BUFFER_SIZE)
+		flush_writer(w);
+	return w->failed ? NULL : w->buf + w->len;
+}
+
+static void put_text(struct text_writer *w, const char *s, size_t n) {
+	while (n > 0 && !w->failed) {
+		size_t room = WRITER_BUFFER_SIZE - w->len;
+		if (room == 0) {
+			flush_writer(w);
+			continue;
 		}
+		size_t chunk = n < room ? n : room;
+		memcpy(w->buf + w->len, s, chunk);
+		w->len += chunk;
+		s += chunk;
+		n -= chunk;
+	}
+}
+
+/* Appends printf-style text, which must be short: these are only ever
+ * numbers and punctuation.
+ */
+static void put_format(struct text_writer *w, const char *format, ...) {
+	char *out = reserve(w, 256);
+	if (!out)
+		return;
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(out, 256, format, args);
+	va_end(args);
+	assert(n >= 0 && n < 256);
+	w->len += n;
 }
@@ -21,8 +21,52 @@
  * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef SAVE_N_LOAD_H
+#define SAVE_N_LOAD_H
+
 #include <stdio.h>
 #include <stdbool.h>
+#include <time.h>
+
+#include "stand.h"
 
 bool save_file(FILE *f);
-bool load_file(FILE *f);
\ No newline at end of file
+bool load_file(FILE *f);
+
+/* Returns why the last call to load_file failed, storing the byte offset
+ * in the file at which the problem was found in offset (if it is not NULL),
+ * or returns NULL if the last call succeeded.
+ */
+const char *get_load_error(size_t *offset);
+
+/* Stores the number of bytes written by the last successful call to
+ * save_file or save_file_binary, and how many seconds it took.
+ */
+void get_save_stats(uint64_t *bytes, double *seconds);
+
+/* Returns the 32-bit FNV-1a hash of a run of bytes, as used for the
+ * checksums of binary files and journals.
+ */
+uint32_t hash_bytes(const void *data, size_t len);
+
+/* The contents of a file being loaded: mapped if it is a regular file,
+ * or else read into memory.
+ */
+struct file_view {
+	const char *data;
+	size_t len;
+	void *map;
+	size_t map_len;
+	char *copy;
+};
+
+/* Used by the readers of each file version. */
+bool open_view(FILE *f, struct file_view *v);
+void close_view(struct file_view *v);
+bool install_loaded_map(struct stand_template *st, int32_t num_templates,
+                        stand *stand_arr, int32_t num_stands, grid g);
+void del_stand_templates(struct stand_template *st, int32_t num);
+void set_load_error(size_t offset, const char *message);
+void record_save(uint64_t bytes, const struct timespec *start);
+
+#endif
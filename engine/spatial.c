@@ -0,0 +1,432 @@
+/* spatial.c
+ *
+ * Defines the spatial index kept by each Grid that has Stands applied to it.
+ *
+ * The index divides the Grid into square buckets of SPATIAL_BUCKET_SIZE
+ * Tiles on a side. Each bucket lists every Stand whose bounding box
+ * overlaps it, so a Stand spanning several buckets is listed in each of
+ * them. The index is kept up to date by do_apply and remove_stand.
+ *
+ * Queries only ever look at the buckets that could hold an answer:
+ * a rectangle query visits the buckets under the rectangle, and the
+ * nearest-Stand queries search outward from the query point one ring of
+ * buckets at a time, stopping as soon as no closer Stand can exist.
+ * None of them visit the Tiles of the Grid.
+ *
+ * Distances are measured from the query point to the nearest Tile of a
+ * Stand's bounding box, and are compared squared (Euclidean).
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include "grid.h"
+#include "stand.h"
+#include "spatial.h"
+
+// how many results nearest_search can rank without allocating
+#define NEAREST_STACK_RESULTS 64
+
+struct bucket {
+	stand *stands;
+	uint32_t num;
+	uint32_t cap;
+};
+
+struct spatial_index {
+	uint32_t rows;
+	uint32_t columns;
+	struct bucket *buckets;
+
+	// incremented for each query, see query_mark in struct stand
+	uint32_t mark;
+};
+
+// the range of buckets overlapped by a rectangle
+struct bucket_range {
+	uint32_t first_row;
+	uint32_t last_row;
+	uint32_t first_column;
+	uint32_t last_column;
+};
+
+static spatial_index new_spatial_index(uint32_t height, uint32_t width);
+static bool find_buckets(spatial_index si, const struct extent *e,
+                         struct bucket_range *br);
+static uint64_t distance2(const struct extent *e, int64_t row,
+                          int64_t column);
+static uint32_t next_mark(spatial_index si);
+static uint32_t nearest_search(grid g, int64_t row, int64_t column,
+                               uint32_t k, stand *out);
+
+/* Allocates an empty index for a Grid of the given dimensions.
+ *
+ * Returns NULL if space could not be allocated.
+ */
+static spatial_index new_spatial_index(uint32_t height, uint32_t width) {
+	spatial_index si = malloc(sizeof(struct spatial_index));
+	if (!si)
+		goto out_si;
+
+	si->rows = (height + SPATIAL_BUCKET_SIZE - 1) >> SPATIAL_BUCKET_SHIFT;
+	si->columns = (width + SPATIAL_BUCKET_SIZE - 1) >> SPATIAL_BUCKET_SHIFT;
+	si->mark = 0;
+	si->buckets = calloc((size_t) si->rows * si->columns,
+	                     sizeof(struct bucket));
+	if (!si->buckets)
+		goto out_buckets;
+
+	return si;
+
+out_buckets:;
+	free(si);
+out_si:;
+	return NULL;
+}
+
+/* Deallocates an index. The indexed Stands are not affected. */
+void del_spatial_index(spatial_index si) {
+	assert(si);
+
+	size_t num_buckets = (size_t) si->rows * si->columns;
+	for (size_t i = 0; i < num_buckets; i++)
+		free(si->buckets[i].stands);
+	free(si->buckets);
+	free(si);
+}
+
+/* Finds the buckets overlapped by a rectangle, clipped to the Grid.
+ *
+ * Returns false if the rectangle is empty or lies entirely off the Grid.
+ */
+static bool find_buckets(spatial_index si, const struct extent *e,
+                         struct bucket_range *br) {
+	if (e->height == 0 || e->width == 0)
+		return false;
+
+	int64_t top = e->row < 0 ? 0 : e->row;
+	int64_t left = e->column < 0 ? 0 : e->column;
+	int64_t bottom = (e->row + e->height - 1) >> SPATIAL_BUCKET_SHIFT;
+	int64_t right = (e->column + e->width - 1) >> SPATIAL_BUCKET_SHIFT;
+	top >>= SPATIAL_BUCKET_SHIFT;
+	left >>= SPATIAL_BUCKET_SHIFT;
+	if (bottom >= si->rows)
+		bottom = si->rows - 1;
+	if (right >= si->columns)
+		right = si->columns - 1;
+	if (top > bottom || left > right)
+		return false;
+
+	br->first_row = top;
+	br->last_row = bottom;
+	br->first_column = left;
+	br->last_column = right;
+	return true;
+}
+
+/* Makes sure a Stand with the given bounding box can be inserted into the
+ * index of Grid g without allocating, creating the index if needed.
+ *
+ * can_apply calls this, so that do_apply never has to fail.
+ *
+ * Returns false if space could not be allocated.
+ */
+bool spatial_reserve(grid g, const struct extent *e) {
+	assert(g);
+	assert(e);
+
+	if (!g->index) {
+		g->index = new_spatial_index(g->height, g->width);
+		if (!g->index)
+			return false;
+	}
+
+	spatial_index si = g->index;
+	struct bucket_range br;
+	if (!find_buckets(si, e, &br))
+		return true;
+
+	for (uint32_t r = br.first_row; r <= br.last_row; r++) {
+		for (uint32_t c = br.first_column; c <= br.last_column; c++) {
+			struct bucket *b = si->buckets + (size_t) r * si->columns + c;
+			if (b->num < b->cap)
+				continue;
+			uint32_t new_cap = b->cap ? b->cap * 2 : 4;
+			stand *new_stands =
+				realloc(b->stands, sizeof(stand) * new_cap);
+			if (!new_stands)
+				return false;
+			b->stands = new_stands;
+			b->cap = new_cap;
+		}
+	}
+
+	return true;
+}
+
+/* Adds a Stand to the index of Grid g, at its current location.
+ * spatial_reserve must have been called for that location beforehand.
+ */
+void spatial_insert(grid g, stand s) {
+	assert(g && g->index);
+	assert(s);
+
+	spatial_index si = g->index;
+	struct extent e;
+	get_stand_extent(s, &e);
+	struct bucket_range br;
+	if (!find_buckets(si, &e, &br))
+		return;
+
+	for (uint32_t r = br.first_row; r <= br.last_row; r++) {
+		for (uint32_t c = br.first_column; c <= br.last_column; c++) {
+			struct bucket *b = si->buckets + (size_t) r * si->columns + c;
+			assert(b->num < b->cap);
+			b->stands[b->num++] = s;
+		}
+	}
+}
+
+/* Removes a Stand from the index of Grid g.
+ * The Stand must still be at the location it was inserted at.
+ */
+void spatial_remove(grid g, stand s) {
+	assert(g);
+	assert(s);
+
+	spatial_index si = g->index;
+	if (!si)
+		return;
+	struct extent e;
+	get_stand_extent(s, &e);
+	struct bucket_range br;
+	if (!find_buckets(si, &e, &br))
+		return;
+
+	for (uint32_t r = br.first_row; r <= br.last_row; r++) {
+		for (uint32_t c = br.first_column; c <= br.last_column; c++) {
+			struct bucket *b = si->buckets + (size_t) r * si->columns + c;
+			for (uint32_t i = 0; i < b->num; i++) {
+				if (b->stands[i] == s) {
+					b->stands[i] = b->stands[--b->num];
+					break;
+				}
+			}
+		}
+	}
+}
+
+/* Returns a fresh mark for a query, so Stands listed in several buckets
+ * are only reported once.
+ */
+static uint32_t next_mark(spatial_index si) {
+	if (++si->mark == 0) {
+		// the counter wrapped; clear every mark so stale ones
+		// can't collide with new queries
+		size_t num_buckets = (size_t) si->rows * si->columns;
+		for (size_t i = 0; i < num_buckets; i++)
+			for (uint32_t j = 0; j < si->buckets[i].num; j++)
+				si->buckets[i].stands[j]->query_mark = 0;
+		si->mark = 1;
+	}
+	return si->mark;
+}
+
+/* Finds every Stand on Grid g whose bounding box intersects the given
+ * rectangle.
+ *
+ * Up to max of them are stored in out, which may be NULL if max is 0.
+ *
+ * Returns the total number of Stands found, which may be greater than max.
+ */
+uint32_t stands_in_rect(grid g, const struct extent *rect,
+                        stand *out, uint32_t max) {
+	assert(g);
+	assert(rect);
+
+	spatial_index si = g->index;
+	struct bucket_range br;
+	if (!si || !find_buckets(si, rect, &br))
+		return 0;
+
+	uint32_t mark = next_mark(si);
+	uint32_t found = 0;
+	for (uint32_t r = br.first_row; r <= br.last_row; r++) {
+		for (uint32_t c = br.first_column; c <= br.last_column; c++) {
+			struct bucket *b = si->buckets + (size_t) r * si->columns + c;
+			for (uint32_t i = 0; i < b->num; i++) {
+				stand s = b->stands[i];
+				if (s->query_mark == mark)
+					continue;
+				s->query_mark = mark;
+
+				struct extent e;
+				get_stand_extent(s, &e);
+				if (e.row >= rect->row + rect->height
+				    || rect->row >= e.row + e.height
+				    || e.column >= rect->column + rect->width
+				    || rect->column >= e.column + e.width)
+					continue;
+
+				if (found < max)
+					out[found] = s;
+				found++;
+			}
+		}
+	}
+
+	return found;
+}
+
+/* Returns the squared distance from a point to the nearest Tile of a
+ * rectangle; 0 if the point lies inside it.
+ */
+static uint64_t distance2(const struct extent *e, int64_t row,
+                          int64_t column) {
+	int64_t dr = 0, dc = 0;
+	if (row < e->row)
+		dr = e->row - row;
+	else if (row >= e->row + e->height)
+		dr = row - (e->row + e->height - 1);
+	if (column < e->column)
+		dc = e->column - column;
+	else if (column >= e->column + e->width)
+		dc = column - (e->column + e->width - 1);
+	return (uint64_t) (dr * dr) + (uint64_t) (dc * dc);
+}
+
+/* Shared search for nearest_stand and k_nearest_stands.
+ *
+ * Visits rings of buckets around the one holding the query point,
+ * keeping the k closest Stands seen so far in out, sorted by distance.
+ * Every bucket in ring n lies at least (n - 1) bucket widths from the
+ * point, so once the k-th best distance is within that bound, no
+ * further ring can improve on it.
+ *
+ * The distances are kept on the stack for up to NEAREST_STACK_RESULTS
+ * Stands, and on the heap beyond that. Returns 0 if space for them could
+ * not be allocated.
+ */
+static uint32_t nearest_search(grid g, int64_t row, int64_t column,
+                               uint32_t k, stand *out) {
+	spatial_index si = g->index;
+	if (!si || k == 0 || g->num_stands == 0)
+		return 0;
+	if (k > g->num_stands)
+		k = g->num_stands;
+
+	uint64_t stack_best[NEAREST_STACK_RESULTS];
+	uint64_t *best = stack_best;
+	if (k > NEAREST_STACK_RESULTS) {
+		best = malloc(sizeof(uint64_t) * k);
+		if (!best)
+			return 0;
+	}
+	uint32_t found = 0;
+	uint32_t mark = next_mark(si);
+
+	// the bucket holding the point, clamped onto the Grid
+	int64_t center_row = row < 0 ? 0 : row >> SPATIAL_BUCKET_SHIFT;
+	int64_t center_column = column < 0 ? 0 : column >> SPATIAL_BUCKET_SHIFT;
+	if (center_row >= si->rows)
+		center_row = si->rows - 1;
+	if (center_column >= si->columns)
+		center_column = si->columns - 1;
+
+	int64_t max_ring = si->rows > si->columns ? si->rows : si->columns;
+	for (int64_t ring = 0; ring <= max_ring; ring++) {
+		if (found == k && ring > 0) {
+			uint64_t bound = (uint64_t) (ring - 1) * SPATIAL_BUCKET_SIZE;
+			if (best[k - 1] <= bound * bound)
+				break;
+		}
+
+		for (int64_t r = center_row - ring; r <= center_row + ring; r++) {
+			if (r < 0 || r >= si->rows)
+				continue;
+			// interior rows of the ring only have their two ends
+			int64_t step = (r == center_row - ring
+			                || r == center_row + ring) ? 1 : 2 * ring;
+			if (step == 0)
+				step = 1;
+			for (int64_t c = center_column - ring;
+			     c <= center_column + ring; c += step) {
+				if (c < 0 || c >= si->columns)
+					continue;
+				struct bucket *b = si->buckets
+					+ (size_t) r * si->columns + c;
+				for (uint32_t i = 0; i < b->num; i++) {
+					stand s = b->stands[i];
+					if (s->query_mark == mark)
+						continue;
+					s->query_mark = mark;
+
+					struct extent e;
+					get_stand_extent(s, &e);
+					uint64_t d = distance2(&e, row, column);
+					if (found == k && d >= best[k - 1])
+						continue;
+
+					// insertion into the sorted results
+					uint32_t j = found < k ? found++ : k - 1;
+					while (j > 0 && best[j - 1] > d) {
+						best[j] = best[j - 1];
+						out[j] = out[j - 1];
+						j--;
+					}
+					best[j] = d;
+					out[j] = s;
+				}
+			}
+		}
+	}
+
+	if (best != stack_best)
+		free(best);
+	return found;
+}
+
+/* Finds the Stand on Grid g whose bounding box lies closest to the
+ * given point.
+ *
+ * Returns NULL if no Stands are applied to the Grid.
+ */
+stand nearest_stand(grid g, int64_t row, int64_t column) {
+	assert(g);
+
+	stand s;
+	if (!nearest_search(g, row, column, 1, &s))
+		return NULL;
+	return s;
+}
+
+/* Finds the k Stands on Grid g whose bounding boxes lie closest to the
+ * given point, and stores them in out, nearest first.
+ *
+ * Returns the number of Stands stored, which is less than k only if fewer
+ * than k Stands are applied to the Grid, or 0 if space could not be
+ * allocated.
+ */
+uint32_t k_nearest_stands(grid g, int64_t row, int64_t column,
+                          uint32_t k, stand *out) {
+	assert(g);
+	assert(out || k == 0);
+
+	return nearest_search(g, row, column, k, out);
+}
@@ -0,0 +1,47 @@
+/* spatial.h
+ *
+ * Declares the spatial index, which answers region and proximity queries
+ * about the Stands applied to a Grid without touching its Tiles.
+ * 
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ * 
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#include <stdbool.h>
+#include "grid.h"
+#include "stand.h"
+
+// each bucket of the index covers a square of 2^SPATIAL_BUCKET_SHIFT Tiles
+#define SPATIAL_BUCKET_SHIFT 5
+#define SPATIAL_BUCKET_SIZE (1 << SPATIAL_BUCKET_SHIFT)
+
+void del_spatial_index(spatial_index si);
+
+bool spatial_reserve(grid g, const struct extent *e);
+void spatial_insert(grid g, stand s);
+void spatial_remove(grid g, stand s);
+
+uint32_t stands_in_rect(grid g, const struct extent *rect,
+                        stand *out, uint32_t max);
+stand nearest_stand(grid g, int64_t row, int64_t column);
+uint32_t k_nearest_stands(grid g, int64_t row, int64_t column,
+                          uint32_t k, stand *out);
+
+#endif
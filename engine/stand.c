@@ -49,24 +49,279 @@
 #include "global.h"
 #include "grid.h"
 #include "stand.h"
-
-typedef struct application_node {
-	tile t;
-	struct application_node *next;
-} *application_node;
+#include "spatial.h"
+#include "workers.h"
+#include "templib.h"
 
 struct application_data {
 	int64_t row;
 	int64_t column;
 	grid g;
-	struct application_node *head;
 };
 
-static void del_application_list(application_node n);
+/* A batch of Stands being checked by check_stands_fit, one stripe of
+ * rows per worker.
+ */
+struct fit_job {
+	grid g;
+	stand *stands;
+	uint32_t num;
+	bool overlap;   // set by any worker that finds Stands overlapping
+	bool unchecked; // set by any worker that couldn't check its stripe
+};
+
+static void check_stripe(void *job, unsigned worker, unsigned num_workers);
 static void del_application_data(application_data appd);
+static void paint_stand(stand s, stand_like sl);
+static bool same_shape(grid a, grid b);
+static void find_extent(grid g, struct extent *e);
+
+/* Builds the set of distinct orientations of a shape.
+ * 
+ * The base Grid becomes owned by the new set (as grids[0]), and is
+ * destroyed along with it. Each of the other symmetries is produced once
+ * by cloning and transforming the base, then discarded if it matches an
+ * orientation we already have.
+ * 
+ * The new set holds a single reference, belonging to the caller.
+ * 
+ * Returns NULL if space could not be allocated, in which case the base
+ * Grid is left untouched.
+ */
+orientation_set new_orientation_set(grid base) {
+	assert(base);
+
+	orientation_set os = malloc(sizeof(struct orientation_set));
+	if (!os)
+		goto out_os;
+	os->grids[0] = base;
+	find_extent(base, &os->extents[0]);
+	os->num_grids = 1;
+	os->index[0] = 0;
+	os->refs = 1;
+
+	for (uint8_t sym = 1; sym < NUM_SYMMETRIES; sym++) {
+		grid g = clone_grid(base);
+		if (!g)
+			goto out_grids;
+		if (sym >= NUM_SYMMETRIES / 2)
+			mirror_grid(g);
+		for (uint8_t r = 0; r < sym % 4; r++)
+			rotate_grid(g, true);
+
+		uint8_t i;
+		for (i = 0; i < os->num_grids; i++)
+			if (same_shape(os->grids[i], g))
+				break;
+		if (i < os->num_grids) {
+			del_grid(g);
+		} else {
+			os->grids[i] = g;
+			find_extent(g, &os->extents[i]);
+			os->num_grids++;
+		}
+		os->index[sym] = i;
+	}
+
+	return os;
+
+out_grids:;
+	// the base Grid still belongs to the caller
+	for (uint8_t i = 1; i < os->num_grids; i++)
+		del_grid(os->grids[i]);
+	free(os);
+out_os:;
+	return NULL;
+}
+
+/* Builds an orientation set from Grids already in every orientation, such
+ * as the shapes kept in a template library, without rotating anything.
+ * index maps each symmetry onto one of the num_grids Grids, grids[0]
+ * being the base shape. The set takes over the Grids.
+ * 
+ * Returns NULL if space could not be allocated, in which case the Grids
+ * are left untouched.
+ */
+orientation_set assemble_orientation_set(grid *grids, uint8_t num_grids,
+                                         const uint8_t *index) {
+	assert(num_grids > 0 && num_grids <= NUM_SYMMETRIES);
+	assert(index[0] == 0);
+
+	orientation_set os = malloc(sizeof(struct orientation_set));
+	if (!os)
+		return NULL;
+	for (uint8_t i = 0; i < num_grids; i++) {
+		os->grids[i] = grids[i];
+		find_extent(grids[i], &os->extents[i]);
+	}
+	for (uint8_t sym = 0; sym < NUM_SYMMETRIES; sym++) {
+		assert(index[sym] < num_grids);
+		os->index[sym] = index[sym];
+	}
+	os->num_grids = num_grids;
+	os->refs = 1;
+	return os;
+}
+
+/* Takes another reference to an orientation set, for a new owner. */
+orientation_set share_orientation_set(orientation_set os) {
+	assert(os);
+	assert(os->refs > 0);
+
+	// Stands being loaded on a pool of workers share their templates'
+	// sets, so the count is updated atomically
+	__atomic_add_fetch(&os->refs, 1, __ATOMIC_RELAXED);
+	return os;
+}
+
+/* Gives back a reference to an orientation set. Once the last reference
+ * is given back, the set is deallocated, including all of its Grids.
+ */
+void del_orientation_set(orientation_set os) {
+	assert(os);
+	assert(os->refs > 0);
+
+	if (__atomic_sub_fetch(&os->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	for (uint8_t i = 0; i < os->num_grids; i++)
+		del_grid(os->grids[i]);
+	free(os);
+}
+
+/* Finds a symmetry under which an orientation set has the same shape as
+ * the given Grid, so that a Stand of that shape can be described by, or
+ * share, the set instead of its own. Returns false if there is none.
+ */
+bool find_orientation(orientation_set os, grid shape, uint8_t *sym) {
+	assert(os);
+	assert(shape);
+
+	for (uint8_t k = 0; k < NUM_SYMMETRIES; k++) {
+		if (same_shape(os->grids[os->index[k]], shape)) {
+			*sym = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Returns the symmetry reached by rotating the given one 90 degrees. */
+uint8_t rotated_symmetry(uint8_t sym, bool clockwise) {
+	assert(sym < NUM_SYMMETRIES);
+
+	uint8_t mirrored = sym & 4;
+	uint8_t turns = sym % 4;
+	return mirrored | ((turns + (clockwise ? 1 : 3)) % 4);
+}
+
+/* Returns the symmetry reached by mirroring the given one.
+ * 
+ * Mirroring a shape that has been turned k times clockwise is the same as
+ * turning the mirrored shape k times counter-clockwise.
+ */
+uint8_t mirrored_symmetry(uint8_t sym) {
+	assert(sym < NUM_SYMMETRIES);
+
+	uint8_t mirrored = sym & 4;
+	uint8_t turns = sym % 4;
+	return (mirrored ^ 4) | ((4 - turns) % 4);
+}
+
+/* Returns the symmetry reached by turning a shape in symmetry sym the way
+ * symmetry by turns the base shape: mirroring it if by is mirrored, then
+ * rotating it clockwise (by % 4) times.
+ */
+uint8_t transformed_symmetry(uint8_t sym, uint8_t by) {
+	assert(sym < NUM_SYMMETRIES);
+	assert(by < NUM_SYMMETRIES);
+
+	if (by & 4)
+		sym = mirrored_symmetry(sym);
+	for (uint8_t r = 0; r < by % 4; r++)
+		sym = rotated_symmetry(sym, true);
+	return sym;
+}
+
+/* Returns the symmetry that transformed_symmetry turns from into to by.
+ * 
+ * This depends only on how the shape was turned, not on which shape is
+ * the base one, so it still holds for an orientation set rebuilt from any
+ * of the shape's orientations.
+ */
+uint8_t symmetry_between(uint8_t from, uint8_t to) {
+	assert(from < NUM_SYMMETRIES);
+	assert(to < NUM_SYMMETRIES);
+
+	// a mirrored symmetry undoes itself; a rotation is undone by
+	// rotating the other way
+	uint8_t undo = from & 4 ? from : (4 - from % 4) % 4;
+	return transformed_symmetry(undo, to);
+}
+
+/* Finds the bounding box of the occupied Tiles of a Grid. */
+static void find_extent(grid g, struct extent *e) {
+	uint32_t top = g->height, bottom = 0;
+	uint32_t left = g->width, right = 0;
+	for (uint32_t row = 0; row < g->height; row++) {
+		const uint64_t *bits =
+			g->occupancy + (size_t) row * g->occ_stride;
+		for (uint32_t w = 0; w < g->occ_stride; w++) {
+			if (!bits[w])
+				continue;
+			uint32_t first = w * OCC_WORD_BITS
+				+ __builtin_ctzll(bits[w]);
+			uint32_t last = w * OCC_WORD_BITS + OCC_WORD_BITS - 1
+				- __builtin_clzll(bits[w]);
+			if (first < left)
+				left = first;
+			if (last + 1 > right)
+				right = last + 1;
+			if (row < top)
+				top = row;
+			bottom = row + 1;
+		}
+	}
+
+	if (top >= bottom) {
+		// empty shape
+		e->row = e->column = 0;
+		e->height = e->width = 0;
+		return;
+	}
+	e->row = top;
+	e->column = left;
+	e->height = bottom - top;
+	e->width = right - left;
+}
+
+/* Returns true if two Grids have the same dimensions and occupancy. */
+static bool same_shape(grid a, grid b) {
+	if (a->width != b->width || a->height != b->height)
+		return false;
+	return memcmp(a->occupancy, b->occupancy,
+	              sizeof(uint64_t) * a->occ_stride * a->height) == 0;
+}
+
+/* Gives a Stand Template a new name, allocated on the heap, which it takes
+ * over. The old name is deallocated, unless it was borrowed from a
+ * template library.
+ */
+void rename_stand_template(stand_template t, char *name) {
+	assert(t);
+	assert(name);
+
+	if (!t->borrowed_name)
+		free(t->name);
+	t->name = name;
+	t->borrowed_name = false;
+}
 
 stand new_stand(stand_template tem) {
 	assert(tem);
+
+	// a template from a library gets its shape on first use
+	if (!template_orients(tem))
+		goto out_ns;
 	
 	stand ns = malloc(sizeof(struct stand));
 	if (!ns)
@@ -83,15 +338,15 @@ stand new_stand(stand_template tem) {
 	ns->blue = tem->blue;
 	ns->alpha = tem->alpha;
 	ns->appd = NULL;
+	ns->registry_index = STAND_UNREGISTERED;
+	ns->query_mark = 0;
 
-	ns->source = clone_grid(tem->t);
-	if (!ns->source)
-		goto out_source;
+	// the shape is shared with the template, never copied
+	ns->orients = share_orientation_set(tem->orients);
+	set_stand_orientation(ns, 0);
 
 	return ns;
 	
-out_source:;
-	free(ns->name);
 out_name:;
 	free(ns);
 out_ns:;
@@ -107,22 +362,13 @@ void del_stand(stand s) {
 	assert(s);
 	if (s->g)
 		remove_stand(s);
-	del_grid(s->source);
+	del_orientation_set(s->orients);
 	free(s->name);
 	if (s->appd)
 		del_application_data(s->appd);
 	free(s);
 }
 
-/* Frees the memory allocated by an application list. */
-static void del_application_list(application_node n) {
-	while (n) {
-		application_node next = n->next;
-		free(n);
-		n = next;
-	}
-}
-
 /* Frees the memory allocated by application data.
  * 
  * Note: this function does not set the pointer in any owning
@@ -131,7 +377,6 @@ static void del_application_list(application_node n) {
 static void del_application_data(application_data appd) {
 	assert(appd);
 
-	del_application_list(appd->head);
 	free(appd);
 }
 
@@ -154,64 +399,185 @@ bool can_apply(restrict stand s, restrict grid g,
 	assert(s);
 	assert(g);
 	
-	application_node head = NULL;
-	application_node tail = NULL;
-	
-	for (uint32_t cur_row = 0; cur_row < s->source->height; cur_row++) {
-		for (uint32_t cur_column = 0; cur_column < s->source->width;
-		     cur_column++) {
-			tile from = grid_lookup(s->source, cur_row, cur_column);
-			if (!from->stand.stand_stand.s) 
-				// stand does not occupy this tile
+	/* Rather than visiting each Tile, we compare the occupancy planes
+	 * of the source and target Grids a word at a time. Each word of a
+	 * source row covers 64 columns; we pull the matching 64 columns out
+	 * of the target row and test them all with a single AND.
+	 */
+	grid src = s->source;
+	for (uint32_t cur_row = 0; cur_row < src->height; cur_row++) {
+		const uint64_t *src_bits =
+			src->occupancy + (size_t) cur_row * src->occ_stride;
+		int64_t target_row = row + cur_row;
+		bool row_on_grid = target_row >= 0 && target_row < g->height;
+
+		for (uint32_t w = 0; w < src->occ_stride; w++) {
+			uint64_t bits = src_bits[w];
+			if (!bits) 
+				// stand does not occupy these tiles
 				continue;
-			int64_t target_row = row + cur_row;
-			int64_t target_column = column + cur_column;
-			if (target_row < 0 || target_row >= g->height
-			    || target_column < 0 || target_column >= g->width)
-				goto out_fail; // target tile is off the grid
-			tile to = grid_lookup(g, target_row, target_column);
-			if (to->stand.stand_stand.s) // another stand occupies this tile
-				goto out_fail;
-			
-			// stand CAN be applied here
-			if (!head) {
-				head = (application_node)
-					malloc(sizeof(struct application_node));
-				if (!head) // out of mem
-					goto out_fail;
-				tail = head;
-				head->t = to;
-				head->next = NULL;
-			} else {
-				tail->next = (application_node)
-					malloc(sizeof(struct application_node));
-				if (!tail->next) // out of mem
-					goto out_fail;
-				tail = tail->next;
-				tail->t = to;
-				tail->next = NULL;
-			}
+			if (!row_on_grid)
+				return false; // target tiles are off the grid
+
+			int64_t target_column = column + w * OCC_WORD_BITS;
+			if (bits & ~grid_window_mask(g, target_column))
+				return false; // target tiles are off the grid
+			if (bits & grid_row_window(g, target_row, target_column))
+				return false; // another stand occupies these tiles
 		}
 	}
 
-	application_data out =
-		(application_data) malloc(sizeof(struct application_data));
-	if (!out)
-		goto out_fail;
+	// stand CAN be applied here
+	return prepare_apply(s, g, row, column);
+}
 
-	if (s->appd)
-		del_application_data(s->appd);
+/* Prepares the data do_apply needs to apply Stand s onto Grid g at the
+ * specified coordinates, without checking that it fits there.
+ * 
+ * This is the second half of can_apply, for callers which have already
+ * made sure the Stand fits, such as with check_stands_fit. Returns false
+ * if the data can't be generated.
+ */
+bool prepare_apply(restrict stand s, restrict grid g,
+                   int64_t row, int64_t column) {
+	assert(s);
+	assert(g);
 
-	out->row = row;
-	out->column = column;
-	out->head = head;
-	out->g = g;
-	s->appd = out;
+	// make sure do_apply will be able to register and index it
+	grid src = s->source;
+	if (!grid_reserve_stands(g, 1))
+		return false;
+	struct extent e;
+	for (uint8_t i = 0; i < s->orients->num_grids; i++)
+		if (s->orients->grids[i] == src)
+			e = s->orients->extents[i];
+	e.row += row;
+	e.column += column;
+	if (!spatial_reserve(g, &e)
+	    || !grid_reserve_region(g, e.row, e.column, e.height, e.width))
+		return false;
+	if (!s->appd) {
+		s->appd = (application_data)
+			malloc(sizeof(struct application_data));
+		if (!s->appd) // out of mem
+			return false;
+	}
+
+	s->appd->row = row;
+	s->appd->column = column;
+	s->appd->g = g;
 	return true;
+}
 
-	out_fail:
-		del_application_list(head);
+/* Checks that a batch of unapplied Stands, each at its own row and column,
+ * would all fit onto Grid g at once, which must hold no Stands yet. This
+ * is the check can_apply would make for each Stand as they are applied one
+ * by one, done all at once so that it can be split up.
+ * 
+ * The rows of g are divided into stripes, each checked by its own worker
+ * against a private occupancy plane, so the workers share nothing but the
+ * Stands they read. Stands spanning several stripes are checked piecewise.
+ * 
+ * Sets *fit and returns true if the check was made, or returns false if it
+ * couldn't be (g is sparse, or memory ran out), in which case the Stands
+ * should be checked with can_apply instead.
+ */
+bool check_stands_fit(grid g, stand *stands, uint32_t num, bool *fit) {
+	assert(g);
+	assert(g->num_stands == 0);
+	if (grid_is_sparse(g))
 		return false;
+
+	*fit = false;
+	for (uint32_t i = 0; i < num; i++) {
+		stand s = stands[i];
+		if (s->orients->extents[s->orients->index[s->orientation]]
+		    .height == 0)
+			continue; // an empty shape fits anywhere
+		// the bounding box of the occupied Tiles has to lie on the
+		// Grid (coordinates are compared first, so nothing overflows)
+		if (s->row < -(int64_t) g->height || s->row > g->height
+		    || s->column < -(int64_t) g->width || s->column > g->width)
+			return true;
+		struct extent e;
+		get_stand_extent(s, &e);
+		if (e.row < 0 || e.row + e.height > g->height
+		    || e.column < 0 || e.column + e.width > g->width)
+			return true;
+	}
+
+	// a thread is only worth it for a good number of Stands, and every
+	// worker needs some rows
+	unsigned workers = num_workers_for(num, 1024);
+	if (workers > g->height)
+		workers = g->height;
+	struct fit_job job = {g, stands, num, false, false};
+	run_workers(check_stripe, &job, workers);
+	if (job.unchecked)
+		return false;
+	*fit = !job.overlap;
+	return true;
+}
+
+static void check_stripe(void *arg, unsigned worker, unsigned num_workers) {
+	struct fit_job *job = arg;
+	grid g = job->g;
+	int64_t first = (uint64_t) g->height * worker / num_workers;
+	int64_t last = (uint64_t) g->height * (worker + 1) / num_workers;
+	uint32_t stride = g->occ_stride;
+	uint64_t *plane = calloc((size_t) (last - first) * stride,
+	                         sizeof(uint64_t));
+	if (!plane) {
+		__atomic_store_n(&job->unchecked, true, __ATOMIC_RELAXED);
+		return;
+	}
+
+	for (uint32_t i = 0; i < job->num; i++) {
+		if ((i & 255) == 0 && __atomic_load_n(&job->overlap,
+		                                      __ATOMIC_RELAXED))
+			break; // another worker has settled it
+		stand s = job->stands[i];
+		struct extent e;
+		get_stand_extent(s, &e);
+		int64_t from = e.row > first ? e.row : first;
+		int64_t to = e.row + e.height < last ? e.row + e.height : last;
+
+		grid src = s->source;
+		for (int64_t row = from; row < to; row++) {
+			const uint64_t *src_bits = src->occupancy
+				+ (size_t) (row - s->row) * src->occ_stride;
+			uint64_t *bits = plane + (size_t) (row - first) * stride;
+			for (uint32_t w = 0; w < src->occ_stride; w++) {
+				if (!src_bits[w])
+					continue;
+				// the 64 columns of this word straddle two
+				// words of the plane; the extent check made
+				// sure the occupied ones are on the Grid
+				int64_t column = s->column + w * OCC_WORD_BITS;
+				int64_t word = column >= 0
+					? column / OCC_WORD_BITS
+					: -((-column + OCC_WORD_BITS - 1)
+					    / OCC_WORD_BITS);
+				unsigned shift = column - word * OCC_WORD_BITS;
+				uint64_t low = src_bits[w] << shift;
+				uint64_t high = shift ? src_bits[w]
+					>> (OCC_WORD_BITS - shift) : 0;
+				if ((low && (bits[word] & low))
+				    || (high && (bits[word + 1] & high))) {
+					__atomic_store_n(&job->overlap, true,
+					                 __ATOMIC_RELAXED);
+					goto out_plane;
+				}
+				if (low)
+					bits[word] |= low;
+				if (high)
+					bits[word + 1] |= high;
+			}
+		}
+	}
+
+out_plane:;
+	free(plane);
 }
 
 /* Actually applies a Stand onto a Grid.
@@ -230,17 +596,26 @@ void do_apply(stand s) {
 	
 	if (!s->appd)
 		return;
-
-	application_node n = s->appd->head;
-	while (n) {
-		n->t->stand.stand_stand.s = s;
-		n = n->next;
-	}
+	assert(s->registry_index == STAND_UNREGISTERED);
 
 	s->row = s->appd->row;
 	s->column = s->appd->column;
 	s->g = s->appd->g;
 
+	stand_like sl;
+	sl.stand_stand.type = STAND;
+	sl.stand_stand.s = s;
+	paint_stand(s, sl);
+
+	// can_apply has already reserved room in the registry and index
+	s->registry_index = s->g->num_stands;
+	s->g->stands[s->g->num_stands++] = s;
+	spatial_insert(s->g, s);
+
+	struct extent e;
+	get_stand_extent(s, &e);
+	grid_mark_dirty(s->g, e.row, e.column, e.height, e.width);
+
 	del_application_data(s->appd);
 	s->appd = NULL;
 }
@@ -248,6 +623,8 @@ void do_apply(stand s) {
  /* Removes a Stand from the Grid it is applied to,
   * but does not de-allocate its memory.
  * 
+ * Removing a Stand that has already been removed does nothing.
+ * 
  * NOTE: This function does not set the owning grid reference in
  * the Stand to NULL. If the Stand is not to be immediately re-applied
  * to a Grid, the caller should perform this operation to signify to
@@ -255,25 +632,109 @@ void do_apply(stand s) {
  */
 void remove_stand(stand s) {
 	assert(s);
+	if (s->registry_index == STAND_UNREGISTERED)
+		return; // already removed
+
+	// fill the hole in the registry with its last Stand
+	grid g = s->g;
+	stand last = g->stands[--g->num_stands];
+	g->stands[s->registry_index] = last;
+	last->registry_index = s->registry_index;
+	s->registry_index = STAND_UNREGISTERED;
+	spatial_remove(g, s);
+
+	struct extent e;
+	get_stand_extent(s, &e);
+	grid_mark_dirty(g, e.row, e.column, e.height, e.width);
 	
-	// we use the Stand's source dimensions to restrict the
-	// search space on the applied Grid
-	uint32_t end_row = s->row + s->source->height;
-	uint32_t end_column = s->column + s->source->width;
-	for (uint32_t row = s->row; row < end_row; row++) {
-		for (uint32_t column = s->column; column < end_column; column++) {
-			tile t = grid_lookup(s->g, row, column);
-			if (t->stand.stand_stand.s == s)
-				t->stand.stand_stand.s = NULL;
+	stand_like empty;
+	empty.stand_stand.type = STAND;
+	empty.stand_stand.s = NULL;
+	paint_stand(s, empty);
+}
+
+/* Writes the given stand-like into every Tile of the Stand's owning Grid
+ * that its source Grid occupies, at the Stand's current location.
+ *
+ * Only the set bits of the source occupancy plane are visited, so the cost
+ * is proportional to the area of the Stand, not of its bounding box.
+ */
+static void paint_stand(stand s, stand_like sl) {
+	grid src = s->source;
+	for (uint32_t row = 0; row < src->height; row++) {
+		const uint64_t *bits =
+			src->occupancy + (size_t) row * src->occ_stride;
+		for (uint32_t w = 0; w < src->occ_stride; w++) {
+			uint64_t word = bits[w];
+			while (word) {
+				uint32_t column = w * OCC_WORD_BITS
+					+ __builtin_ctzll(word);
+				word &= word - 1;
+				grid_set_stand(s->g, s->row + row,
+				               s->column + column, sl);
+			}
 		}
 	}
 }
 
+/* Switches a Stand to another of its orientations.
+ * 
+ * The Stand must not be applied to a Grid while its orientation changes.
+ */
+void set_stand_orientation(stand s, uint8_t sym) {
+	assert(s);
+	assert(sym < NUM_SYMMETRIES);
+
+	s->orientation = sym;
+	s->source = s->orients->grids[s->orients->index[sym]];
+}
+
+/* Finds the bounding box of the Tiles a Stand occupies on its Grid, in
+ * its current orientation and at its current location.
+ */
+void get_stand_extent(stand s, struct extent *e) {
+	assert(s);
+
+	*e = s->orients->extents[s->orients->index[s->orientation]];
+	e->row += s->row;
+	e->column += s->column;
+}
+
+/* Checks which orientations of a Stand fit onto Grid g at the specified
+ * coordinates, in one pass over its distinct orientations.
+ * 
+ * Returns a mask with bit k set if symmetry k fits. The Stand itself is
+ * left in its current orientation, but any application data prepared by a
+ * previous call to can_apply is discarded.
+ */
+uint8_t fitting_orientations(stand s, grid g, int64_t row, int64_t column) {
+	assert(s);
+	assert(g);
+
+	uint8_t sym = s->orientation;
+	uint8_t distinct = 0;
+	for (uint8_t i = 0; i < s->orients->num_grids; i++) {
+		s->source = s->orients->grids[i];
+		if (can_apply(s, g, row, column))
+			distinct |= 1 << i;
+	}
+	set_stand_orientation(s, sym);
+	if (s->appd) {
+		del_application_data(s->appd);
+		s->appd = NULL;
+	}
+
+	uint8_t fits = 0;
+	for (uint8_t k = 0; k < NUM_SYMMETRIES; k++)
+		if (distinct & (1 << s->orients->index[k]))
+			fits |= 1 << k;
+	return fits;
+}
+
 /* Rotates a Stand applied to a Grid.
  * 
- * The Stand is rotated about its approximate center. To be exact, the source
- * grid of the Stand is rotated, then the Stand is re-checked for applicability
- * at the same point it was previously applied.
+ * The Stand keeps the same origin on the Grid, and switches to the next
+ * of its precomputed orientations in the specified direction.
  * 
  * The rotation is 90 degrees in the specified direction if no problems occur.
  * However, if the Stand cannot be re-applied to the Grid in its
@@ -288,30 +749,37 @@ void rotate_stand(stand s, bool clockwise) {
 	assert(s);
 
 	remove_stand(s);
+	uint8_t fits = fitting_orientations(s, s->g, s->row, s->column);
+	uint8_t sym = s->orientation;
 	do {
-		rotate_grid(s->source, clockwise);
-	} while (!can_apply(s, s->g, s->row, s->column));
+		sym = rotated_symmetry(sym, clockwise);
+	} while (!(fits & (1 << sym)) && sym != s->orientation);
 
+	set_stand_orientation(s, sym);
+	can_apply(s, s->g, s->row, s->column);
 	do_apply(s);
 }
 
 
 /* Mirrors a Stand applied to a Grid.
  * 
- * This is achieved by removing the Stand from the Grid, mirroring its
- * source Grid, and attempting to re-apply it.
+ * This is achieved by removing the Stand from the Grid, switching to its
+ * mirrored orientation, and attempting to re-apply it.
  * 
- * If this fails for any reason, the source Grid is re-mirrored back to
- * its original state, and the Stand is applied, leaving the applied Grid
- * exactly as it was before this function was called.
+ * If this fails for any reason, the Stand is re-applied in its original
+ * orientation, leaving the applied Grid exactly as it was before this
+ * function was called.
  */
 void mirror_stand(stand s) {
 	assert(s);
 
 	remove_stand(s);
-	do {
-		mirror_grid(s->source);
-	} while (!can_apply(s, s->g, s->row, s->column));
+	uint8_t sym = s->orientation;
+	set_stand_orientation(s, mirrored_symmetry(sym));
+	if (!can_apply(s, s->g, s->row, s->column)) {
+		set_stand_orientation(s, sym);
+		can_apply(s, s->g, s->row, s->column);
+	}
 
 	do_apply(s);
 }
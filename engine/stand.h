@@ -29,9 +29,41 @@
 #include "grid.h"
 
 typedef struct application_data *application_data;
+typedef struct orientation_set *orientation_set;
+typedef struct template_library *template_library;
+
+/* A shape can be rotated four ways and mirrored, giving eight symmetries.
+ * Symmetry k is the base shape mirrored if k >= 4, then rotated clockwise
+ * (k % 4) times.
+ */
+#define NUM_SYMMETRIES 8
+
+/* The distinct orientations of a shape, computed once up front so that
+ * rotating or mirroring a Stand only has to pick a different Grid.
+ * 
+ * Symmetric shapes have fewer than eight distinct orientations; index maps
+ * every symmetry onto the Grid that represents it. grids[0] is always the
+ * base shape.
+ * 
+ * Orientation sets are immutable once built, and are shared by a Stand
+ * Template and every Stand made from it. They are reference counted: each
+ * owner takes a reference with share_orientation_set and gives it back with
+ * del_orientation_set.
+ */
+struct orientation_set {
+	grid grids[NUM_SYMMETRIES];
+	// bounding box of the occupied Tiles of each Grid, relative to
+	// that Grid's origin
+	struct extent extents[NUM_SYMMETRIES];
+	uint8_t num_grids;
+	uint8_t index[NUM_SYMMETRIES];
+	uint32_t refs;
+};
 
 struct stand_template {
+	// base orientation, owned by orients
 	grid t;
+	orientation_set orients;
 
 	char *name;
 
@@ -40,11 +72,21 @@ struct stand_template {
 	double green;
 	double blue;
 	double alpha;
+
+	// A template from a template library (see templib.h) has no shape
+	// until template_orients builds it, and borrows its name from the
+	// library until it is renamed.
+	template_library lib;
+	uint32_t lib_entry;
+	bool borrowed_name;
 };
 
 struct stand {
 	// basic info
+	// source is the Grid of the current orientation, owned by orients
 	grid source;
+	orientation_set orients;
+	uint8_t orientation;
 	char *name;
 
 	// owning grid & location info
@@ -63,8 +105,29 @@ struct stand {
 
 	// applicable data, added by can_apply and removed by do_apply
 	application_data appd;
+
+	// position in the registry of g, or STAND_UNREGISTERED
+	uint32_t registry_index;
+
+	// scratch mark used by spatial queries to report each Stand once
+	uint32_t query_mark;
 };
 
+#define STAND_UNREGISTERED UINT32_MAX
+
+orientation_set new_orientation_set(grid base);
+orientation_set assemble_orientation_set(grid *grids, uint8_t num_grids,
+                                         const uint8_t *index);
+orientation_set share_orientation_set(orientation_set os);
+void del_orientation_set(orientation_set os);
+bool find_orientation(orientation_set os, grid shape, uint8_t *sym);
+uint8_t rotated_symmetry(uint8_t sym, bool clockwise);
+uint8_t mirrored_symmetry(uint8_t sym);
+uint8_t transformed_symmetry(uint8_t sym, uint8_t by);
+uint8_t symmetry_between(uint8_t from, uint8_t to);
+
+void rename_stand_template(stand_template t, char *name);
+
 stand new_stand(stand_template t);
 
 void del_stand(stand s);
@@ -72,7 +135,13 @@ void del_stand(stand s);
 void do_apply(stand s);
 bool can_apply(restrict stand s, restrict grid g,
                int64_t row, int64_t column);
+bool prepare_apply(restrict stand s, restrict grid g,
+                   int64_t row, int64_t column);
+bool check_stands_fit(grid g, stand *stands, uint32_t num, bool *fit);
 
+void set_stand_orientation(stand s, uint8_t sym);
+void get_stand_extent(stand s, struct extent *e);
+uint8_t fitting_orientations(stand s, grid g, int64_t row, int64_t column);
 void rotate_stand(stand s, bool clockwise);
 void mirror_stand(stand s);
 void remove_stand(stand s);
@@ -0,0 +1,371 @@
+/* templib.c
+ *
+ * This file contains definitions for template libraries.
+ *
+ * Engines that render many maps from the same catalogue of Stand
+ * Templates would otherwise each parse their own copy of it. A library is
+ * the catalogue compiled once into a read-only file that every engine maps
+ * and uses in place, so the pages are shared by all of them: names are
+ * used straight from the mapping, colours are single bytes, and the shape
+ * of every template is stored in all of its orientations as packed
+ * occupancy words, so building one takes no parsing or rotating. Shapes
+ * are only built once a Stand is made from them (see template_orients).
+ *
+ * All integers are little-endian, and every offset is from the start of
+ * the file.
+ *
+ *   header  "MMGL" version:u32 count:u32 reserved:u32
+ *   then count entries of ENTRY_BYTES bytes:
+ *           name:u32 name_len:u32 red:u8 green:u8 blue:u8 alpha:u8
+ *           shapes:u32 num_grids:u8 index:u8[8], padded with zeroes
+ *   then the names, each followed by a NUL
+ *   then the shapes, starting on a multiple of 8 bytes
+ *
+ * index maps each symmetry onto one of the entry's num_grids Grids, which
+ * are stored one after another from shapes, the base shape first. Each is
+ * width:u32 height:u32, then height rows of (width + 63) / 64 words of 64
+ * bits, bit i of word w being the Tile in column (w * 64 + i), as in the
+ * occupancy plane of a Grid.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "save_n_load.h"
+#include "templib.h"
+
+#define LIBRARY_VERSION 1
+#define HEADER_BYTES 16
+#define ENTRY_BYTES  32
+
+// where the fields of an entry are
+#define ENTRY_NAME      0
+#define ENTRY_NAME_LEN  4
+#define ENTRY_COLOR     8
+#define ENTRY_SHAPES    12
+#define ENTRY_NUM_GRIDS 16
+#define ENTRY_INDEX     17
+
+static void put_le(uint8_t *p, uint64_t v, int bytes);
+static uint64_t get_le(const uint8_t *p, int bytes);
+static uint64_t shape_bytes(grid g);
+static bool write_shape(FILE *f, grid g);
+static const uint8_t *library_entry(template_library lib, uint32_t i);
+static bool check_entry(template_library lib, const uint8_t *e);
+static grid read_shape(const uint8_t **p, const uint8_t *end,
+                       stand_template t);
+
+/* Compiles an array of Stand Templates into a template library.
+ *
+ * Returns false if the library couldn't be written, or would be too big
+ * for its 32-bit offsets.
+ */
+bool save_template_library(FILE *f, struct stand_template *st, int32_t num) {
+	assert(num >= 0);
+
+	// the names and shapes come after the entries, so their sizes are
+	// totted up first
+	uint64_t names_at = HEADER_BYTES + (uint64_t) num * ENTRY_BYTES;
+	uint64_t shapes_at = names_at;
+	for (int32_t i = 0; i < num; i++) {
+		if (!template_orients(st + i))
+			return false;
+		shapes_at += strlen(st[i].name) + 1;
+	}
+	shapes_at = (shapes_at + 7) & ~(uint64_t) 7;
+	uint64_t end = shapes_at;
+	for (int32_t i = 0; i < num; i++) {
+		orientation_set os = st[i].orients;
+		for (uint8_t g = 0; g < os->num_grids; g++)
+			end += shape_bytes(os->grids[g]);
+	}
+	if (end > UINT32_MAX)
+		return false;
+
+	uint8_t header[HEADER_BYTES] = {'M', 'M', 'G', 'L'};
+	put_le(header + 4, LIBRARY_VERSION, 4);
+	put_le(header + 8, num, 4);
+	if (fwrite(header, 1, HEADER_BYTES, f) != HEADER_BYTES)
+		return false;
+
+	uint64_t name_at = names_at;
+	uint64_t shape_at = shapes_at;
+	for (int32_t i = 0; i < num; i++) {
+		stand_template t = st + i;
+		uint8_t e[ENTRY_BYTES] = {0};
+		size_t name_len = strlen(t->name);
+		put_le(e + ENTRY_NAME, name_at, 4);
+		put_le(e + ENTRY_NAME_LEN, name_len, 4);
+		e[ENTRY_COLOR] = (uint8_t) (t->red * 255.0);
+		e[ENTRY_COLOR + 1] = (uint8_t) (t->green * 255.0);
+		e[ENTRY_COLOR + 2] = (uint8_t) (t->blue * 255.0);
+		e[ENTRY_COLOR + 3] = (uint8_t) (t->alpha * 255.0);
+		put_le(e + ENTRY_SHAPES, shape_at, 4);
+		e[ENTRY_NUM_GRIDS] = t->orients->num_grids;
+		memcpy(e + ENTRY_INDEX, t->orients->index, NUM_SYMMETRIES);
+		if (fwrite(e, 1, ENTRY_BYTES, f) != ENTRY_BYTES)
+			return false;
+
+		name_at += name_len + 1;
+		for (uint8_t g = 0; g < t->orients->num_grids; g++)
+			shape_at += shape_bytes(t->orients->grids[g]);
+	}
+
+	for (int32_t i = 0; i < num; i++)
+		if (fwrite(st[i].name, 1, strlen(st[i].name) + 1, f)
+		    != strlen(st[i].name) + 1)
+			return false;
+	static const uint8_t zeroes[8];
+	if (fwrite(zeroes, 1, shapes_at - name_at, f) != shapes_at - name_at)
+		return false;
+
+	for (int32_t i = 0; i < num; i++) {
+		orientation_set os = st[i].orients;
+		for (uint8_t g = 0; g < os->num_grids; g++)
+			if (!write_shape(f, os->grids[g]))
+				return false;
+	}
+	return true;
+}
+
+/* Opens a template library for use, checking its entries (but not yet
+ * its shapes) as it goes. Returns NULL if the file can't be read or isn't
+ * a library.
+ */
+template_library open_template_library(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		goto out_file;
+	template_library lib = malloc(sizeof(struct template_library));
+	if (!lib)
+		goto out_lib;
+	// the mapping outlives the stream it was made from
+	if (!open_view(f, &lib->view))
+		goto out_view;
+	lib->data = (const uint8_t *) lib->view.data;
+	lib->len = lib->view.len;
+
+	if (lib->len < HEADER_BYTES || memcmp(lib->data, "MMGL", 4) != 0
+	    || get_le(lib->data + 4, 4) != LIBRARY_VERSION)
+		goto out_bad;
+	lib->num_templates = get_le(lib->data + 8, 4);
+	if (lib->num_templates > INT32_MAX
+	    || lib->num_templates > (lib->len - HEADER_BYTES) / ENTRY_BYTES)
+		goto out_bad;
+	for (uint32_t i = 0; i < lib->num_templates; i++)
+		if (!check_entry(lib, library_entry(lib, i)))
+			goto out_bad;
+
+	fclose(f);
+	return lib;
+
+out_bad:;
+	close_view(&lib->view);
+out_view:;
+	free(lib);
+out_lib:;
+	fclose(f);
+out_file:;
+	return NULL;
+}
+
+/* Closes a template library. No template made from it may be left. */
+void del_template_library(template_library lib) {
+	assert(lib);
+
+	close_view(&lib->view);
+	free(lib);
+}
+
+/* Makes an array of the Stand Templates in a library, to be deallocated
+ * with del_stand_templates. Only the array itself is allocated: names are
+ * borrowed from the library, and shapes are built on first use.
+ *
+ * Returns NULL if space could not be allocated.
+ */
+struct stand_template *new_library_templates(template_library lib) {
+	assert(lib);
+
+	struct stand_template *st = calloc(lib->num_templates ?
+	                                   lib->num_templates : 1,
+	                                   sizeof(struct stand_template));
+	if (!st)
+		return NULL;
+	for (uint32_t i = 0; i < lib->num_templates; i++) {
+		const uint8_t *e = library_entry(lib, i);
+		stand_template t = st + i;
+		t->name = (char *) lib->data + get_le(e + ENTRY_NAME, 4);
+		t->borrowed_name = true;
+		t->red = e[ENTRY_COLOR] / 255.0;
+		t->green = e[ENTRY_COLOR + 1] / 255.0;
+		t->blue = e[ENTRY_COLOR + 2] / 255.0;
+		t->alpha = e[ENTRY_COLOR + 3] / 255.0;
+		t->lib = lib;
+		t->lib_entry = i;
+	}
+	return st;
+}
+
+/* Returns the orientation set of a Stand Template, first building it from
+ * its library if it comes from one and hasn't been used yet.
+ *
+ * Returns NULL if the shape could not be built: there wasn't enough
+ * memory, or the library is damaged.
+ */
+orientation_set template_orients(stand_template t) {
+	assert(t);
+
+	if (t->orients || !t->lib)
+		return t->orients;
+
+	template_library lib = t->lib;
+	const uint8_t *e = library_entry(lib, t->lib_entry);
+	const uint8_t *p = lib->data + get_le(e + ENTRY_SHAPES, 4);
+	uint8_t num_grids = e[ENTRY_NUM_GRIDS];
+	grid grids[NUM_SYMMETRIES];
+	uint8_t built;
+	for (built = 0; built < num_grids; built++) {
+		grids[built] = read_shape(&p, lib->data + lib->len, t);
+		if (!grids[built])
+			goto out_grids;
+	}
+	orientation_set os = assemble_orientation_set(grids, num_grids,
+	                                              e + ENTRY_INDEX);
+	if (!os)
+		goto out_grids;
+
+	t->orients = os;
+	t->t = os->grids[0];
+	return os;
+
+out_grids:;
+	while (built-- > 0)
+		del_grid(grids[built]);
+	return NULL;
+}
+
+static void put_le(uint8_t *p, uint64_t v, int bytes) {
+	for (int i = 0; i < bytes; i++)
+		p[i] = v >> (8 * i);
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes) {
+	uint64_t v = 0;
+	for (int i = 0; i < bytes; i++)
+		v |= (uint64_t) p[i] << (8 * i);
+	return v;
+}
+
+/* Returns the number of bytes a shape takes in a library. */
+static uint64_t shape_bytes(grid g) {
+	uint64_t words = (g->width + OCC_WORD_BITS - 1) / OCC_WORD_BITS;
+	return 8 + 8 * words * g->height;
+}
+
+static bool write_shape(FILE *f, grid g) {
+	uint8_t buf[8];
+	put_le(buf, g->width, 4);
+	put_le(buf + 4, g->height, 4);
+	if (fwrite(buf, 1, 8, f) != 8)
+		return false;
+	for (uint32_t row = 0; row < g->height; row++) {
+		for (uint32_t column = 0; column < g->width;
+		     column += OCC_WORD_BITS) {
+			put_le(buf, grid_row_window(g, row, column), 8);
+			if (fwrite(buf, 1, 8, f) != 8)
+				return false;
+		}
+	}
+	return true;
+}
+
+static const uint8_t *library_entry(template_library lib, uint32_t i) {
+	return lib->data + HEADER_BYTES + (size_t) i * ENTRY_BYTES;
+}
+
+/* Returns true if an entry's name and orientations make sense, and its
+ * shapes at least start within the file.
+ */
+static bool check_entry(template_library lib, const uint8_t *e) {
+	uint64_t name = get_le(e + ENTRY_NAME, 4);
+	uint64_t name_len = get_le(e + ENTRY_NAME_LEN, 4);
+	if (name + name_len >= lib->len || lib->data[name + name_len] != '\0')
+		return false;
+
+	uint8_t num_grids = e[ENTRY_NUM_GRIDS];
+	if (num_grids < 1 || num_grids > NUM_SYMMETRIES
+	    || e[ENTRY_INDEX] != 0)
+		return false;
+	for (uint8_t sym = 0; sym < NUM_SYMMETRIES; sym++)
+		if (e[ENTRY_INDEX + sym] >= num_grids)
+			return false;
+
+	uint64_t shapes = get_le(e + ENTRY_SHAPES, 4);
+	return shapes % 8 == 0 && shapes < lib->len;
+}
+
+/* Builds one of the stored shapes of a Stand Template, whose occupied
+ * Tiles hold the template, and moves p past it. Returns NULL if it runs
+ * past end or doesn't make sense, or space could not be allocated.
+ */
+static grid read_shape(const uint8_t **p, const uint8_t *end,
+                       stand_template t) {
+	if (end - *p < 8)
+		return NULL;
+	uint32_t width = get_le(*p, 4);
+	uint32_t height = get_le(*p + 4, 4);
+	*p += 8;
+	uint64_t words = (width + OCC_WORD_BITS - 1) / OCC_WORD_BITS;
+	if (width == 0 || height == 0
+	    || (uint64_t) width * height > SPARSE_GRID_MIN_TILES
+	    || (uint64_t) (end - *p) / 8 / words < height)
+		return NULL;
+
+	grid g = new_grid(width, height);
+	if (!g)
+		return NULL;
+	stand_like tl;
+	tl.stand_proto.type = STAND_TEMPLATE;
+	tl.stand_st.st = t;
+	for (uint32_t row = 0; row < height; row++) {
+		for (uint64_t w = 0; w < words; w++) {
+			uint64_t bits = get_le(*p, 8);
+			*p += 8;
+			// bits past the last column must be clear
+			uint32_t left = width - w * OCC_WORD_BITS;
+			if (left < OCC_WORD_BITS && bits >> left) {
+				del_grid(g);
+				return NULL;
+			}
+			while (bits) {
+				grid_set_stand(g, row, w * OCC_WORD_BITS
+				               + __builtin_ctzll(bits), tl);
+				bits &= bits - 1;
+			}
+		}
+	}
+	return g;
+}
@@ -0,0 +1,54 @@
+/* templib.h
+ *
+ * This file contains declarations for template libraries: compiled,
+ * read-only catalogues of Stand Templates that are mapped into memory and
+ * used in place.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPLIB_H
+#define TEMPLIB_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stand.h"
+#include "save_n_load.h"
+
+#define TEMPLATE_LIBRARY_EXTENSION ".mmgl"
+
+/* An open template library. The file stays mapped for as long as the
+ * library is open, and the templates made from it borrow from it, so it
+ * must outlive them.
+ */
+struct template_library {
+	struct file_view view;
+	const uint8_t *data;
+	size_t len;
+	uint32_t num_templates;
+};
+
+bool save_template_library(FILE *f, struct stand_template *st, int32_t num);
+template_library open_template_library(const char *path);
+void del_template_library(template_library lib);
+struct stand_template *new_library_templates(template_library lib);
+orientation_set template_orients(stand_template t);
+
+#endif
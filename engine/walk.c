@@ -0,0 +1,583 @@
+/* walk.c
+ *
+ * This file contains definitions for working out where shoppers can walk
+ * on a Grid: which Stands they can get to from the entrances and how far
+ * they have to go, which parts of the floor they can never get to, and
+ * where the aisles they walk down are too narrow.
+ *
+ * Shoppers walk over empty Tiles, a step at a time up, down, left or right.
+ * The walk is a search over the occupancy plane, done a word at a time.
+ * The frontier is a list of the words it has bits in, so each round only
+ * visits the words the frontier touches: every bit of a word moves at
+ * once, with the bits carried into the neighbouring words, and the words
+ * above and below take the same bits unshifted. A word can be listed more
+ * than once, with different bits, which is cheaper than merging the
+ * entries through a plane that wouldn't stay in the cache.
+ *
+ * Just finding the floor is a flood fill: whenever the search moves onto a
+ * word, it also takes the whole of each stretch of empty Tiles it landed
+ * in, so it only comes back to a word for another stretch, and a map takes
+ * a few passes' worth of work. Measuring distances needs a breadth-first
+ * search instead, a Tile per round, so that the first round to touch a
+ * Stand gives its distance. A wave crossing a word sideways then moves one
+ * bit of it per round, so that costs time in proportion to the floor area,
+ * and is only done when asked for.
+ *
+ * While measuring, the search looks up the Stand of the first occupied
+ * Tile it runs into, and marks all of that Stand as visited, so that the
+ * rest of its Tiles are never looked up. Otherwise the search leaves the
+ * Stands alone, and each Stand in the registry is checked afterwards
+ * against the reached floor, grown by a Tile in each direction.
+ *
+ * The floor that no entrance reaches is then split into pockets with the
+ * same search, started from each Tile that is still unvisited. An aisle
+ * is too narrow where no square min_aisle Tiles wide fits over a reached
+ * Tile, which is found by eroding the empty Tiles with the square and
+ * dilating the result again, a whole plane at a time.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "walk.h"
+
+/* Some of the Tiles of one word of a plane. */
+struct cell {
+	uint32_t row;
+	uint32_t w;
+	uint64_t bits;
+};
+
+/* A search over the empty Tiles of a Grid. */
+struct search {
+	grid g;
+	uint32_t stride;
+	// the valid bits of the last word of each row
+	uint64_t last_mask;
+
+	// every Tile found so far, empty or occupied
+	uint64_t *seen;
+	// the empty Tiles found by the last step, and by the step being
+	// taken
+	struct cell *front;
+	struct cell *next;
+	size_t num_front;
+	size_t num_next;
+	size_t front_cap;
+	size_t next_cap;
+	// set if the next frontier couldn't grow
+	bool failed;
+
+	// whether each round takes one step, rather than as many as it can
+	// along a row
+	bool layered;
+	// the number of rounds taken
+	uint32_t steps;
+
+	// if set, the distance of each Stand the search runs into, which
+	// the search must be layered to measure
+	uint32_t *distance;
+	uint32_t num_unreachable;
+
+	// the empty Tiles found, and their bounding box
+	uint64_t found;
+	int64_t top, bottom, left, right;
+};
+
+static void start_search(struct search *sr);
+static void add_seed(struct search *sr, uint32_t row, uint32_t column);
+static void run_search(struct search *sr);
+static void visit(struct search *sr, uint32_t row, uint32_t w,
+                  uint64_t bits);
+static uint64_t fill_stretches(uint64_t bits, uint64_t open);
+static void mark_stand(struct search *sr, stand s);
+static uint32_t find_touched(struct search *sr, const uint64_t *reached,
+                             uint32_t *distance);
+static bool find_pockets(struct search *sr, struct walk_result *out);
+static void find_narrow(grid g, uint32_t min_aisle, uint64_t *plane,
+                        const uint64_t *reached);
+
+/* Works out where shoppers coming in by the given entrances can walk on
+ * Grid g, and fills in out. Entrances that are off the Grid or occupied
+ * are ignored.
+ *
+ * The distance to each reachable Stand is only measured if measure is
+ * set; otherwise it is given as WALK_UNMEASURED.
+ *
+ * If min_aisle is more than 1, the reached Tiles that an aisle that many
+ * Tiles wide can't pass over are found as well; it may be at most
+ * WALK_MAX_AISLE.
+ *
+ * Returns false if space could not be allocated. Otherwise the result
+ * must be freed with free_walk_result.
+ */
+bool analyze_walk(grid g, const struct walk_entrance *entrances,
+                  uint32_t num_entrances, uint32_t min_aisle,
+                  bool measure, struct walk_result *out) {
+	assert(g);
+	assert(entrances || num_entrances == 0);
+	assert(min_aisle <= WALK_MAX_AISLE);
+
+	memset(out, 0, sizeof(struct walk_result));
+	size_t words = (size_t) g->height * g->occ_stride;
+	size_t plane_bytes = sizeof(uint64_t) * (words ? words : 1);
+	struct search sr = {.g = g, .stride = g->occ_stride};
+	sr.last_mask = g->width % OCC_WORD_BITS
+		? ((uint64_t) 1 << g->width % OCC_WORD_BITS) - 1 : ~(uint64_t) 0;
+	sr.seen = calloc(1, plane_bytes);
+	out->num_stands = g->num_stands;
+	out->distance = malloc(sizeof(uint32_t)
+	                       * (g->num_stands ? g->num_stands : 1));
+	out->reached = malloc(plane_bytes);
+	if (!sr.seen || !out->distance || !out->reached)
+		goto out_fail;
+
+	// walk from the entrances, measuring the way to each Stand if asked
+	for (uint32_t i = 0; i < g->num_stands; i++)
+		out->distance[i] = WALK_UNREACHABLE;
+	sr.distance = measure ? out->distance : NULL;
+	sr.num_unreachable = g->num_stands;
+	sr.layered = measure;
+	start_search(&sr);
+	for (uint32_t i = 0; i < num_entrances; i++) {
+		const struct walk_entrance *en = &entrances[i];
+		if (en->row >= 0 && en->row < g->height
+		    && en->column >= 0 && en->column < g->width
+		    && !grid_occupied(g, en->row, en->column))
+			add_seed(&sr, en->row, en->column);
+	}
+	run_search(&sr);
+	if (sr.failed)
+		goto out_fail;
+	out->num_reached = sr.found;
+	for (size_t i = 0; i < words; i++)
+		out->reached[i] = sr.seen[i] & ~g->occupancy[i];
+	if (!measure)
+		sr.num_unreachable = find_touched(&sr, out->reached,
+		                                  out->distance);
+	out->num_unreachable = sr.num_unreachable;
+
+	// then split up whatever floor is left
+	sr.distance = NULL;
+	sr.layered = false;
+	if (!find_pockets(&sr, out))
+		goto out_fail;
+
+	if (min_aisle > 1) {
+		out->narrow = malloc(plane_bytes);
+		if (!out->narrow)
+			goto out_fail;
+		find_narrow(g, min_aisle, out->narrow, out->reached);
+		for (size_t i = 0; i < words; i++)
+			out->num_narrow += __builtin_popcountll(out->narrow[i]);
+	}
+
+	free(sr.next);
+	free(sr.front);
+	free(sr.seen);
+	return true;
+
+out_fail:;
+	free(sr.next);
+	free(sr.front);
+	free(sr.seen);
+	free_walk_result(out);
+	return false;
+}
+
+/* Frees what analyze_walk allocated for a result. */
+void free_walk_result(struct walk_result *r) {
+	free(r->reached);
+	free(r->distance);
+	free(r->pockets);
+	free(r->narrow);
+	memset(r, 0, sizeof(struct walk_result));
+}
+
+/* Gets a search ready to start from a new set of seeds. */
+static void start_search(struct search *sr) {
+	sr->num_front = 0;
+	sr->num_next = 0;
+	sr->steps = 0;
+	sr->found = 0;
+	sr->top = sr->left = INT64_MAX;
+	sr->bottom = sr->right = -1;
+}
+
+/* Adds an empty Tile to the frontier a search starts from. */
+static void add_seed(struct search *sr, uint32_t row, uint32_t column) {
+	uint32_t w = column / OCC_WORD_BITS;
+	uint64_t bit = (uint64_t) 1 << column % OCC_WORD_BITS;
+	visit(sr, row, w, bit);
+}
+
+/* Takes rounds until there is nowhere new to go. Seeds are added as the
+ * first round's finds, so they end up in the first frontier here.
+ */
+static void run_search(struct search *sr) {
+	uint32_t height = sr->g->height;
+	uint32_t stride = sr->stride;
+	while (sr->num_next > 0 && !sr->failed) {
+		// the last step's finds are the frontier of this one
+		struct cell *list = sr->front;
+		sr->front = sr->next;
+		sr->next = list;
+		size_t cap = sr->front_cap;
+		sr->front_cap = sr->next_cap;
+		sr->next_cap = cap;
+		sr->num_front = sr->num_next;
+		sr->num_next = 0;
+
+		for (size_t i = 0; i < sr->num_front; i++) {
+			uint32_t row = sr->front[i].row;
+			uint32_t w = sr->front[i].w;
+			uint64_t bits = sr->front[i].bits;
+
+			visit(sr, row, w, bits << 1 | bits >> 1);
+			if (w > 0 && (bits & 1))
+				visit(sr, row, w - 1,
+				      (uint64_t) 1 << (OCC_WORD_BITS - 1));
+			if (w + 1 < stride && (bits >> (OCC_WORD_BITS - 1)))
+				visit(sr, row, w + 1, 1);
+			if (row > 0)
+				visit(sr, row - 1, w, bits);
+			if (row + 1 < height)
+				visit(sr, row + 1, w, bits);
+		}
+		sr->steps++;
+	}
+}
+
+/* Moves onto the given Tiles of one word, those that haven't been visited
+ * yet: empty ones join the next frontier, along with the rest of their
+ * stretches unless the search is layered, and occupied ones give the
+ * distance of their Stands.
+ */
+static void visit(struct search *sr, uint32_t row, uint32_t w,
+                  uint64_t bits) {
+	size_t index = (size_t) row * sr->stride + w;
+	bits &= ~sr->seen[index];
+	if (w == sr->stride - 1)
+		bits &= sr->last_mask;
+	if (!bits)
+		return;
+
+	grid g = sr->g;
+	uint64_t occupied = bits & g->occupancy[index];
+	if (occupied && sr->distance) {
+		// a Stand is marked as a whole once found, so each of these
+		// Tiles belongs to one that hasn't been yet
+		do {
+			uint32_t column = w * OCC_WORD_BITS
+				+ __builtin_ctzll(occupied);
+			sr->seen[index] |= occupied & -occupied;
+			stand s = grid_lookup(g, row, column)
+				->stand.stand_stand.s;
+			if (s && sr->distance[s->registry_index]
+			         == WALK_UNREACHABLE) {
+				sr->distance[s->registry_index] = sr->layered
+					? sr->steps : WALK_UNMEASURED;
+				sr->num_unreachable--;
+				mark_stand(sr, s);
+			}
+			occupied &= ~sr->seen[index];
+		} while (occupied);
+	}
+
+	uint64_t empty = bits & ~g->occupancy[index];
+	if (!empty)
+		return;
+	if (!sr->layered) {
+		uint64_t open = ~g->occupancy[index] & ~sr->seen[index];
+		if (w == sr->stride - 1)
+			open &= sr->last_mask;
+		empty = fill_stretches(empty, open);
+	}
+	sr->seen[index] |= empty;
+	sr->found += __builtin_popcountll(empty);
+	if (row < sr->top)
+		sr->top = row;
+	if (row > sr->bottom)
+		sr->bottom = row;
+	int64_t first = w * OCC_WORD_BITS + __builtin_ctzll(empty);
+	int64_t last = w * OCC_WORD_BITS + OCC_WORD_BITS - 1
+		- __builtin_clzll(empty);
+	if (first < sr->left)
+		sr->left = first;
+	if (last > sr->right)
+		sr->right = last;
+
+	if (sr->num_next == sr->next_cap) {
+		size_t new_cap = sr->next_cap ? sr->next_cap * 2 : 1024;
+		struct cell *list = realloc(sr->next,
+		                            sizeof(struct cell) * new_cap);
+		if (!list) {
+			sr->failed = true;
+			return;
+		}
+		sr->next = list;
+		sr->next_cap = new_cap;
+	}
+	sr->next[sr->num_next++] = (struct cell) {row, w, empty};
+}
+
+/* Returns the stretches of set bits of open that hold a bit of bits,
+ * spreading each bit both ways at once, as far as it can go in doubling
+ * strides.
+ */
+static uint64_t fill_stretches(uint64_t bits, uint64_t open) {
+	uint64_t up = bits, down = bits;
+	uint64_t open_up = open, open_down = open;
+	for (unsigned shift = 1; shift < OCC_WORD_BITS; shift *= 2) {
+		up |= open_up & (up << shift);
+		open_up &= open_up << shift;
+		down |= open_down & (down >> shift);
+		open_down &= open_down >> shift;
+	}
+	return up | down;
+}
+
+/* Marks every Tile of a Stand the search has found as seen, so that none
+ * of the rest of its Tiles are looked up again.
+ *
+ * The source Grid of a Stand may hang off the Grid it is applied to, but
+ * only where it is empty.
+ */
+static void mark_stand(struct search *sr, stand s) {
+	grid src = s->source;
+	for (uint32_t cur_row = 0; cur_row < src->height; cur_row++) {
+		const uint64_t *src_bits =
+			src->occupancy + (size_t) cur_row * src->occ_stride;
+		for (uint32_t w = 0; w < src->occ_stride; w++) {
+			uint64_t bits = src_bits[w];
+			if (!bits)
+				continue;
+			uint64_t *seen = sr->seen + (size_t) (s->row + cur_row)
+				* sr->stride;
+
+			// the word lands across two words of the plane, the
+			// first of which may lie off the Grid to the left
+			int64_t column = s->column + (int64_t) w * OCC_WORD_BITS;
+			int64_t target = column >= 0 ? column / OCC_WORD_BITS
+				: -((OCC_WORD_BITS - 1 - column) / OCC_WORD_BITS);
+			uint32_t shift = column - target * OCC_WORD_BITS;
+			if (target >= 0)
+				seen[target] |= bits << shift;
+			if (shift && target + 1 < sr->stride)
+				seen[target + 1] |= bits >> (OCC_WORD_BITS - shift);
+		}
+	}
+}
+
+/* Finds the Stands beside the reached Tiles, by growing them into the
+ * seen plane of the search, and gives them distances of WALK_UNMEASURED.
+ * Growing only adds occupied Tiles, since the empty neighbours of reached
+ * Tiles were reached too.
+ *
+ * Returns the number of Stands that weren't found.
+ */
+static uint32_t find_touched(struct search *sr, const uint64_t *reached,
+                             uint32_t *distance) {
+	grid g = sr->g;
+	uint32_t stride = sr->stride;
+	for (uint32_t row = 0; row < g->height; row++) {
+		const uint64_t *cur = reached + (size_t) row * stride;
+		const uint64_t *above = row > 0 ? cur - stride : NULL;
+		const uint64_t *below = row + 1 < g->height ? cur + stride : NULL;
+		uint64_t *grown = sr->seen + (size_t) row * stride;
+		for (uint32_t w = 0; w < stride; w++) {
+			uint64_t bits = cur[w] | cur[w] << 1 | cur[w] >> 1;
+			if (w > 0)
+				bits |= cur[w - 1] >> (OCC_WORD_BITS - 1);
+			if (w + 1 < stride)
+				bits |= cur[w + 1] << (OCC_WORD_BITS - 1);
+			if (above)
+				bits |= above[w];
+			if (below)
+				bits |= below[w];
+			grown[w] = bits;
+		}
+		grown[stride - 1] &= sr->last_mask;
+	}
+
+	uint32_t num_unreachable = 0;
+	for (uint32_t i = 0; i < g->num_stands; i++) {
+		stand s = g->stands[i];
+		grid src = s->source;
+		bool touched = false;
+		for (uint32_t cur_row = 0;
+		     cur_row < src->height && !touched; cur_row++) {
+			const uint64_t *src_bits =
+				src->occupancy + (size_t) cur_row * src->occ_stride;
+			int64_t row = s->row + cur_row;
+			for (uint32_t w = 0; w < src->occ_stride; w++) {
+				if (!src_bits[w])
+					continue;
+				uint64_t window = occupancy_window(
+					sr->seen + (size_t) row * stride, stride,
+					s->column + (int64_t) w * OCC_WORD_BITS);
+				if (src_bits[w] & window) {
+					touched = true;
+					break;
+				}
+			}
+		}
+		if (touched)
+			distance[i] = WALK_UNMEASURED;
+		else
+			num_unreachable++;
+	}
+	return num_unreachable;
+}
+
+/* Splits the empty Tiles a search hasn't seen into pockets, searching from
+ * the first unseen Tile of each in turn.
+ */
+static bool find_pockets(struct search *sr, struct walk_result *out) {
+	grid g = sr->g;
+	uint32_t cap = 0;
+	for (uint32_t row = 0; row < g->height; row++) {
+		for (uint32_t w = 0; w < sr->stride; w++) {
+			size_t index = (size_t) row * sr->stride + w;
+			for (;;) {
+				uint64_t unseen = ~g->occupancy[index]
+					& ~sr->seen[index];
+				if (w == sr->stride - 1)
+					unseen &= sr->last_mask;
+				if (!unseen)
+					break;
+
+				start_search(sr);
+				add_seed(sr, row, w * OCC_WORD_BITS
+				         + __builtin_ctzll(unseen));
+				run_search(sr);
+				if (sr->failed)
+					return false;
+
+				if (out->num_pockets == cap) {
+					uint32_t new_cap = cap ? cap * 2 : 16;
+					struct walk_pocket *p = realloc(
+						out->pockets,
+						sizeof(struct walk_pocket)
+						* new_cap);
+					if (!p)
+						return false;
+					out->pockets = p;
+					cap = new_cap;
+				}
+				struct walk_pocket *p =
+					&out->pockets[out->num_pockets++];
+				p->e.row = sr->top;
+				p->e.column = sr->left;
+				p->e.height = sr->bottom - sr->top + 1;
+				p->e.width = sr->right - sr->left + 1;
+				p->tiles = sr->found;
+			}
+		}
+	}
+	return true;
+}
+
+/* Fills plane with the reached Tiles that no empty square min_aisle Tiles
+ * wide covers.
+ *
+ * The origins of the squares that fit are found first: a row of the plane
+ * marks where a run of min_aisle Tiles would run into a Stand, and ORing
+ * min_aisle rows of that together marks every square that doesn't fit. The
+ * squares that do are then smeared back down and across to cover their
+ * Tiles. Each smear doubles the distance covered, so it takes a few passes
+ * over the plane whatever the width.
+ */
+static void find_narrow(grid g, uint32_t min_aisle, uint64_t *plane,
+                        const uint64_t *reached) {
+	uint32_t stride = g->occ_stride;
+	uint32_t height = g->height;
+
+	// where a run of the width would hit something
+	for (uint32_t row = 0; row < height; row++) {
+		const uint64_t *bits = g->occupancy + (size_t) row * stride;
+		for (uint32_t w = 0; w < stride; w++)
+			plane[(size_t) row * stride + w] = occupancy_run_window(
+				bits, stride, (int64_t) w * OCC_WORD_BITS,
+				min_aisle);
+	}
+
+	// where the square would, working down from the top so each row
+	// still holds the rows below it from the last pass
+	for (uint32_t span = 1; span < min_aisle; ) {
+		uint32_t step = span < min_aisle - span
+			? span : min_aisle - span;
+		for (uint32_t row = 0; row + step < height; row++)
+			for (uint32_t w = 0; w < stride; w++)
+				plane[(size_t) row * stride + w] |=
+					plane[(size_t) (row + step) * stride + w];
+		span += step;
+	}
+
+	// the squares that fit, and lie on the Grid
+	for (uint32_t row = 0; row < height; row++) {
+		for (uint32_t w = 0; w < stride; w++) {
+			size_t index = (size_t) row * stride + w;
+			int64_t room = (int64_t) g->width - min_aisle
+				- (int64_t) w * OCC_WORD_BITS + 1;
+			uint64_t on_grid = room <= 0 ? 0
+				: room >= OCC_WORD_BITS ? ~(uint64_t) 0
+				: ((uint64_t) 1 << room) - 1;
+			if (row + min_aisle > height)
+				on_grid = 0;
+			plane[index] = ~plane[index] & on_grid;
+		}
+	}
+
+	// the Tiles they cover, down and then across, working from the
+	// bottom right so each word still holds the last pass
+	for (uint32_t span = 1; span < min_aisle; ) {
+		uint32_t step = span < min_aisle - span
+			? span : min_aisle - span;
+		for (uint32_t row = height; row-- > step; )
+			for (uint32_t w = 0; w < stride; w++)
+				plane[(size_t) row * stride + w] |=
+					plane[(size_t) (row - step) * stride + w];
+		span += step;
+	}
+	for (uint32_t span = 1; span < min_aisle; ) {
+		uint32_t step = span < min_aisle - span
+			? span : min_aisle - span;
+		for (uint32_t row = 0; row < height; row++) {
+			uint64_t *bits = plane + (size_t) row * stride;
+			for (uint32_t w = stride; w-- > 0; ) {
+				bits[w] |= bits[w] << step;
+				if (w > 0)
+					bits[w] |= bits[w - 1]
+						>> (OCC_WORD_BITS - step);
+			}
+		}
+		span += step;
+	}
+
+	size_t words = (size_t) height * stride;
+	for (size_t i = 0; i < words; i++)
+		plane[i] = reached[i] & ~plane[i];
+}
@@ -0,0 +1,82 @@
+/* walk.h
+ *
+ * This file contains declarations for working out where shoppers can walk
+ * on a Grid.
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WALK_H
+#define WALK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "grid.h"
+
+// the distance to a Stand no entrance reaches, and to one that can be
+// reached when distances weren't measured
+#define WALK_UNREACHABLE UINT32_MAX
+#define WALK_UNMEASURED (UINT32_MAX - 1)
+
+// widest aisle analyze_walk can check for
+#define WALK_MAX_AISLE OCC_WORD_BITS
+
+/* An empty Tile shoppers come in by. */
+struct walk_entrance {
+	int64_t row;
+	int64_t column;
+};
+
+/* A region of empty Tiles, connected to each other but to no entrance. */
+struct walk_pocket {
+	// bounding box of the region
+	struct extent e;
+	uint64_t tiles;
+};
+
+/* What analyze_walk found. The planes are laid out like the occupancy
+ * plane of the Grid, with one bit per Tile.
+ */
+struct walk_result {
+	// the empty Tiles that can be walked to from an entrance
+	uint64_t *reached;
+	uint64_t num_reached;
+
+	// for each Stand in the registry of the Grid, in registry order,
+	// the fewest steps from an entrance to an empty Tile beside it, or
+	// WALK_UNREACHABLE or WALK_UNMEASURED
+	uint32_t *distance;
+	uint32_t num_stands;
+	uint32_t num_unreachable;
+
+	struct walk_pocket *pockets;
+	uint32_t num_pockets;
+
+	// the reached Tiles where the aisle is narrower than asked for, or
+	// NULL if no width was asked for
+	uint64_t *narrow;
+	uint64_t num_narrow;
+};
+
+bool analyze_walk(grid g, const struct walk_entrance *entrances,
+                  uint32_t num_entrances, uint32_t min_aisle,
+                  bool measure, struct walk_result *out);
+void free_walk_result(struct walk_result *r);
+
+#endif
@@ -0,0 +1,85 @@
+/* workers.c
+ *
+ * This file contains definitions for splitting work across threads.
+ * 
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ * 
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "workers.h"
+
+struct worker_arg {
+	worker_fn fn;
+	void *job;
+	unsigned worker;
+	unsigned num_workers;
+};
+
+static void *start_worker(void *arg);
+
+/* Decides how many workers to split a job of the given number of items
+ * over: one per online processor, but none with fewer items than
+ * min_items_per_worker, as a thread costs more than a handful of items.
+ */
+unsigned num_workers_for(uint64_t items, uint64_t min_items_per_worker) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t n = min_items_per_worker ? items / min_items_per_worker
+	                                  : items;
+	if (cpus > 0 && n > (uint64_t) cpus)
+		n = cpus;
+	if (n > MAX_WORKERS)
+		n = MAX_WORKERS;
+	return n ? n : 1;
+}
+
+/* Runs fn for each of num_workers workers, and waits for all of them.
+ * 
+ * Worker 0 runs on the calling thread. If a thread can't be started, its
+ * worker runs on the calling thread as well, after worker 0, so the job
+ * still gets done, just not as quickly.
+ */
+void run_workers(worker_fn fn, void *job, unsigned num_workers) {
+	if (num_workers > MAX_WORKERS)
+		num_workers = MAX_WORKERS;
+
+	pthread_t threads[MAX_WORKERS];
+	struct worker_arg args[MAX_WORKERS];
+	bool started[MAX_WORKERS];
+	for (unsigned i = 1; i < num_workers; i++) {
+		args[i] = (struct worker_arg) {fn, job, i, num_workers};
+		started[i] = pthread_create(&threads[i], NULL,
+		                            start_worker, &args[i]) == 0;
+	}
+
+	fn(job, 0, num_workers);
+	for (unsigned i = 1; i < num_workers; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			fn(job, i, num_workers);
+	}
+}
+
+static void *start_worker(void *arg) {
+	struct worker_arg *a = arg;
+	a->fn(a->job, a->worker, a->num_workers);
+	return NULL;
+}
@@ -0,0 +1,40 @@
+/* workers.h
+ *
+ * Declares a minimal way of splitting work across threads, for the few
+ * places where the engine has enough independent work to make it pay.
+ * 
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ * 
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdint.h>
+
+// no more threads than this are ever started for one job
+#define MAX_WORKERS 64
+
+/* Does worker's share of a job. Workers 0 to num_workers - 1 all run at
+ * once, each on its own thread.
+ */
+typedef void (*worker_fn)(void *job, unsigned worker, unsigned num_workers);
+
+unsigned num_workers_for(uint64_t items, uint64_t min_items_per_worker);
+void run_workers(worker_fn fn, void *job, unsigned num_workers);
+
+#endif
@@ -0,0 +1,303 @@
+/* bench_io.c
+ *
+ * This file contains a benchmark of loading and saving maps, to hold
+ * changes to save_n_load.c and binfile.c against.
+ *
+ * Each file named is loaded, saved in the format it is in, and saved and
+ * loaded again in turn, several times over. Binary files are also browsed
+ * through open_map_index, the way an archive of past sales would be: the
+ * file is opened, the Stands in a screenful at its top left corner found,
+ * and only those decoded. For each the benchmark reports
+ * the time taken, megabytes and Stands per second, the number of heap
+ * allocations made and the peak resident set size of the process so far.
+ * Layouts to run it on can be made with gen_layout.
+ *
+ * Allocations are counted by wrapping the allocator at link time, so
+ * build from the top of the tree with:
+ *   gcc -std=gnu99 -O2 -Iengine $(pkg-config --cflags mono-2) \
+ *       -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc \
+ *       -o bench_io tools/bench_io.c engine/grid.c engine/stand.c \
+ *       engine/spatial.c engine/save_n_load.c engine/binfile.c \
+ *       engine/journal.c engine/workers.c engine/templib.c \
+ *       engine/origins.c -lpthread -lm
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "capi.h"
+#include "save_n_load.h"
+#include "binfile.h"
+
+// the engine's program state, normally owned by capi.c
+grid main_grid = NULL;
+struct stand_template *main_templates = NULL;
+int32_t num_main_templates = 0;
+
+// the part of a map browse_path decodes, about what fits on a screen
+#define BROWSE_ROWS    100
+#define BROWSE_COLUMNS 160
+
+// heap allocations made so far, by any thread
+static uint64_t num_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t num, size_t size) {
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+	return __real_calloc(num, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+	return __real_realloc(p, size);
+}
+
+/* What one phase of the benchmark measured over all its repetitions. */
+struct phase {
+	const char *name;
+	double seconds;
+	uint64_t bytes;
+	uint64_t stands;
+	uint64_t allocs;
+	double peak_mb;  // peak resident set size once the phase is done
+};
+
+static double now(void);
+static double peak_mb(void);
+static bool load_path(const char *path);
+static bool save_to(FILE *f, bool binary, uint64_t *bytes);
+static bool bench_file(const char *path, int reps);
+static bool browse_path(const char *path, uint64_t *decoded);
+static void report(const struct phase *p, int reps);
+
+int main(int argc, char *argv[]) {
+	int reps = 5;
+	int opt;
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		default:
+			reps = 0;
+		}
+	}
+	if (reps < 1 || optind == argc) {
+		fprintf(stderr, "usage: %s [-r repetitions] file...\n", argv[0]);
+		return 2;
+	}
+
+	printf("%-10s %10s %10s %12s %12s %10s\n", "phase", "ms/op", "MB/s",
+	       "stands/s", "allocs/op", "peak MB");
+	bool ok = true;
+	for (int i = optind; i < argc; i++)
+		ok &= bench_file(argv[i], reps);
+	return ok ? 0 : 1;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double peak_mb(void) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0;
+}
+
+static bool load_path(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return false;
+	}
+	bool ok = load_file(f);
+	fclose(f);
+	if (!ok)
+		fprintf(stderr, "%s: %s\n", path, get_load_error(NULL));
+	return ok;
+}
+
+/* Saves the program state to f, and stores how many bytes that took. */
+static bool save_to(FILE *f, bool binary, uint64_t *bytes) {
+	if (!(binary ? save_file_binary(f) : save_file(f)) || fflush(f) != 0)
+		return false;
+	double seconds;
+	get_save_stats(bytes, &seconds);
+	return true;
+}
+
+static bool bench_file(const char *path, int reps) {
+	// the first load is a warm-up, which also tells what is in the file
+	if (!load_path(path))
+		return false;
+	uint64_t stands = main_grid->num_stands;
+	FILE *f = fopen(path, "rb");
+	char header[8] = "";
+	size_t header_len = f ? fread(header, 1, sizeof(header) - 1, f) : 0;
+	long file_bytes = f && fseek(f, 0, SEEK_END) == 0 ? ftell(f) : 0;
+	if (f)
+		fclose(f);
+	bool binary = header_len == 7 && strcmp(header, "MMGS:2;") == 0;
+	printf("%s: %" PRIu64 " stands, %ld bytes\n", path, stands, file_bytes);
+
+	struct phase load = {"load", 0, 0, 0, 0, 0};
+	struct phase save = {"save", 0, 0, 0, 0, 0};
+	struct phase trip = {"roundtrip", 0, 0, 0, 0, 0};
+
+	for (int i = 0; i < reps; i++) {
+		uint64_t allocs = num_allocs;
+		double start = now();
+		if (!load_path(path))
+			return false;
+		load.seconds += now() - start;
+		load.allocs += num_allocs - allocs;
+		load.bytes += file_bytes;
+		load.stands += stands;
+	}
+	load.peak_mb = peak_mb();
+
+	for (int i = 0; i < reps; i++) {
+		FILE *out = tmpfile();
+		if (!out)
+			return false;
+		uint64_t bytes;
+		uint64_t allocs = num_allocs;
+		double start = now();
+		bool ok = save_to(out, binary, &bytes);
+		save.seconds += now() - start;
+		save.allocs += num_allocs - allocs;
+		fclose(out);
+		if (!ok) {
+			fprintf(stderr, "%s: could not save\n", path);
+			return false;
+		}
+		save.bytes += bytes;
+		save.stands += stands;
+	}
+	save.peak_mb = peak_mb();
+
+	// saved and read straight back in
+	for (int i = 0; i < reps; i++) {
+		FILE *out = tmpfile();
+		if (!out)
+			return false;
+		uint64_t bytes;
+		uint64_t allocs = num_allocs;
+		double start = now();
+		bool ok = save_to(out, binary, &bytes);
+		ok = ok && fseek(out, 0, SEEK_SET) == 0 && load_file(out);
+		trip.seconds += now() - start;
+		trip.allocs += num_allocs - allocs;
+		fclose(out);
+		if (!ok) {
+			fprintf(stderr, "%s: round trip failed\n", path);
+			return false;
+		}
+		trip.bytes += 2 * bytes;
+		trip.stands += stands;
+	}
+	trip.peak_mb = peak_mb();
+
+	struct phase browse = {"index", 0, 0, 0, 0, 0};
+	for (int i = 0; binary && i < reps; i++) {
+		uint64_t decoded;
+		uint64_t allocs = num_allocs;
+		double start = now();
+		if (!browse_path(path, &decoded))
+			return false;
+		browse.seconds += now() - start;
+		browse.allocs += num_allocs - allocs;
+		browse.bytes += file_bytes;
+		browse.stands += decoded;
+	}
+	browse.peak_mb = peak_mb();
+
+	report(&load, reps);
+	report(&save, reps);
+	report(&trip, reps);
+	if (binary)
+		report(&browse, reps);
+	return true;
+}
+
+/* Opens a binary file with open_map_index and decodes the Stands in the
+ * top left corner of the map, storing how many there were.
+ */
+static bool browse_path(const char *path, uint64_t *decoded) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return false;
+	}
+	map_index mi = open_map_index(f);
+	fclose(f);
+	if (!mi) {
+		fprintf(stderr, "%s: could not open the index\n", path);
+		return false;
+	}
+
+	struct extent view = {0, 0, BROWSE_ROWS, BROWSE_COLUMNS};
+	uint32_t found = map_index_in_rect(mi, &view, NULL, 0);
+	uint32_t *nums = malloc((found ? found : 1) * sizeof(uint32_t));
+	bool ok = nums != NULL;
+	if (ok)
+		map_index_in_rect(mi, &view, nums, found);
+	for (uint32_t i = 0; ok && i < found; i++) {
+		stand s = map_index_stand(mi, nums[i]);
+		if (!s) {
+			fprintf(stderr, "%s: Stand %" PRIu32 " is malformed\n",
+			        path, nums[i]);
+			ok = false;
+			break;
+		}
+		del_stand(s);
+	}
+	free(nums);
+	del_map_index(mi);
+	*decoded = found;
+	return ok;
+}
+
+static void report(const struct phase *p, int reps) {
+	printf("%-10s %10.2f %10.1f %12.0f %12.0f %10.1f\n", p->name,
+	       p->seconds * 1000.0 / reps, p->bytes / p->seconds / 1e6,
+	       p->stands / p->seconds, (double) p->allocs / reps,
+	       p->peak_mb);
+}
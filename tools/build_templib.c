@@ -0,0 +1,86 @@
+/* build_templib.c
+ *
+ * This file contains a tool that compiles the Stand Templates of a map
+ * into a template library (see engine/templib.c), for engines to share
+ * with --template-library.
+ *
+ * Build from the top of the tree with:
+ *   gcc -std=gnu99 -O2 -Iengine $(pkg-config --cflags mono-2) \
+ *       -o build_templib tools/build_templib.c engine/grid.c \
+ *       engine/stand.c engine/spatial.c engine/save_n_load.c \
+ *       engine/binfile.c engine/journal.c engine/workers.c \
+ *       engine/templib.c engine/origins.c -lpthread -lm
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "capi.h"
+#include "save_n_load.h"
+#include "templib.h"
+
+// the engine's program state, normally owned by capi.c
+grid main_grid = NULL;
+struct stand_template *main_templates = NULL;
+int32_t num_main_templates = 0;
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s map library%s\n", argv[0],
+		        TEMPLATE_LIBRARY_EXTENSION);
+		return 2;
+	}
+
+	FILE *f = fopen(argv[1], "rb");
+	if (!f) {
+		perror(argv[1]);
+		return 1;
+	}
+	bool ok = load_file(f);
+	fclose(f);
+	if (!ok) {
+		size_t offset;
+		const char *why = get_load_error(&offset);
+		fprintf(stderr, "%s: %s at byte %zu\n", argv[1], why, offset);
+		return 1;
+	}
+
+	f = fopen(argv[2], "wb");
+	if (!f) {
+		perror(argv[2]);
+		return 1;
+	}
+	ok = save_template_library(f, main_templates, num_main_templates);
+	if (fclose(f) != 0)
+		ok = false;
+	if (!ok) {
+		fprintf(stderr, "could not write %s\n", argv[2]);
+		remove(argv[2]);
+		return 1;
+	}
+	fprintf(stderr, "%s: %" PRIi32 " Stand Templates\n", argv[2],
+	        num_main_templates);
+	return 0;
+}
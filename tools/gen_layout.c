@@ -0,0 +1,294 @@
+/* gen_layout.c
+ *
+ * This file contains a generator of large garage sale layouts, for
+ * measuring how the engine copes with maps far bigger than the sample.
+ *
+ * Every layout is built with the engine itself and saved with save_file
+ * (or save_file_binary, for a name ending in .mmgb), so it is always a
+ * valid map. The same options and seed always give the same file.
+ *
+ * Build from the top of the tree with:
+ *   gcc -std=gnu99 -O2 -Iengine $(pkg-config --cflags mono-2) \
+ *       -o gen_layout tools/gen_layout.c engine/grid.c engine/stand.c \
+ *       engine/spatial.c engine/save_n_load.c engine/binfile.c \
+ *       engine/journal.c engine/workers.c engine/templib.c \
+ *       engine/origins.c -lpthread -lm
+ *
+ * Copyright (C) 2014 - Blake Lowe, Jordan Polaniec
+ *
+ * This file is part of Map My Garage Sale.
+ *
+ * Map My Garage Sale is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Map My Garage Sale is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Map My Garage Sale. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "grid.h"
+#include "stand.h"
+#include "capi.h"
+#include "save_n_load.h"
+#include "binfile.h"
+
+// the engine's program state, normally owned by capi.c
+grid main_grid = NULL;
+struct stand_template *main_templates = NULL;
+int32_t num_main_templates = 0;
+
+struct options {
+	uint32_t width;
+	uint32_t height;
+	int32_t num_templates;
+	uint32_t max_stands;
+	double fill;
+	uint32_t max_shape;
+	uint64_t seed;
+};
+
+static uint64_t rng_state;
+
+static void usage(const char *prog);
+static uint64_t next_random(void);
+static uint32_t random_below(uint32_t n);
+static bool make_templates(const struct options *o, uint32_t *tiles);
+static uint32_t place_stands(const struct options *o, const uint32_t *tiles,
+                             uint64_t *occupied);
+
+int main(int argc, char *argv[]) {
+	struct options o = {1000, 1000, 16, UINT32_MAX, 0.4, 12, 1};
+	int opt;
+	while ((opt = getopt(argc, argv, "W:H:t:n:f:m:s:")) != -1) {
+		switch (opt) {
+		case 'W':
+			o.width = strtoul(optarg, NULL, 10);
+			break;
+		case 'H':
+			o.height = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			o.num_templates = strtol(optarg, NULL, 10);
+			break;
+		case 'n':
+			o.max_stands = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			o.fill = strtod(optarg, NULL);
+			break;
+		case 'm':
+			o.max_shape = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			o.seed = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (optind != argc - 1 || o.width == 0 || o.height == 0
+	    || o.num_templates < 1 || o.max_shape < 2
+	    || o.fill < 0.0 || o.fill > 1.0) {
+		usage(argv[0]);
+		return 2;
+	}
+	const char *path = argv[optind];
+	// xorshift gets stuck on zero
+	rng_state = o.seed * 0x9e3779b97f4a7c15ull | 1;
+
+	if ((uint64_t) o.width * o.height > SPARSE_GRID_MIN_TILES)
+		main_grid = new_sparse_grid(o.width, o.height);
+	else
+		main_grid = new_grid(o.width, o.height);
+	uint32_t *tiles = malloc(sizeof(uint32_t) * o.num_templates);
+	if (!main_grid || !tiles || !make_templates(&o, tiles)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	uint64_t occupied;
+	uint32_t placed = place_stands(&o, tiles, &occupied);
+	free(tiles);
+
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+	size_t len = strlen(path);
+	size_t ext_len = strlen(BINARY_FILE_EXTENSION);
+	bool ok;
+	if (len >= ext_len
+	    && strcmp(path + len - ext_len, BINARY_FILE_EXTENSION) == 0)
+		ok = save_file_binary(f);
+	else
+		ok = save_file(f);
+	if (fclose(f) != 0)
+		ok = false;
+	if (!ok) {
+		fprintf(stderr, "could not save %s\n", path);
+		return 1;
+	}
+
+	uint64_t bytes;
+	double seconds;
+	get_save_stats(&bytes, &seconds);
+	fprintf(stderr, "%s: %" PRIu32 "x%" PRIu32 ", %" PRIi32 " templates, "
+	        "%" PRIu32 " stands, %.1f%% filled, %" PRIu64 " bytes\n",
+	        path, o.width, o.height, o.num_templates, placed,
+	        100.0 * occupied / ((double) o.width * o.height), bytes);
+	return 0;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr,
+	        "usage: %s [-W width] [-H height] [-t templates] [-n stands]\n"
+	        "          [-f fill] [-m max shape size] [-s seed] file\n"
+	        "\n"
+	        "Stands are placed until the map is about fill (0-1) full\n"
+	        "or there are as many as -n asks for.\n", prog);
+}
+
+/* xorshift64*, which is plenty for picking shapes and spots. */
+static uint64_t next_random(void) {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static uint32_t random_below(uint32_t n) {
+	return next_random() % n;
+}
+
+/* Builds the Stand Templates: rectangles, half of them with a corner cut
+ * out to make an L. Every shape fills its bounding box, so a Stand's Grid
+ * is exactly the space it takes. Stores the number of Tiles of each.
+ */
+static bool make_templates(const struct options *o, uint32_t *tiles) {
+	static const char *const kinds[] = {
+		"Table", "Rack", "Bin", "Shelf", "Cart", "Booth"
+	};
+
+	main_templates = calloc(o->num_templates, sizeof(struct stand_template));
+	if (!main_templates)
+		return false;
+	num_main_templates = o->num_templates;
+
+	for (int32_t i = 0; i < o->num_templates; i++) {
+		stand_template t = main_templates + i;
+		uint32_t width = 2 + random_below(o->max_shape - 1);
+		uint32_t height = 2 + random_below(o->max_shape - 1);
+		uint32_t cut_width = 0, cut_height = 0;
+		if (next_random() & 1) {
+			cut_width = 1 + random_below(width - 1);
+			cut_height = 1 + random_below(height - 1);
+		}
+
+		grid g = new_grid(width, height);
+		if (!g)
+			return false;
+		stand_like tl;
+		tl.stand_proto.type = STAND_TEMPLATE;
+		tl.stand_st.st = t;
+		tiles[i] = 0;
+		for (uint32_t row = 0; row < height; row++) {
+			for (uint32_t column = 0; column < width; column++) {
+				if (row < cut_height && column < cut_width)
+					continue;
+				grid_set_stand(g, row, column, tl);
+				tiles[i]++;
+			}
+		}
+		t->t = g;
+		t->orients = new_orientation_set(g);
+		t->name = malloc(32);
+		if (!t->orients || !t->name)
+			return false;
+		snprintf(t->name, 32, "%s %" PRIi32,
+		         kinds[i % (sizeof(kinds) / sizeof(kinds[0]))], i + 1);
+		t->red = random_below(256) / 255.0;
+		t->green = random_below(256) / 255.0;
+		t->blue = random_below(256) / 255.0;
+		t->alpha = 1.0;
+	}
+	return true;
+}
+
+/* Lays Stands out along shelves as tall as the largest shape, left to
+ * right and top to bottom, in random templates and orientations. A spot is
+ * skipped whenever the map so far is already as full as asked for, which
+ * spreads the Stands evenly; a fill beyond what shelves can pack just
+ * packs them as tightly as they go. A limit on the number of Stands lowers
+ * the fill to match, so that they still spread over the whole map.
+ *
+ * Returns how many Stands were placed, and stores how many Tiles they
+ * cover.
+ */
+static uint32_t place_stands(const struct options *o, const uint32_t *tiles,
+                             uint64_t *occupied) {
+	uint32_t shelf = o->max_shape;
+	uint32_t placed = 0;
+	*occupied = 0;
+
+	// whether a spot is used doesn't depend on the shape drawn for it,
+	// or small shapes would win out
+	double mean_tiles = 0;
+	for (int32_t i = 0; i < o->num_templates; i++)
+		mean_tiles += (double) tiles[i] / o->num_templates;
+	double fill = o->fill;
+	if (o->max_stands != UINT32_MAX) {
+		double enough = o->max_stands * mean_tiles
+			/ ((double) o->width * o->height);
+		if (enough < fill)
+			fill = enough;
+	}
+
+	for (uint32_t top = 0; top < o->height && placed < o->max_stands;
+	     top += shelf) {
+		uint32_t column = 0;
+		while (placed < o->max_stands) {
+			int32_t ti = random_below(o->num_templates);
+			stand s = new_stand(main_templates + ti);
+			if (!s)
+				return placed;
+			set_stand_orientation(s, random_below(NUM_SYMMETRIES));
+			uint32_t width = s->source->width;
+			uint32_t height = s->source->height;
+			if (column + width > o->width) {
+				del_stand(s);
+				break;
+			}
+
+			double seen = (double) top * o->width
+				+ (double) (column + width) * shelf;
+			uint32_t row = top + random_below(shelf - height + 1);
+			if (*occupied + mean_tiles <= fill * seen
+			    && row + height <= o->height
+			    && can_apply(s, main_grid, row, column)) {
+				do_apply(s);
+				*occupied += tiles[ti];
+				placed++;
+			} else {
+				del_stand(s);
+			}
+			column += width;
+		}
+	}
+	return placed;
+}